@@ -0,0 +1,179 @@
+import cmsgpack
+
+# The file buffer sizes to compare, the default is 8192
+CHUNK_SIZES = [1024, 4096, 8192, 65536, 262144, 1048576]
+
+RUNS = 3
+
+# The number of bytes of records to write per run, per record size distribution
+TARGET_BYTES = 32 * 1024 * 1024
+
+# Each run writes a fresh file and reads it back, with the page cache warm or dropped before reading
+
+
+
+import os
+import random
+import string
+import sys
+import tempfile
+import time
+
+random.seed(0xA1B2C3D4)
+
+def random_string(mmin, mmax):
+    return ''.join(random.choices(string.ascii_letters + string.digits, k=random.randint(mmin, mmax)))
+
+def generate_record(nfields, mmin, mmax):
+    return {f"field_{i}": random_string(mmin, mmax) for i in range(nfields)}
+
+def generate_distributions():
+    " Pools of records to draw from, per record size distribution "
+
+    return {
+        "small (~64 B)": [generate_record(2, 8, 32) for _ in range(1024)],
+        "medium (~1 KB)": [generate_record(8, 64, 192) for _ in range(1024)],
+        "large (~64 KB)": [generate_record(16, 2048, 6144) for _ in range(64)],
+        "mixed": (
+            [generate_record(2, 8, 32) for _ in range(900)] +
+            [generate_record(8, 64, 192) for _ in range(90)] +
+            [generate_record(16, 2048, 6144) for _ in range(10)]
+        ),
+    }
+
+
+def io_counters():
+    " Get the number of read/write syscalls made by this process so far, or None if unavailable "
+
+    try:
+        with open("/proc/self/io") as f:
+            fields = dict(line.split(": ") for line in f.read().splitlines())
+
+        return int(fields["syscr"]), int(fields["syscw"])
+
+    except (OSError, KeyError, ValueError):
+        return None
+
+def drop_cache(path):
+    " Drop the pages of the file from the page cache, returns whether that's supported "
+
+    if not hasattr(os, "posix_fadvise"):
+        return False
+
+    fd = os.open(path, os.O_RDONLY)
+
+    try:
+        # Only clean pages are dropped, so make sure everything is written back first
+        os.fsync(fd)
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+
+    finally:
+        os.close(fd)
+
+    return True
+
+
+def measure(path, records, chunk_size, cold):
+    " Write all records to a fresh file and read them back, and return the timings and syscall counts "
+
+    open(path, "wb").close()
+
+    stream = cmsgpack.FileStream(path, chunk_size=chunk_size)
+    encode = stream.encode
+
+    io_start = io_counters()
+    start = time.perf_counter()
+
+    for record in records:
+        encode(record)
+
+    encode_time = time.perf_counter() - start
+    io_encoded = io_counters()
+
+    # Close the file to flush it, and open a new stream for reading
+    del stream, encode
+
+    if cold and not drop_cache(path):
+        return None
+
+    stream = cmsgpack.FileStream(path, chunk_size=chunk_size)
+    decode = stream.decode
+
+    io_decode_start = io_counters()
+    start = time.perf_counter()
+
+    for _ in range(len(records)):
+        decode()
+
+    decode_time = time.perf_counter() - start
+    io_decoded = io_counters()
+
+    del stream, decode
+
+    result = {
+        "encode": encode_time,
+        "decode": decode_time,
+        "syscw": None,
+        "syscr": None,
+    }
+
+    if io_start is not None:
+        # Writes are counted during encoding, reads during decoding (the counters include all syscalls of the process)
+        result["syscw"] = (io_encoded[1] - io_start[1]) / len(records)
+        result["syscr"] = (io_decoded[0] - io_decode_start[0]) / len(records)
+
+    return result
+
+
+def throughput_str(nbytes, seconds):
+    return f"{nbytes / seconds / (1024 * 1024):8.1f} MB/s"
+
+def syscalls_str(n):
+    return f"{n:9.4f}" if n is not None else "      n/a"
+
+
+distributions = generate_distributions()
+cache_modes = {"warm": False, "dropped": True}
+
+print(f"## FileStream I/O benchmark ##")
+print(f"\n{RUNS} runs per chunk size and distribution, {TARGET_BYTES // (1024 * 1024)} MB of records per run, best run is shown")
+print("\nEncode:    throughput of `FileStream.encode`, including the writes")
+print("Decode:    throughput of `FileStream.decode`, including the reads")
+print("Writes:    write syscalls per record while encoding")
+print("Reads:     read syscalls per record while decoding")
+
+if io_counters() is None:
+    print("\n/proc/self/io is unavailable, syscall counts are not shown")
+
+with tempfile.TemporaryDirectory() as tmpdir:
+    path = os.path.join(tmpdir, "filestream_bench.bin")
+
+    for name, pool in distributions.items():
+        pool_size = sum(len(cmsgpack.encode(r)) for r in pool)
+        nrecords = max(1, TARGET_BYTES * len(pool) // pool_size)
+        records = [pool[i % len(pool)] for i in range(nrecords)]
+        nbytes = sum(len(cmsgpack.encode(r)) for r in records)
+
+        print(f"\n\n# Records '{name}': {nrecords} records, {nbytes / nrecords:.0f} B on average\n")
+
+        for mode, cold in cache_modes.items():
+            print(f"  Cache: {mode}\n")
+            print("  Chunk size  |  Encode        |  Decode        |  Writes    |  Reads")
+            print("--------------+----------------+----------------+------------+------------")
+
+            for chunk_size in CHUNK_SIZES:
+                runs = [measure(path, records, chunk_size, cold) for _ in range(RUNS)]
+
+                if None in runs:
+                    print(f"  {chunk_size:10d}  |  dropping the page cache is not supported on this system")
+                    break
+
+                encode_time = min(r["encode"] for r in runs)
+                decode_time = min(r["decode"] for r in runs)
+
+                print(f"  {chunk_size:10d}  |  {throughput_str(nbytes, encode_time)} |  {throughput_str(nbytes, decode_time)} |  {syscalls_str(runs[0]['syscw'])} |  {syscalls_str(runs[0]['syscr'])}")
+
+            print()
+
+    if os.path.exists(path):
+        os.remove(path)
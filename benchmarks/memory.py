@@ -0,0 +1,191 @@
+import cmsgpack
+
+RUNS = 5
+
+# Each measurement is done in a separate process so that peak RSS values don't carry over
+
+
+
+import json
+import random
+import string
+import subprocess
+import sys
+import tracemalloc
+
+random.seed(0xA1B2C3D4)
+
+def random_string(mmin, mmax):
+    return ''.join(random.choices(string.ascii_letters + string.digits, k=random.randint(mmin, mmax)))
+
+def generate_record():
+    return {
+        "id": random.randint(1, 1_000_000),
+        "name": random_string(5, 12),
+        "email": random_string(10, 15) + "@example.com",
+        "verified": random.choice([True, False]),
+        "score": random.uniform(0, 100),
+        "tags": [random_string(4, 8) for _ in range(5)],
+    }
+
+# Functions that generate the values of each category, so that a process only generates the category it measures
+test_values = {
+    "small_strs": lambda: [
+        random_string(0, 31)
+        for _ in range(100_000)
+    ],
+
+    "large_strs": lambda: [
+        random_string(0x1000, 0xFFFF)
+        for _ in range(256)
+    ],
+
+    "bins": lambda: [
+        random.randbytes(random.randint(0x100, 0xFFFF))
+        for _ in range(256)
+    ],
+
+    "ints": lambda: [
+        random.randint(-(2**63), 2**64-1)
+        for _ in range(100_000)
+    ],
+
+    "floats": lambda: [
+        random.uniform(-1e308, 1e308)
+        for _ in range(100_000)
+    ],
+
+    "records": lambda: [
+        generate_record()
+        for _ in range(10_000)
+    ],
+
+    "nested": lambda: generate_record() | {
+        "children": [
+            generate_record() | {"children": [generate_record() for _ in range(10)]}
+            for _ in range(100)
+        ]
+    },
+}
+
+
+def read_peak_rss():
+    " Get the peak RSS in bytes since it was last reset, or None if unavailable "
+
+    try:
+        with open("/proc/self/status") as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1]) * 1024
+
+    except (OSError, ValueError):
+        pass
+
+    return None
+
+def reset_peak_rss():
+    " Reset the peak RSS to the current RSS, so that generating the data doesn't count towards it "
+
+    try:
+        with open("/proc/self/clear_refs", "w") as f:
+            f.write("5")
+
+        return True
+
+    except OSError:
+        return False
+
+
+# The operations to measure, each getting the value and its encoded form
+stream = cmsgpack.Stream()
+stream_raw = cmsgpack.Stream(raw_depth=1)
+
+options = {
+    "encode": lambda v, e: cmsgpack.encode(v),
+    "Stream.encode": lambda v, e: stream.encode(v),
+    "decode": lambda v, e: cmsgpack.decode(e),
+    "decode(raw_depth=1)": lambda v, e: stream_raw.decode(e),
+}
+
+
+def measure(category, option):
+    " Measure a single category and option, and return the results in bytes "
+
+    value = test_values[category]()
+    encoded = cmsgpack.encode(value)
+    func = options[option]
+
+    rss_before = read_peak_rss() if reset_peak_rss() else None
+
+    # Warm up the adaptive allocation heuristics
+    for _ in range(RUNS):
+        func(value, encoded)
+
+    tracemalloc.start()
+
+    peak = 0
+    retained = 0
+    for _ in range(RUNS):
+        tracemalloc.reset_peak()
+        start, _ = tracemalloc.get_traced_memory()
+
+        result = func(value, encoded)
+
+        current, run_peak = tracemalloc.get_traced_memory()
+
+        peak = max(peak, run_peak - start)
+        retained = max(retained, current - start)
+
+        del result
+
+    tracemalloc.stop()
+
+    rss_after = read_peak_rss()
+
+    return {
+        "peak": peak,
+        "retained": retained,
+        "encoded": len(encoded),
+        "nitems": len(value),
+        "rss_growth": rss_after - rss_before if rss_before is not None and rss_after is not None else None,
+    }
+
+
+def size_str(n):
+    for unit in ("B", "KB", "MB", "GB"):
+        if abs(n) < 1024:
+            return f"{n:.1f} {unit}"
+
+        n /= 1024
+
+    return f"{n:.1f} TB"
+
+
+if len(sys.argv) == 4 and sys.argv[1] == "--child":
+    print(json.dumps(measure(sys.argv[2], sys.argv[3])))
+    sys.exit()
+
+
+categories = list(test_values.keys())
+
+print(f"## MessagePack memory benchmark ##")
+print(f"\n{RUNS} runs per category and option, peak values are the largest of all runs")
+print("\nPeak:      highest traced memory during the call")
+print("Retained:  traced memory still held by the returned object")
+print("Per item:  retained memory per item of the top-level container")
+print("Overhead:  retained memory relative to the encoded size")
+print("RSS:       growth of the peak RSS during the runs, over the RSS after generating the data")
+
+for cat in categories:
+    print(f"\n\n# Category '{cat}':\n")
+    print("  Option                |  Peak         |  Retained     |  Per item     |  Overhead  |  RSS")
+    print("------------------------+---------------+---------------+---------------+------------+--------------")
+
+    for option in options:
+        output = subprocess.run([sys.executable, __file__, "--child", cat, option], capture_output=True, text=True, check=True).stdout
+        res = json.loads(output)
+
+        per_item = res["retained"] / res["nitems"] if res["nitems"] else 0
+        overhead = res["retained"] / res["encoded"] if res["encoded"] else 0
+
+        print(f"  {option:21s} |  {size_str(res['peak']):11s}  |  {size_str(res['retained']):11s}  |  {size_str(per_item):11s}  |  {overhead:7.2f}x  |  {size_str(res['rss_growth']) if res['rss_growth'] is not None else 'n/a'}")
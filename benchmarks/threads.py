@@ -0,0 +1,143 @@
+import cmsgpack
+
+# The thread counts to measure, capped at the number of CPUs (or at the first command line argument if given)
+THREADS = [1, 2, 4, 8, 16]
+
+RUNS = 3
+
+# The number of operations each thread does per run
+ITERATIONS = 2000
+
+# On GIL builds threads take turns, so per-thread throughput is expected to drop by the thread count.
+# On free-threaded builds (e.g. 3.13t) it should stay close to the single-thread value
+
+
+
+import os
+import random
+import string
+import sys
+import threading
+import time
+
+random.seed(0xA1B2C3D4)
+
+def random_string(mmin, mmax):
+    return ''.join(random.choices(string.ascii_letters + string.digits, k=random.randint(mmin, mmax)))
+
+def generate_record():
+    return {
+        "id": random.randint(1, 1_000_000),
+        "name": random_string(5, 12),
+        "email": random_string(10, 15) + "@example.com",
+        "verified": random.choice([True, False]),
+        "score": random.uniform(0, 100),
+        "tags": [random_string(4, 8) for _ in range(5)],
+    }
+
+def generate_test_values():
+    return {
+        # Short strings go through the string cache while decoding, which is shared between threads
+        "records": [generate_record() for _ in range(50)],
+        "ints": [random.randint(-(2**63), 2**63 - 1) for _ in range(500)],
+    }
+
+
+# The operations to measure. Each gets the value and its encoded form, and a Stream object to use
+operations = {
+    "encode": lambda v, e, s: cmsgpack.encode(v),
+    "decode": lambda v, e, s: cmsgpack.decode(e),
+    "Stream.encode": lambda v, e, s: s.encode(v),
+    "Stream.decode": lambda v, e, s: s.decode(e),
+}
+
+# Whether the threads share the value and Stream object, or each get their own copies
+sharing_modes = {
+    "shared": True,
+    "per-thread": False,
+}
+
+
+def run(nthreads, op, value, shared):
+    " Run OP on NTHREADS threads, and return the wall time, CPU time, and the time of each thread "
+
+    encoded = cmsgpack.encode(value)
+    shared_stream = cmsgpack.Stream()
+
+    times = [0.0] * nthreads
+    barrier = threading.Barrier(nthreads + 1)
+
+    def worker(i):
+        if shared:
+            v, e, s = value, encoded, shared_stream
+        else:
+            # Separate copies, so that threads don't touch the same objects or refcounts
+            e = bytes(bytearray(encoded))
+            v, s = cmsgpack.decode(e), cmsgpack.Stream()
+
+        barrier.wait()
+        start = time.perf_counter()
+
+        for _ in range(ITERATIONS):
+            op(v, e, s)
+
+        times[i] = time.perf_counter() - start
+
+    threads = [threading.Thread(target=worker, args=(i,)) for i in range(nthreads)]
+
+    for t in threads:
+        t.start()
+
+    cpu_start = time.process_time()
+    barrier.wait()
+    start = time.perf_counter()
+
+    for t in threads:
+        t.join()
+
+    wall = time.perf_counter() - start
+    cpu = time.process_time() - cpu_start
+
+    return wall, cpu, times
+
+
+gil_enabled = sys._is_gil_enabled() if hasattr(sys, "_is_gil_enabled") else True
+ncpus = os.cpu_count() or 1
+max_threads = int(sys.argv[1]) if len(sys.argv) > 1 else ncpus
+thread_counts = [n for n in THREADS if n <= max_threads] or [1]
+
+print(f"## MessagePack thread scaling benchmark ##")
+print(f"\nPython {sys.version.split()[0]}, GIL {'enabled' if gil_enabled else 'disabled'}, {ncpus} CPUs")
+print(f"{RUNS} runs per option, {ITERATIONS} operations per thread per run, best run is shown")
+print("\nPer thread:  operations per second per thread")
+print("Total:       operations per second of all threads together")
+print("Scaling:     total throughput relative to a single thread, ideally equal to the thread count")
+print("CPU/op:      CPU time per operation relative to a single thread, above 1.0 means time spent waiting on locks or cache lines")
+print("Spread:      slowest thread's time relative to the fastest, above 1.0 means threads didn't progress evenly")
+
+values = generate_test_values()
+
+for cat, value in values.items():
+    for op_name, op in operations.items():
+        for mode, shared in sharing_modes.items():
+            print(f"\n\n# '{cat}', {op_name}, {mode} objects:\n")
+            print("  Threads  |  Per thread    |  Total         |  Scaling  |  CPU/op   |  Spread")
+            print("-----------+----------------+----------------+-----------+-----------+----------")
+
+            base_total = None
+            base_cpu = None
+
+            for nthreads in thread_counts:
+                results = [run(nthreads, op, value, shared) for _ in range(RUNS)]
+                wall, cpu, times = min(results, key=lambda r: r[0])
+
+                nops = nthreads * ITERATIONS
+                total = nops / wall
+                cpu_per_op = cpu / nops
+
+                if base_total is None:
+                    base_total, base_cpu = total, cpu_per_op
+
+                spread = max(times) / min(times) if min(times) > 0 else 0.0
+
+                print(f"  {nthreads:7d}  |  {total / nthreads:10.0f}/s  |  {total:10.0f}/s  |  {total / base_total:7.2f}x |  {cpu_per_op / base_cpu:7.2f}x |  {spread:6.2f}x")
@@ -2,4 +2,5 @@ __author__ = "Sven Boertjens"
 __license__ = "MIT License"
 __url__ = "https://github.com/svenboertjens/cmsgpack"
 
-from .cmsgpack import encode, decode, Extensions, extensions, Stream, FileStream
+from .cmsgpack import encode, decode, iter_array, iter_items, patch, merge_maps, on_slow, Raw, Extensions, extensions, Stream, FileStream, _C_API
+from .scanning import scan_files
@@ -2,8 +2,12 @@
 
 #define PY_SSIZE_T_CLEAN
 
+// Only take the C API types from its header, the import helpers are for other modules
+#define CMSGPACK_MODULE
+
 #include "masks.h"
 #include "internals.h"
+#include "cmsgpack_capi.h"
 
 #include <Python.h>
 #include <stdbool.h>
@@ -16,6 +20,10 @@
 // Default file buffer size
 #define FILEBUF_DEFAULTSIZE 8192 // 8 KB
 
+// Offset alignment and minimum block buffer size for direct I/O reads
+#define DIRECTIO_ALIGN 4096
+#define DIRECTIO_MINSIZE (1024 * 1024) // 1 MB
+
 // The number of slots to use in caches
 #define STRING_CACHE_SLOTS 512
 #define INTEGER_CACHE_SLOTS (255 + 1 + 128) // 255 positive, 128 negative, and a zero
@@ -28,12 +36,44 @@
 // Recursion limit
 #define RECURSION_LIMIT 1000
 
+// Number of entries per set in decode caches, and the maximum size of encoded data to cache
+#define DECODE_CACHE_WAYS 4
+#define DECODE_CACHE_MAXSIZE 4096 // 4 KB
+
+// Minimum number of items of lists and tuples to attempt to write as packed integer arrays
+#define INT_ARRAY_MIN_ITEMS 8
+
+// Minimum size of binary data to pass out-of-band when a buffer callback is given
+#define OOB_MIN_SIZE (64 * 1024) // 64 KB
+
 // Immortal refcount value
 #define IMMORTAL_REFCNT _Py_IMMORTAL_REFCNT
 
 // Whether the Python version is 3.13+
 #define PYVER13 (PY_VERSION_HEX >= 0x030D0000)
 
+///////////////////
+//  USDT PROBES  //
+///////////////////
+
+/* Probes in the `cmsgpack` provider, compiled in when building with the `usdt` option:
+ * - encode__start(type name)               / encode__done(encoded size, duration ns, success)
+ * - decode__start(buffer size, 0 for files) / decode__done(consumed size, duration ns, success)
+ * - buffer__expand(used size, new size)
+ * - file__refill(buffered size, read size, file buffer size)
+ * - ext__encode(ID, duration ns) / ext__decode(ID, data size, duration ns) / ext__batch(number of values, duration ns)
+ */
+
+usdt_semaphore(encode__start)
+usdt_semaphore(encode__done)
+usdt_semaphore(decode__start)
+usdt_semaphore(decode__done)
+usdt_semaphore(buffer__expand)
+usdt_semaphore(file__refill)
+usdt_semaphore(ext__encode)
+usdt_semaphore(ext__decode)
+usdt_semaphore(ext__batch)
+
 ///////////////////////////
 //  TYPEDEFS & FORWARDS  //
 ///////////////////////////
@@ -43,15 +83,30 @@ typedef struct {
     PyObject_HEAD
 
     char id;        // ID of the type
-    PyObject *func; // The function used for encoding objects of the type set as the dict's key
+    bool batch;     // Whether the function takes a list of objects
+    bool nested;    // Whether the object returned by the function is encoded as the ext data
+    PyObject *func; // The function used for encoding objects of the type set as the dict's key, NULL if native
+    size_t size;    // The size of the memoryview the function writes to, 0 if the function returns the data
+
+    cm_native_encode_t native; // The native function used for encoding, NULL if not native
+    void *ctx;                 // The context passed to the native function
 } ext_dictitem_t;
 
+// Native decoding function registered through the C API
+typedef struct {
+    cm_native_decode_t func;
+    void *ctx;
+} ext_native_t;
+
 // Extension data for during serialization
 typedef struct {
     bool pass_memview; // Whether to pass memoryview objects instead of byte objects to decoding functions
 
     PyObject *dict;   // Dict object containing encoding data
     PyObject **funcs; // Functions array with decoding functions, indexed by ID casted to unsigned
+    bool *batch;      // Whether the decoding functions take a list of values, indexed like `funcs`
+    bool *nested;     // Whether the ext data is decoded before passing it to the decoding functions, indexed like `funcs`
+    ext_native_t *natives; // Native decoding functions, indexed like `funcs`
 } ext_data_t;
 
 // Extensions object
@@ -59,13 +114,58 @@ typedef struct {
     PyObject_HEAD
 
     ext_data_t data;
-    PyObject *funcs[256]; // The functions array
+    PyObject *funcs[256];     // The functions array
+    bool batch[256];          // The batch flags array
+    bool nested[256];         // The nested flags array
+    ext_native_t natives[256]; // The native functions array
 } extensions_t;
 
+// A value of a batched ext type, waiting for its function to be called
+typedef struct {
+    PyObject *obj;       // The object to encode, or the ext data to decode
+    PyObject *func;      // The function to call with the batch
+    PyObject *container; // Decoding: the list or dict holding the placeholder, NULL if it's the top-level object
+    PyObject *key;       // Decoding: the key of the placeholder in the dict, NULL for lists
+    size_t pos;          // Encoding: the offset in the output to insert the value at. Decoding: the index in the list
+    char id;             // Encoding: the ID of the ext type
+} batch_entry_t;
+
+// Pending values of batched ext types
+typedef struct {
+    batch_entry_t *entries;
+    size_t n;
+    size_t cap;
+} batch_t;
+
+// Containers seen during a run with shared references, numbered in the order their headers are written
+typedef struct {
+    PyObject *objs; // List of the containers, indexed by their number. Also keeps them alive during encoding
+    PyObject *ids;  // Dict mapping the addresses of the containers to their number, only used for encoding
+} refs_t;
+
+// Binary data passed out-of-band, outside of the encoded data
+typedef struct {
+    PyObject *callback; // Encoding: the function that receives the buffers
+    PyObject *buffers;  // Decoding: list or tuple of the buffers, indexed by the number in their placeholders
+    size_t n;           // Encoding: the number of buffers passed to the callback so far
+} oob_t;
+
 static PyTypeObject ExtDictItemObj;
 static PyTypeObject ExtensionsObj;
 
 
+// Raw object, holding already-encoded data that is written as-is
+typedef struct {
+    PyObject_HEAD
+
+    Py_buffer view; // The buffer of the object that owns the data
+    char *data;     // Start of the encoded data, within the buffer
+    size_t size;    // Size of the encoded data
+} raw_t;
+
+static PyTypeObject RawObj;
+
+
 // Keyarg struct for parsing keyword arguments
 typedef struct {
     PyObject **dest;
@@ -89,6 +189,17 @@ typedef struct {
     PyLongObject slots[INTEGER_CACHE_SLOTS];
 } intcache_t;
 
+// Settings of the hook for slow or oversized messages, see `on_slow`
+typedef struct {
+    PyObject *callback;    // The function to call, NULL when disabled
+    uint64_t threshold_ns; // Duration from which messages are reported, 0 to not check durations
+    size_t max_bytes;      // Size from which messages are reported, 0 to not check sizes
+    uint64_t sample_limit; // Crossings are reported when a random 32-bit number is below this
+    size_t prefix_size;    // Maximum number of bytes of the encoded message to pass
+    atomic_bool enabled;   // Whether a callback is set, so that runs can check this without taking the lock
+    atomic_flag lock;      // Held while accessing the fields above, as the hook can be changed from any thread
+} slowhook_t;
+
 // Module states
 typedef struct {
     // Interned strings
@@ -97,11 +208,33 @@ typedef struct {
         PyObject *types;
         PyObject *extensions;
         PyObject *pass_memoryview;
+        PyObject *validate;
         PyObject *str_keys;
         PyObject *reading_offset;
         PyObject *chunk_size;
+        PyObject *raw_depth;
+        PyObject *sync_records;
+        PyObject *sync_ms;
+        PyObject *direct_io;
+        PyObject *batch;
+        PyObject *size;
+        PyObject *release;
+        PyObject *nested;
+        PyObject *hash;
+        PyObject *shared_refs;
+        PyObject *sample_rate;
+        PyObject *prefix_size;
+        PyObject *encode;
+        PyObject *decode;
+        PyObject *buffer_callback;
+        PyObject *buffers;
+        PyObject *decode_cache;
+        PyObject *int_arrays;
     } interned;
 
+    // Stands in for values of batched ext types while decoding
+    PyObject *batch_placeholder;
+
     // Caches
     struct {
         intcache_t integers;
@@ -110,6 +243,9 @@ typedef struct {
 
     // The global extensions object
     extensions_t extensions;
+
+    // The hook for slow or oversized messages
+    slowhook_t slow;
 } mstates_t;
 
 
@@ -119,6 +255,29 @@ typedef struct {
     char *name; // Name of the file
 } filedata_t;
 
+// Reader for direct I/O, which reads aligned blocks through a separate file descriptor, bypassing the page cache
+typedef struct {
+    int fd;         // The file descriptor opened for direct I/O, -1 if not used
+    int err;        // The errno of the last failed read, 0 if none
+    char *buf;      // The aligned block buffer
+    size_t size;    // The size of the block buffer, a multiple of DIRECTIO_ALIGN
+    size_t start;   // The file offset of the start of the block buffer
+    size_t len;     // The number of valid bytes in the block buffer
+    size_t pos;     // The file offset to read from next
+    size_t dropped; // The file offset up to which pages were dropped from the page cache, when falling back to fadvise
+} directio_t;
+
+// State of writing an encoded object to a file while it's being encoded, to keep the buffer within the chunk size
+typedef struct {
+    FILE *file;              // The file to write to
+    PyThread_type_lock lock; // The stream's write lock, held from the first flush until the object is fully written
+    unsigned long *owner;    // The stream's write lock owner
+    size_t size;             // The amount of data from which the buffer is written to the file
+    size_t flushed;          // The number of bytes of the object written to the file so far
+    size_t start;            // The file offset where the object starts, set on the first flush
+    bool started;            // Whether anything was flushed, meaning that the write lock is held
+} flush_t;
+
 typedef struct {
     char *base;        // Base towards the buffer (for decoding from a file, this holds the file buffer)
     char *offset;      // Current writing offset in the buffer
@@ -127,13 +286,38 @@ typedef struct {
     bool str_keys;     // Whether only string keys are allowed
     ext_data_t ext;    // Extensions data
     size_t recursion;  // Recursion depth to prevent cyclic references during encoding
+    size_t depth;      // Container depth while decoding
+    size_t raw_depth;  // Container depth at which objects are decoded as raw objects, 0 if not used
+    PyObject *owner;   // The object that owns the buffer being decoded, NULL if not decoding from an object
+    batch_t *batch;    // Pending values of batched ext types, NULL if batching isn't used
+    refs_t *refs;      // Containers seen so far, NULL if not using shared references
+    oob_t *oob;        // Out-of-band buffers, NULL if binary data is always written in-band
+    bool int_arrays;   // Whether integer arrays are written and read as packed integer arrays
+    flush_t *flush;    // The file to write to while encoding, NULL if the whole object is kept in the buffer
     mstates_t *states; // The module states
 
     FILE *file;        // The file object in use, NULL if not using a file
     size_t fbuf_size;  // The actual size of the file buffer, for if it's updated
+    directio_t *dio;   // The direct I/O reader in use, NULL if reading through the file object
 } buffer_t;
 
 
+// An encoded message and a copy of the object it was decoded to
+typedef struct {
+    uint64_t hash;     // The xxHash of the encoded data
+    PyObject *encoded; // Bytes object holding the encoded data, NULL if the entry is empty
+    PyObject *result;  // The decoded object, which is never returned itself
+} dcache_entry_t;
+
+// Set-associative cache of decoded messages, with least-recently-used eviction within each set
+typedef struct {
+    dcache_entry_t *entries; // NSETS sets of DECODE_CACHE_WAYS entries, each ordered from most to least recently used
+    size_t nsets;            // The number of sets, 0 if the cache is disabled
+    uint64_t hits;           // The number of lookups that found their message
+    uint64_t misses;         // The number of lookups that didn't
+    atomic_flag lock;        // Held while accessing the entries
+} dcache_t;
+
 typedef struct {
     PyObject_HEAD
 
@@ -141,7 +325,13 @@ typedef struct {
     double avg_item_size;
     double avg_fluctuation;
 
+    dcache_t cache;    // Cache of decoded messages
+
     bool str_keys;     // Whether to allow string keys
+    size_t raw_depth;  // Container depth at which objects are decoded as raw objects
+    cm_hash_t hash;    // The hash to return alongside the encoded data
+    bool shared_refs;  // Whether repeated containers are encoded as references
+    bool int_arrays;   // Whether integer arrays are encoded as packed integer arrays
     PyObject *ext;     // The extensions object to use
     mstates_t *states; // The module states
 
@@ -162,16 +352,33 @@ typedef struct {
     FILE *file;  // The file, opened in "a+b" mode
     size_t foff; // The file's reading offset
 
-    char *fbuf;       // The file buffer for decoding
-    size_t fbuf_size; // The size of the file buffer
+    char *fbuf;        // The file buffer for decoding, allocated with the raw memory functions so that it's traced
+    size_t fbuf_size;  // The size of the file buffer
+    size_t chunk_size; // The configured size of the file buffer, which it shrinks back to after oversized records
 
     char *fname;      // The filename
 
+    PyObject *iterating; // The live item iterator reading the file, NULL if there is none. Borrowed, cleared by the iterator
+
+    bool direct_io;   // Whether to bypass the page cache when reading
+    directio_t dio;   // The direct I/O reader
+
+    // Durability
+    uint64_t written_seq;         // The sequence number of the last written record
+    uint64_t durable_seq;         // The sequence number of the last record that was synced to disk
+    size_t sync_records;          // Sync after this many unsynced records, 0 to disable
+    uint64_t sync_ns;             // Sync on writes when this much time passed since the last sync, 0 to disable
+    uint64_t last_sync;           // Timestamp of the last sync
+    PyThread_type_lock sync_lock; // Held while syncing, so that concurrent syncs wait on a single shared sync
+    PyThread_type_lock write_lock; // Held while writing a record, so that records written in parts aren't interleaved
+    unsigned long write_owner;     // The identifier of the thread holding the write lock, 0 if it isn't held
+
     PyObject *module; // Reference to the module
 } filestream_t;
 
 static PyTypeObject StreamObj;
 static PyTypeObject FileStreamObj;
+static PyTypeObject ItemIterObj;
 
 
 static _always_inline mstates_t *get_mstates(PyObject *m);
@@ -182,6 +389,15 @@ static PyObject *decode_bytes(buffer_t *b);
 static _always_inline bool ensure_space(buffer_t *b, size_t required);
 static _always_inline bool overread_check(buffer_t *b, size_t required);
 
+static bool skip_object(buffer_t *b);
+
+static _always_inline PyObject *get_cached_int(buffer_t *b, int n);
+
+static PyObject *decoding_read_file_direct(buffer_t *b, size_t size, bool str);
+static bool encoding_flush(buffer_t *b);
+static bool encoding_resolve_batch(buffer_t *b);
+static bool filestream_sync_to(filestream_t *stream, uint64_t seq);
+
 
 static PyModuleDef cmsgpack;
 
@@ -190,7 +406,7 @@ static PyModuleDef cmsgpack;
 //  COMMON ERRORS  //
 /////////////////////
 
-// Error for when LIMIT_LARGE is exceeded
+// Error for when CM_LIMIT_LARGE is exceeded
 #define error_size_limit(name, size) (PyErr_Format(PyExc_ValueError, #name " values can only hold up to 4294967295 bytes (2^32-1, 4 bytes), got a size of %zu", size))
 
 // Error for when we get an unexpected tyoe
@@ -202,6 +418,9 @@ static PyModuleDef cmsgpack;
 // Error for when we get an unexpected header
 #define error_unexpected_header(expected_tpname, received_header) (PyErr_Format(PyExc_TypeError, "Expected a header of type '%s', but got header byte '0x%02X'", expected_tpname, received_header))
 
+// Error for when shared references are combined with raw objects, where containers inside raw objects can't be numbered
+#define error_refs_rawdepth() (PyErr_Format(PyExc_ValueError, "Shared references can't be used together with a raw depth"))
+
 // Error for when a file couldn't be opened
 #define error_cannot_open_file(filename, err) (PyErr_Format(PyExc_OSError, "Unable to open file '%s', received errno %i: '%s'", filename, err, strerror(err)))
 
@@ -370,8 +589,23 @@ static _always_inline bool parse_keywords(Py_ssize_t npos, PyObject **args, Py_s
 //   EXT OBJECTS   //
 /////////////////////
 
-static bool extensions_add_encode_internal(extensions_t *ext, char id, PyObject *type, PyObject *encfunc)
+// Check that ID isn't reserved for the ext types the module writes itself, which it would decode differently when enabled
+static bool ext_id_check_reserved(int id)
+{
+    if (id >= CM_EXT_ID_RESERVED_MIN)
+    {
+        PyErr_Format(PyExc_ValueError, "Ext type IDs %i to 127 are reserved for shared references, out-of-band buffers, and integer arrays, but got an ID of %i", CM_EXT_ID_RESERVED_MIN, id);
+        return false;
+    }
+
+    return true;
+}
+
+static bool extensions_add_encode_internal(extensions_t *ext, char id, PyObject *type, PyObject *encfunc, bool batch, bool nested, size_t size)
 {
+    if (!ext_id_check_reserved((int8_t)id))
+        return false;
+    
     // Create a dict item object
     ext_dictitem_t *item = PyObject_New(ext_dictitem_t, &ExtDictItemObj);
 
@@ -382,6 +616,11 @@ static bool extensions_add_encode_internal(extensions_t *ext, char id, PyObject
 
     item->func = encfunc;
     item->id = id;
+    item->batch = batch;
+    item->nested = nested;
+    item->size = size;
+    item->native = NULL;
+    item->ctx = NULL;
 
     int status = PyDict_SetItem(ext->data.dict, type, (PyObject *)item);
 
@@ -390,22 +629,91 @@ static bool extensions_add_encode_internal(extensions_t *ext, char id, PyObject
     return status >= 0;
 }
 
-static bool extensions_add_decode_internal(extensions_t *ext, char id, PyObject *decfunc)
+static bool extensions_add_decode_internal(extensions_t *ext, char id, PyObject *decfunc, bool batch, bool nested)
 {
+    if (!ext_id_check_reserved((int8_t)id))
+        return false;
+    
     unsigned char idx = (unsigned char)id;
 
     Py_XDECREF(ext->funcs[idx]);
     Py_INCREF(decfunc);
 
     ext->funcs[idx] = decfunc;
+    ext->batch[idx] = batch;
+    ext->nested[idx] = nested;
+    ext->natives[idx].func = NULL;
+
+    return true;
+}
+
+// Parse the keyword arguments of the add methods, which follow NPOS positional arguments. SIZE is NULL when only decoding
+static bool extensions_parse_options(PyObject **args, Py_ssize_t nargs, PyObject *kwargs, Py_ssize_t npos, bool *batch, bool *nested, size_t *size)
+{
+    mstates_t *states = get_mstates(PyState_FindModule(&cmsgpack));
+
+    PyObject *batch_obj = Py_False;
+    PyObject *nested_obj = Py_False;
+    PyObject *size_obj = NULL;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&batch_obj, &PyBool_Type, states->interned.batch),
+        KEYARG(&nested_obj, &PyBool_Type, states->interned.nested),
+        KEYARG(&size_obj, &PyLong_Type, states->interned.size),
+    };
+
+    // Only the encoding functions take a size
+    if (!parse_keywords(npos, args, nargs, kwargs, keyargs, size ? NKEYARGS(keyargs) : NKEYARGS(keyargs) - 1))
+        return false;
+
+    *batch = batch_obj == Py_True;
+    *nested = nested_obj == Py_True;
+
+    if (*batch && *nested)
+    {
+        PyErr_SetString(PyExc_ValueError, "Extension functions can't be both batched and nested");
+        return false;
+    }
+
+    if (!size)
+        return true;
+    
+    *size = 0;
+
+    if (size_obj)
+    {
+        Py_ssize_t num = PyLong_AsSsize_t(size_obj);
+
+        if (num == -1 && PyErr_Occurred())
+            return false;
+        
+        if (num <= 0 || (size_t)num > CM_LIMIT_LARGE)
+        {
+            PyErr_Format(PyExc_ValueError, "Expected argument 'size' to be between 1 and 4294967295, but got %zi", num);
+            return false;
+        }
+
+        if (*batch || *nested)
+        {
+            PyErr_SetString(PyExc_ValueError, "Batched and nested extension functions can't write to the output directly, so they don't take a size");
+            return false;
+        }
+
+        *size = (size_t)num;
+    }
 
     return true;
 }
 
-static PyObject *extensions_add(extensions_t *ext, PyObject **args, Py_ssize_t nargs)
+static PyObject *extensions_add(extensions_t *ext, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
 {
-    if (nargs != 4)
-        return PyErr_Format(PyExc_TypeError, "Expected exactly 4 arguments, but got %zi", nargs);
+    if (!min_positional(nargs, 4))
+        return NULL;
+
+    bool batch, nested;
+    size_t size;
+    if (!extensions_parse_options(args, nargs, kwargs, 4, &batch, &nested, &size))
+        return NULL;
     
     PyObject *longobj = args[0];
     PyObject *type = args[1];
@@ -431,17 +739,22 @@ static PyObject *extensions_add(extensions_t *ext, PyObject **args, Py_ssize_t n
     
     char id = (char)long_id;
 
-    if (!extensions_add_encode_internal(ext, id, type, encfunc) ||
-        !extensions_add_decode_internal(ext, id, decfunc))
+    if (!extensions_add_encode_internal(ext, id, type, encfunc, batch, nested, size) ||
+        !extensions_add_decode_internal(ext, id, decfunc, batch, nested))
         return NULL;
     
     Py_RETURN_NONE;
 }
 
-static PyObject *extensions_add_encode(extensions_t *ext, PyObject **args, Py_ssize_t nargs)
+static PyObject *extensions_add_encode(extensions_t *ext, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
 {
-    if (nargs != 3)
-        return PyErr_Format(PyExc_TypeError, "Expected exactly 3 arguments, but got %zi", nargs);
+    if (!min_positional(nargs, 3))
+        return NULL;
+
+    bool batch, nested;
+    size_t size;
+    if (!extensions_parse_options(args, nargs, kwargs, 3, &batch, &nested, &size))
+        return NULL;
     
     PyObject *longobj = args[0];
     PyObject *type = args[1];
@@ -463,16 +776,20 @@ static PyObject *extensions_add_encode(extensions_t *ext, PyObject **args, Py_ss
     
     char id = (char)long_id;
 
-    if (!extensions_add_encode_internal(ext, id, type, encfunc))
+    if (!extensions_add_encode_internal(ext, id, type, encfunc, batch, nested, size))
         return NULL;
     
     Py_RETURN_NONE;
 }
 
-static PyObject *extensions_add_decode(extensions_t *ext, PyObject **args, Py_ssize_t nargs)
+static PyObject *extensions_add_decode(extensions_t *ext, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
 {
-    if (nargs != 2)
-        return PyErr_Format(PyExc_TypeError, "Expected exactly 2 arguments, but got %zi", nargs);
+    if (!min_positional(nargs, 2))
+        return NULL;
+
+    bool batch, nested;
+    if (!extensions_parse_options(args, nargs, kwargs, 2, &batch, &nested, NULL))
+        return NULL;
     
     PyObject *longobj = args[0];
     PyObject *decfunc = args[1];
@@ -490,7 +807,7 @@ static PyObject *extensions_add_decode(extensions_t *ext, PyObject **args, Py_ss
     
     char id = (char)long_id;
 
-    if (!extensions_add_decode_internal(ext, id, decfunc))
+    if (!extensions_add_decode_internal(ext, id, decfunc, batch, nested))
         return NULL;
     
     Py_RETURN_NONE;
@@ -524,6 +841,9 @@ static PyObject *extensions_remove(extensions_t *ext, PyObject **args, Py_ssize_
     // Remove the decode function
     Py_XDECREF(ext->funcs[(unsigned char)id]);
     ext->funcs[(unsigned char)id] = NULL;
+    ext->batch[(unsigned char)id] = false;
+    ext->nested[(unsigned char)id] = false;
+    ext->natives[(unsigned char)id].func = NULL;
     
     Py_RETURN_NONE;
 }
@@ -553,6 +873,9 @@ static PyObject *extensions_remove_decode(extensions_t *ext, PyObject *longobj)
 
     Py_XDECREF(ext->funcs[(unsigned char)id]);
     ext->funcs[(unsigned char)id] = NULL;
+    ext->batch[(unsigned char)id] = false;
+    ext->nested[(unsigned char)id] = false;
+    ext->natives[(unsigned char)id].func = NULL;
     
     Py_RETURN_NONE;
 }
@@ -566,6 +889,9 @@ static PyObject *extensions_clear(extensions_t *ext)
     {
         Py_XDECREF(ext->funcs[i]);
         ext->funcs[i] = NULL;
+        ext->batch[i] = false;
+        ext->nested[i] = false;
+        ext->natives[i].func = NULL;
     }
     
     // Create a new dict object
@@ -607,6 +933,15 @@ static PyObject *Extensions(PyObject *self, PyObject **args, Py_ssize_t nargs, P
     memset(ext->funcs, 0, sizeof(ext->funcs));
     ext->data.funcs = ext->funcs;
 
+    memset(ext->batch, 0, sizeof(ext->batch));
+    ext->data.batch = ext->batch;
+
+    memset(ext->nested, 0, sizeof(ext->nested));
+    ext->data.nested = ext->nested;
+
+    memset(ext->natives, 0, sizeof(ext->natives));
+    ext->data.natives = ext->natives;
+
     // Create the dict holding the data
     ext->data.dict = PyDict_New();
 
@@ -663,8 +998,8 @@ static PyObject *Extensions(PyObject *self, PyObject **args, Py_ssize_t nargs, P
                     "but got items of type '%s', '%s', and '%s'", Py_TYPE(type)->tp_name, Py_TYPE(encfunc)->tp_name, Py_TYPE(decfunc)->tp_name);
             }
 
-            if (!extensions_add_encode_internal(ext, id, type, encfunc) ||
-                !extensions_add_decode_internal(ext, id, decfunc))
+            if (!extensions_add_encode_internal(ext, id, type, encfunc, false, false, 0) ||
+                !extensions_add_decode_internal(ext, id, decfunc, false, false))
             {
                 Py_DECREF(ext);
                 return NULL;
@@ -677,7 +1012,7 @@ static PyObject *Extensions(PyObject *self, PyObject **args, Py_ssize_t nargs, P
 
 static void ExtDictItem_dealloc(ext_dictitem_t *item)
 {
-    Py_DECREF(item->func);
+    Py_XDECREF(item->func);
     PyObject_Del(item);
 }
 
@@ -697,2055 +1032,5679 @@ static PyObject *extensions_get_passmemview(extensions_t *ext, void *closure)
     return ext->data.pass_memview == true ? Py_True : Py_False;
 }
 
-static PyObject *extensions_set_passmemview(extensions_t *ext, PyObject *arg, void *closure)
+static int extensions_set_passmemview(extensions_t *ext, PyObject *arg, void *closure)
 {
     ext->data.pass_memview = arg == Py_True;
-    Py_RETURN_NONE;
+    return 0;
 }
 
-// Attempt to encode an object as an ext type. Returns the object from the type's encode function
-static _always_inline PyObject *attempt_encode_ext(buffer_t *b, PyObject *obj, char *id)
+
+/////////////////////
+//  BATCHED EXTS   //
+/////////////////////
+
+/* # Batched extension types
+ * 
+ * Functions of batched ext types take a list of objects and return a list of results, so that they're called
+ * once per encoding/decoding run instead of once per object.
+ * 
+ * Encoding: the position of each object is recorded without writing anything, and once the whole object is
+ * encoded, the written data is moved back to make room for the results.
+ * 
+ * Decoding: a placeholder object is inserted in place of each value, and its container is recorded. Once the whole
+ * object is decoded, the placeholders are replaced by the results. Map keys are resolved right away, as their hash is needed.
+ * 
+ * When a run can't batch (`b->batch` is NULL), the functions are called with a list of a single object.
+ */
+
+// Add an entry for OBJ (stolen) to the batch. Returns the entry, or NULL on failure
+static batch_entry_t *batch_push(batch_t *batch, PyObject *obj, PyObject *func)
 {
-    // We're guaranteed to have an ExtTypesEncode object due to the global one
+    if (batch->n == batch->cap)
+    {
+        const size_t cap = batch->cap == 0 ? 16 : batch->cap * 2;
+        batch_entry_t *entries = (batch_entry_t *)PyMem_Realloc(batch->entries, cap * sizeof(batch_entry_t));
 
-    // Attempt to get an item for all subclasses of OBJ, up until Type
-    ext_dictitem_t *item = NULL;
-    PyTypeObject *type = Py_TYPE(obj);
-    while (type != &PyType_Type)
+        if (!entries)
+        {
+            Py_DECREF(obj);
+            PyErr_NoMemory();
+            return NULL;
+        }
+
+        batch->entries = entries;
+        batch->cap = cap;
+    }
+
+    batch_entry_t *entry = &batch->entries[batch->n++];
+
+    // Keep the function alive, in case it's removed from the extensions object by another function during the run
+    entry->obj = obj;
+    entry->func = Py_NewRef(func);
+    entry->container = NULL;
+    entry->key = NULL;
+    entry->pos = 0;
+    entry->id = 0;
+
+    return entry;
+}
+
+// Release all entries of the batch
+static void batch_clear(batch_t *batch)
+{
+    for (size_t i = 0; i < batch->n; ++i)
     {
-        item = (ext_dictitem_t *)PyDict_GetItem(b->ext.dict, (PyObject *)type);
+        batch_entry_t *entry = &batch->entries[i];
 
-        if (item)
-            break;
-        
-        type = Py_TYPE(type);
+        Py_DECREF(entry->obj);
+        Py_DECREF(entry->func);
+        Py_XDECREF(entry->container);
+        Py_XDECREF(entry->key);
     }
 
-    // If we didn't find an item, the object is of an invalid type
-    if (!item)
-        return PyErr_Format(PyExc_TypeError, "Received unsupported type '%s'"
-            "\n\tHint: Did you mean to add this type to the Extension Types?", Py_TYPE(obj)->tp_name);
-    
-    *id = item->id;
-    
-    // Call the function for encoding data and return the result
-    return PyObject_CallOneArg(item->func, obj);
+    PyMem_Free(batch->entries);
+
+    batch->entries = NULL;
+    batch->n = 0;
+    batch->cap = 0;
 }
 
-// Attempt to decode an ext type object. Returns the object from the type's decode function
-static _always_inline PyObject *attempt_decode_ext(buffer_t *b, char *buf, size_t size, char id)
+// Call FUNC with the list OBJS and check that it returned a sequence of the same length. Returns a fast sequence
+static PyObject *batch_call(PyObject *func, PyObject *objs)
 {
-    // We're guaranteed to have an ExtTypesDecode object due to the global one
+    const uint64_t start = usdt_clock(ext__batch);
 
-    // See if there's a function for this ID
-    PyObject *func = b->ext.funcs[(unsigned char)id];
+    PyObject *results = PyObject_CallOneArg(func, objs);
 
-    if (!func)
-        return PyErr_Format(PyExc_TypeError, "Found an extension type with ID %i, but no function was registered for this ID"
-            "\n\tHint: Did you forget to add a decoding function to the extension types, or is there a mismatch between IDs?", id);
+    usdt_probe(ext__batch, PyList_GET_SIZE(objs), _monotonic_ns() - start);
+
+    if (!results)
+        return NULL;
     
-    // Decide if we should return a bytes or memoryview object
-    PyObject *bufobj;
+    PyObject *fast = PySequence_Fast(results, "Expected batched extension functions to return a sequence");
+    Py_DECREF(results);
 
-    if (b->ext.pass_memview)
-    {
-        bufobj = PyMemoryView_FromMemory(buf, (Py_ssize_t)size, PyBUF_READ);
-    }
-    else
+    if (!fast)
+        return NULL;
+    
+    if (PySequence_Fast_GET_SIZE(fast) != PyList_GET_SIZE(objs))
     {
-        bufobj = PyBytes_FromStringAndSize(buf, (Py_ssize_t)size);
+        PyErr_Format(PyExc_ValueError, "Expected batched extension functions to return %zi results, but got %zi", PyList_GET_SIZE(objs), PySequence_Fast_GET_SIZE(fast));
+        Py_DECREF(fast);
+        return NULL;
     }
 
-    if (!bufobj)
-        return PyErr_NoMemory();
+    return fast;
+}
+
+// Call FUNC with a batch of only OBJ, and return the single result
+static PyObject *batch_call_single(PyObject *func, PyObject *obj)
+{
+    PyObject *objs = PyList_New(1);
+
+    if (!objs)
+        return NULL;
     
-    // Call the decode function
-    PyObject *result = PyObject_CallOneArg(func, bufobj);
+    PyList_SET_ITEM(objs, 0, Py_NewRef(obj));
+
+    PyObject *results = batch_call(func, objs);
+    Py_DECREF(objs);
+
+    if (!results)
+        return NULL;
+    
+    PyObject *result = Py_NewRef(PySequence_Fast_GET_ITEM(results, 0));
+    Py_DECREF(results);
 
-    Py_DECREF(bufobj);
     return result;
 }
 
+// Call the function of each distinct group of entries once. Returns a list with the results, indexed like the entries
+static PyObject *batch_call_all(batch_t *batch)
+{
+    PyObject *values = PyList_New(batch->n);
 
-////////////////////
-//  WRITING DATA  //
-////////////////////
-
-// Get the current offset's byte and increment afterwards
-#define INCBYTE ((b->offset++)[0])
+    if (!values)
+        return NULL;
 
-// Write a header's typemask and its size based on the number of bytes the size should take up.
-// NBYTES can be 0 for FIXSIZE, 1 for SMALL, 2 for MEDIUM, 4 for LARGE, and 8 for 64-bit int/uint cases
-static _always_inline void write_mask(buffer_t *b, const unsigned char mask, const size_t size, const size_t nbytes)
-{
-    if (nbytes == 0) // FIXSIZE
-    {
-        INCBYTE = mask | size;
-    }
-    else if (nbytes == 1) // SMALL
+    // Entries that already have a result are skipped, so each function gets called with all of its entries at once
+    for (size_t i = 0; i < batch->n; ++i)
     {
-        const char head[2] = {
-            mask,
-            size
-        };
+        if (PyList_GET_ITEM(values, i) != NULL)
+            continue;
+        
+        PyObject *func = batch->entries[i].func;
 
-        memcpy(b->offset, head, 2);
-        b->offset += 2;
-    }
-    else if (nbytes == 2) // MEDIUM
-    {
-        const char head[3] = {
-            mask,
-            size >> 8,
-            size
-        };
+        PyObject *objs = PyList_New(0);
 
-        memcpy(b->offset, head, 3);
-        b->offset += 3;
-    }
-    else if (nbytes == 4) // LARGE
-    {
-        const char head[5] = {
-            mask,
-            size >> 24,
-            size >> 16,
-            size >> 8,
-            size,
-        };
+        if (!objs)
+        {
+            Py_DECREF(values);
+            return NULL;
+        }
 
-        memcpy(b->offset, head, 5);
-        b->offset += 5;
-    }
-    else if (nbytes == 8)
-    {
-        const char head[9] = {
-            mask,
-            size >> 56,
-            size >> 48,
-            size >> 40,
-            size >> 32,
-            size >> 24,
-            size >> 16,
-            size >> 8,
-            size
-        };
+        for (size_t j = i; j < batch->n; ++j)
+        {
+            if (batch->entries[j].func == func && PyList_Append(objs, batch->entries[j].obj) < 0)
+            {
+                Py_DECREF(objs);
+                Py_DECREF(values);
+                return NULL;
+            }
+        }
+
+        PyObject *results = batch_call(func, objs);
+        Py_DECREF(objs);
+
+        if (!results)
+        {
+            Py_DECREF(values);
+            return NULL;
+        }
+
+        Py_ssize_t nth = 0;
+        for (size_t j = i; j < batch->n; ++j)
+        {
+            if (batch->entries[j].func == func)
+                PyList_SET_ITEM(values, j, Py_NewRef(PySequence_Fast_GET_ITEM(results, nth++)));
+        }
 
-        memcpy(b->offset, head, 9);
-        b->offset += 9;
+        Py_DECREF(results);
     }
+
+    return values;
 }
 
-// Separate from `write_str` for re-use in other places, for getting string data
-static _always_inline void py_str_data(PyObject *obj, char **base, size_t *size)
+// Record the container of the placeholder that was pushed last. KEY is NULL for lists, where POS is the index
+static _always_inline void batch_track(batch_t *batch, PyObject *container, PyObject *key, size_t pos)
 {
-    // Check if the object is compact ASCII, use quick path for that
-    if (PyUnicode_IS_COMPACT_ASCII(obj))
-    {
-        *size = ((PyASCIIObject *)obj)->length;
-        *base = (char *)(((PyASCIIObject *)obj) + 1);
-    }
-    else
-    {
-        // Otherwise simply get data through this
-        *base = (char *)PyUnicode_AsUTF8AndSize(obj, (Py_ssize_t *)size);
+    batch_entry_t *entry = &batch->entries[batch->n - 1];
 
-        if (base == NULL)
-            PyErr_SetString(PyExc_BufferError, "Unable to get the internal buffer of a string");
-    }
+    entry->container = Py_NewRef(container);
+    entry->key = Py_XNewRef(key);
+    entry->pos = pos;
 }
 
-static _always_inline bool write_string(buffer_t *b, PyObject *obj)
+// Resolve the placeholder that was pushed last right away, and return its value
+static PyObject *batch_resolve_last(batch_t *batch)
 {
-    char *base;
-    size_t size;
-    py_str_data(obj, &base, &size);
+    batch_entry_t *entry = &batch->entries[--batch->n];
 
-    if (base == NULL)
-        return false;
-
-    if (!ensure_space(b, size + 5))
-        return false;
-    
-    if (size <= LIMIT_STR_FIXED)
-    {
-        write_mask(b, DT_STR_FIXED, size, 0);
-    }
-    else if (size <= LIMIT_SMALL)
-    {
-        write_mask(b, DT_STR_SMALL, size, 1);
-    }
-    else if (size <= LIMIT_MEDIUM)
-    {
-        write_mask(b, DT_STR_MEDIUM, size, 2);
-    }
-    else if (size <= LIMIT_LARGE)
-    {
-        write_mask(b, DT_STR_LARGE, size, 4);
-    }
-    else
-    {
-        error_size_limit(String, size);
-        return false;
-    }
+    PyObject *result = batch_call_single(entry->func, entry->obj);
 
-    memcpy(b->offset, base, size);
-    b->offset += size;
+    Py_DECREF(entry->obj);
+    Py_DECREF(entry->func);
 
-    return true;
+    return result;
 }
 
-static _always_inline bool write_binary(buffer_t *b, char *base, size_t size)
+
+/////////////////////
+//  SHARED  REFS   //
+/////////////////////
+
+/* # Shared references
+ * 
+ * When enabled, lists, tuples, and dicts are numbered in the order their headers are written. A container that was
+ * written before is written as an ext type with ID `CM_EXT_ID_SHARED_REF`, holding its number as a 32-bit big-endian integer.
+ * The decoder numbers the containers in the same order, and returns the same object for each reference.
+ * 
+ * Containers are numbered before their items are written, so references to a container from within itself (cycles) work.
+ */
+
+static bool refs_setup(refs_t *refs, bool encoding)
 {
-    if (!ensure_space(b, size + 5))
-        return false;
+    refs->objs = PyList_New(0);
+    refs->ids = encoding ? PyDict_New() : NULL;
 
-    if (size <= LIMIT_SMALL)
-    {
-        write_mask(b, DT_BIN_SMALL, size, 1);
-    }
-    else if (size <= LIMIT_MEDIUM)
-    {
-        write_mask(b, DT_BIN_MEDIUM, size, 2);
-    }
-    else if (size <= LIMIT_LARGE)
-    {
-        write_mask(b, DT_BIN_LARGE, size, 4);
-    }
-    else
+    if (!refs->objs || (encoding && !refs->ids))
     {
-        error_size_limit(Binary, size);
+        Py_XDECREF(refs->objs);
+        Py_XDECREF(refs->ids);
         return false;
     }
 
-    memcpy(b->offset, base, size);
-    b->offset += size;
-
     return true;
 }
 
-static _always_inline bool write_bytes(buffer_t *b, PyObject *obj)
+static void refs_clear(refs_t *refs)
 {
-    char *base = PyBytes_AS_STRING(obj);
-    size_t size = PyBytes_GET_SIZE(obj);
-
-    return write_binary(b, base, size);
+    Py_XDECREF(refs->objs);
+    Py_XDECREF(refs->ids);
 }
 
-static _always_inline bool write_bytearray(buffer_t *b, PyObject *obj)
+// Write a reference if OBJ was written before, or number it otherwise. WRITTEN is set to whether a reference was written
+static bool write_shared_ref(buffer_t *b, PyObject *obj, bool *written)
 {
-    char *base = PyByteArray_AS_STRING(obj);
-    size_t size = PyByteArray_GET_SIZE(obj);
-
-    return write_binary(b, base, size);
-}
+    refs_t *refs = b->refs;
 
-static _always_inline bool write_memoryview(buffer_t *b, PyObject *obj)
-{
-    PyMemoryViewObject *ob = (PyMemoryViewObject *)obj;
+    PyObject *id = PyLong_FromVoidPtr(obj);
 
-    char *base = ob->view.buf;
-    size_t size = ob->view.len;
+    if (!id)
+        return false;
+    
+    PyObject *index = PyDict_GetItemWithError(refs->ids, id);
 
-    return write_binary(b, base, size);
-}
+    if (index)
+    {
+        Py_DECREF(id);
 
-static _always_inline bool write_double(buffer_t *b, PyObject *obj)
-{
-    // No ensure_space, already done globally
+        if (!ensure_space(b, 6))
+            return false;
+        
+        const uint32_t num = CM_BIG_32((uint32_t)PyLong_AsSize_t(index));
 
-    double num = PyFloat_AS_DOUBLE(obj);
+        b->offset += cm_write_ext_header(b->offset, CM_EXT_ID_SHARED_REF, 4);
+        memcpy(b->offset, &num, 4);
+        b->offset += 4;
 
-    // Ensure big-endianness
-    BIG_DOUBLE(num);
+        *written = true;
+        return true;
+    }
 
-    INCBYTE = DT_FLOAT_BIT64;
-    memcpy(b->offset, &num, 8);
+    if (PyErr_Occurred())
+    {
+        Py_DECREF(id);
+        return false;
+    }
 
-    b->offset += 8;
+    const Py_ssize_t nrefs = PyList_GET_SIZE(refs->objs);
 
-    return true;
-}
+    if ((size_t)nrefs > CM_LIMIT_LARGE)
+    {
+        Py_DECREF(id);
+        PyErr_SetString(PyExc_ValueError, "Can't encode more than 4294967296 containers with shared references");
+        return false;
+    }
 
-static _always_inline bool write_integer(buffer_t *b, PyObject *obj)
-{
-    // No ensure_space, already done globally
+    index = PyLong_FromSsize_t(nrefs);
 
-    // Cast the object to a LongObject for easy internals access
-    PyLongObject *lobj = (PyLongObject *)obj;
+    // The list keeps the object alive, so its address can't be reused by another object during the run
+    const bool success = index && PyDict_SetItem(refs->ids, id, index) == 0 && PyList_Append(refs->objs, obj) == 0;
 
-    // Get the long_value fields for easy access
-    digit *digits = lobj->long_value.ob_digit;
-    uintptr_t tag = lobj->long_value.lv_tag;
+    Py_DECREF(id);
+    Py_XDECREF(index);
 
-    // Get the number of digits and whether the number is positive
-    size_t ndigits = tag >> _PyLong_NON_SIZE_BITS;
-    bool positive = (tag & 3) != 2; // Check if the number is positive (or zero)
+    *written = false;
+    return success;
+}
 
-    // Start the number off with the first digit
-    uint64_t num = digits[0];
+// Number the containers held by already-encoded data written as-is, as the decoder will number them too
+static bool number_raw_containers(buffer_t *b, const char *data, size_t size)
+{
+    const char *end = data + size;
 
-    // Iterate over the digits besides the first digit, using `ndigits` as the index to `digits`
-    while (ndigits > 1)
+    while (data < end)
     {
-        // Decrement to get it as index, working from top to bottom
-        --ndigits;
-
-        uint64_t dig = digits[ndigits];
-
-        // Calculate the shift amount for this digit
-        int shift = PyLong_SHIFT * ndigits;
-
-        // Shift the digit in place
-        uint64_t shifted = dig << shift;
+        cm_header_t header;
+        cm_error_t error = cm_read_header(&data, end, &header);
 
-        // Check for overflow
-        if ((shifted >> shift) != dig)
+        if (error != CM_OK)
         {
-            overflow_case: // Jump label for the extra 64-bit negative check
-
-            PyErr_SetString(PyExc_OverflowError, "Integer values cannot exceed `2^64-1` or `-2^63` (must be within the 64-bit boundary)");
+            PyErr_SetString(PyExc_ValueError, cm_error_string(error));
             return false;
         }
 
-        // Add the shifted digit to the total number
-        num |= shifted;
-    }
-
-    if (positive)
-    {
-        if (num <= LIMIT_UINT_FIXED)
-        {
-            write_mask(b, DT_UINT_FIXED, num, 0);
-        }
-        else if (num <= LIMIT_SMALL)
-        {
-            write_mask(b, DT_UINT_BIT8, num, 1);
-        }
-        else if (num <= LIMIT_MEDIUM)
-        {
-            write_mask(b, DT_UINT_BIT16, num, 2);
-        }
-        else if (num <= LIMIT_LARGE)
-        {
-            write_mask(b, DT_UINT_BIT32, num, 4);
-        }
-        else
-        {
-            write_mask(b, DT_UINT_BIT64, num, 8);
-        }
-    }
-    else
-    {
-        // Get the number as signed and negative
-        int64_t snum = -num;
-
-        // Test if the limit was exceeded by checking if the negative number shows up as positive
-        if (snum >= 0)
-            goto overflow_case;
-
-        if (snum >= LIMIT_INT_FIXED)
-        {
-            write_mask(b, DT_INT_FIXED, snum, 0);
-        }
-        else if (snum >= LIMIT_INT_BIT8)
-        {
-            write_mask(b, DT_INT_BIT8, snum, 1);
-        }
-        else if (snum >= LIMIT_INT_BIT16)
-        {
-            write_mask(b, DT_INT_BIT16, snum, 2);
-        }
-        else if (snum >= LIMIT_INT_BIT32)
+        if (header.type == CM_TYPE_ARRAY || header.type == CM_TYPE_MAP || (b->int_arrays && header.type == CM_TYPE_EXT && header.ext_id == CM_EXT_ID_INT_ARRAY))
         {
-            write_mask(b, DT_INT_BIT32, snum, 4);
+            // The containers can't be referenced, so their slots are filled with None
+            if (PyList_Append(b->refs->objs, Py_None) < 0)
+                return false;
         }
-        else
+        
+        if (header.type == CM_TYPE_STR || header.type == CM_TYPE_BIN || header.type == CM_TYPE_EXT)
         {
-            write_mask(b, DT_INT_BIT64, snum, 8);
+            data += header.size;
         }
     }
 
     return true;
 }
 
-static _always_inline bool write_bool(buffer_t *b, PyObject *obj)
+// Number a container that is being decoded
+static _always_inline bool decoding_add_ref(buffer_t *b, PyObject *obj)
 {
-    // No ensure_space, already done globally
-
-    INCBYTE = obj == Py_True ? DT_TRUE : DT_FALSE;
-    return true;
+    return b->refs == NULL || PyList_Append(b->refs->objs, obj) == 0;
 }
 
-static _always_inline bool write_nil(buffer_t *b, PyObject *obj)
+// Get the container a reference refers to
+static PyObject *decode_shared_ref(buffer_t *b, const char *buf, size_t size)
 {
-    // No ensure_space, already done globally
+    if (size != 4)
+        return PyErr_Format(PyExc_ValueError, "Expected shared references to hold 4 bytes, but got %zu", size);
+    
+    const size_t index = (size_t)cm_load_u32(buf);
 
-    INCBYTE = DT_NIL;
-    return true;
+    if (index >= (size_t)PyList_GET_SIZE(b->refs->objs) || PyList_GET_ITEM(b->refs->objs, index) == Py_None)
+        return PyErr_Format(PyExc_ValueError, "Got a shared reference to container %zu, which wasn't decoded before it", index);
+    
+    return Py_NewRef(PyList_GET_ITEM(b->refs->objs, index));
 }
 
-// Recursion check for container types
-static _always_inline bool recursion_check(buffer_t *b)
-{
-    if (b->recursion > RECURSION_LIMIT)
-    {
-        PyErr_SetString(PyExc_RecursionError, "Exceeded the maximum recursion depth");
-        return false;
-    }
 
-    return true;
-}
+/////////////////////
+//   OUT-OF-BAND   //
+/////////////////////
 
-static _always_inline bool write_array_header(buffer_t *b, size_t nitems)
+/* # Out-of-band buffers
+ * 
+ * When encoding with a buffer callback, binary data of at least `OOB_MIN_SIZE` bytes isn't copied into the encoded data.
+ * A memoryview of it is passed to the callback instead, and an ext type with ID `CM_EXT_ID_OOB_BUFFER` is written in its
+ * place, holding the number of the buffer as a 32-bit big-endian integer. The decoder gets the buffers in the same order,
+ * and returns a memoryview of the buffer for each placeholder.
+ */
+
+// Pass the binary data of OBJ to the buffer callback, and write a placeholder for it
+static bool write_oob_buffer(buffer_t *b, PyObject *obj)
 {
-    // No ensure_space, already done globally
+    oob_t *oob = b->oob;
 
-    if (nitems <= LIMIT_ARR_FIXED)
-    {
-        write_mask(b, DT_ARR_FIXED, nitems, 0);
-    }
-    else if (nitems <= LIMIT_MEDIUM)
-    {
-        write_mask(b, DT_ARR_MEDIUM, nitems, 2);
-    }
-    else if (nitems <= LIMIT_LARGE)
-    {
-        write_mask(b, DT_ARR_LARGE, nitems, 4);
-    }
-    else
+    if (oob->n > CM_LIMIT_LARGE)
     {
-        error_size_limit(Array, nitems);
+        PyErr_SetString(PyExc_ValueError, "Can't pass more than 4294967296 buffers out-of-band");
         return false;
     }
 
-    return true;
-}
-
-static _always_inline bool write_list(buffer_t *b, PyObject *obj)
-{
-    // No ensure_space, already done globally
-
-    b->recursion++;
+    PyObject *view = PyMemoryView_Check(obj) ? Py_NewRef(obj) : PyMemoryView_FromObject(obj);
 
-    if (!recursion_check(b))
+    if (!view)
         return false;
+    
+    PyObject *result = PyObject_CallOneArg(oob->callback, view);
+    Py_DECREF(view);
 
-    size_t nitems = PyList_GET_SIZE(obj);
+    if (!result)
+        return false;
+    
+    Py_DECREF(result);
 
-    if (!write_array_header(b, nitems))
+    if (!ensure_space(b, 6))
         return false;
     
-    for (size_t i = 0; i < nitems; ++i)
-    {
-        PyObject *item = PyList_GET_ITEM(obj, i);
-        
-        if (!encode_object_inline(b, item))
-            return false;
-    }
+    const uint32_t num = CM_BIG_32((uint32_t)oob->n++);
 
-    b->recursion--;
+    b->offset += cm_write_ext_header(b->offset, CM_EXT_ID_OOB_BUFFER, 4);
+    memcpy(b->offset, &num, 4);
+    b->offset += 4;
 
     return true;
 }
 
-static _always_inline bool write_tuple(buffer_t *b, PyObject *obj)
+// Get a memoryview of the buffer a placeholder refers to
+static PyObject *decode_oob_buffer(buffer_t *b, const char *buf, size_t size)
 {
-    // No ensure_space, already done globally
-
-    b->recursion++;
+    if (size != 4)
+        return PyErr_Format(PyExc_ValueError, "Expected out-of-band buffer placeholders to hold 4 bytes, but got %zu", size);
+    
+    const size_t index = (size_t)cm_load_u32(buf);
 
-    if (!recursion_check(b))
-        return false;
+    if (index >= (size_t)PySequence_Fast_GET_SIZE(b->oob->buffers))
+        return PyErr_Format(PyExc_ValueError, "Got a placeholder for out-of-band buffer %zu, but only %zi buffers were given",
+            index, PySequence_Fast_GET_SIZE(b->oob->buffers));
+    
+    return PyMemoryView_FromObject(PySequence_Fast_GET_ITEM(b->oob->buffers, index));
+}
 
-    size_t nitems = PyTuple_GET_SIZE(obj);
 
-    if (!write_array_header(b, nitems))
-        return false;
-    
-    for (size_t i = 0; i < nitems; ++i)
-    {
-        PyObject *item = PyTuple_GET_ITEM(obj, i);
-        
-        if (!encode_object_inline(b, item))
-            return false;
-    }
+/////////////////////
+//  INTEGER ARRAYS  //
+/////////////////////
 
-    b->recursion--;
+/* # Packed integer arrays
+ * 
+ * When enabled, lists and tuples of at least `INT_ARRAY_MIN_ITEMS` integers within the signed 64-bit range are written as
+ * an ext type with ID `CM_EXT_ID_INT_ARRAY`, if that's smaller than writing them as an array. The ext data holds:
+ * - The number of items, as a 32-bit big-endian integer
+ * - The bit width of the packed values, from 1 to 64, as a byte
+ * - The first item, as a 64-bit big-endian integer
+ * - The difference between the first two items (the first delta), zig-zag encoded as a 64-bit big-endian integer
+ * - For each further item, the difference between its delta and the previous delta (the delta-of-delta), zig-zag encoded
+ *   and packed into the given number of bits, starting at the least significant bit of each byte
+ * 
+ * All differences wrap around at 64 bits, so that any 64-bit integers can be stored. For evenly spaced values such as
+ * timestamps, each delta-of-delta is zero, and only takes a single bit.
+ */
 
-    return true;
+static _always_inline uint64_t zigzag_encode(uint64_t num)
+{
+    return (num << 1) ^ (uint64_t)((int64_t)num >> 63);
 }
 
-static _always_inline bool write_dict(buffer_t *b, PyObject *obj)
+static _always_inline uint64_t zigzag_decode(uint64_t num)
 {
-    // No ensure_space, already done globally
+    return (num >> 1) ^ (0 - (num & 1));
+}
 
-    b->recursion++;
+// The number of bytes an integer takes when written as a regular integer
+static _always_inline size_t int_encoded_size(int64_t num)
+{
+    if (num >= CM_LIMIT_INT_FIXED && num <= (int64_t)CM_LIMIT_UINT_FIXED)
+        return 1;
+    else if (num >= CM_LIMIT_INT_BIT8 && num <= (int64_t)CM_LIMIT_UINT_BIT8)
+        return 2;
+    else if (num >= CM_LIMIT_INT_BIT16 && num <= (int64_t)CM_LIMIT_UINT_BIT16)
+        return 3;
+    else if (num >= CM_LIMIT_INT_BIT32 && num <= (int64_t)CM_LIMIT_UINT_BIT32)
+        return 5;
+    
+    return 9;
+}
 
-    if (!recursion_check(b))
+// Get the value of an item as a 64-bit integer, returns false if it's not an integer within the signed 64-bit range
+static _always_inline bool int_array_item(PyObject *item, uint64_t *num)
+{
+    if (Py_TYPE(item) != &PyLong_Type)
         return false;
+    
+    int overflow;
+    const long long val = PyLong_AsLongLongAndOverflow(item, &overflow);
 
-    const size_t npairs = PyDict_GET_SIZE(obj);
+    *num = (uint64_t)val;
+    return overflow == 0;
+}
 
-    // No ensure_space, already done globally
+// Write the NITEMS integers at ITEMS as a packed integer array if possible and smaller. WRITTEN is set to whether it was written
+static bool write_int_array(buffer_t *b, PyObject **items, size_t nitems, bool *written)
+{
+    *written = false;
+
+    if (nitems > CM_LIMIT_LARGE)
+        return true;
+
+    // Find the largest delta-of-delta and the size of the regular array, stopping at the first item that isn't an integer
+    uint64_t first, prev, delta = 0, maxdod = 0;
+    size_t regular = 5;
+
+    if (!int_array_item(items[0], &first))
+        return true;
     
-    if (npairs <= LIMIT_MAP_FIXED)
-    {
-        write_mask(b, DT_MAP_FIXED, npairs, 0);
-    }
-    else if (npairs <= LIMIT_MEDIUM)
-    {
-        write_mask(b, DT_MAP_MEDIUM, npairs, 2);
-    }
-    else if (npairs <= LIMIT_LARGE)
-    {
-        write_mask(b, DT_MAP_LARGE, npairs, 4);
-    }
-    else
-    {
-        error_size_limit(Map, npairs);
-        return false;
-    }
+    prev = first;
+    regular += int_encoded_size((int64_t)first);
 
-    Py_ssize_t pos = 0;
-    for (size_t i = 0; i < npairs; ++i)
+    for (size_t i = 1; i < nitems; ++i)
     {
-        PyObject *key;
-        PyObject *val;
-        PyDict_Next(obj, &pos, &key, &val);
+        uint64_t num;
+        if (!int_array_item(items[i], &num))
+            return true;
+        
+        const uint64_t newdelta = num - prev;
 
-        if (!b->str_keys)
+        if (i >= 2)
         {
-            if (!encode_object_inline(b, key))
-                return false;
-        }
-        else if (PyUnicode_CheckExact(key))
-        {
-            if (!write_string(b, obj))
-                return false;
+            const uint64_t dod = zigzag_encode(newdelta - delta);
+
+            if (dod > maxdod)
+                maxdod = dod;
+        }
+
+        delta = newdelta;
+        prev = num;
+        regular += int_encoded_size((int64_t)num);
+    }
+
+    // A width of at least 1 bit bounds the number of items by the data size when decoding
+    unsigned int width = 1;
+    while (width < 64 && (maxdod >> width) != 0)
+        ++width;
+    
+    const size_t size = 21 + ((nitems - 2) * width + 7) / 8;
+
+    if (size + 6 >= regular)
+        return true;
+    
+    if (!ensure_space(b, size + 6))
+        return false;
+    
+    b->offset += cm_write_ext_header(b->offset, CM_EXT_ID_INT_ARRAY, size);
+
+    const uint32_t count = CM_BIG_32((uint32_t)nitems);
+    memcpy(b->offset, &count, 4);
+    b->offset[4] = (char)width;
+
+    const uint64_t bigfirst = CM_BIG_64(first);
+    memcpy(b->offset + 5, &bigfirst, 8);
+
+    // Pack the values while computing them again, the items can't change in between as no Python code was run
+    unsigned char *out = (unsigned char *)b->offset + 21;
+    memset(out, 0, size - 21);
+
+    size_t bitpos = 0;
+    prev = first;
+
+    for (size_t i = 1; i < nitems; ++i)
+    {
+        uint64_t num = 0;
+        int_array_item(items[i], &num);
+
+        const uint64_t newdelta = num - prev;
+
+        if (i == 1)
+        {
+            const uint64_t bigdelta = CM_BIG_64(zigzag_encode(newdelta));
+            memcpy(b->offset + 13, &bigdelta, 8);
         }
         else
         {
-            PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(key)->tp_name);
-            return false;
+            const uint64_t dod = zigzag_encode(newdelta - delta);
+
+            for (unsigned int done = 0; done < width;)
+            {
+                const unsigned int shift = bitpos & 7;
+                const unsigned int take = (8 - shift) < (width - done) ? (8 - shift) : (width - done);
+
+                out[bitpos >> 3] |= (unsigned char)(((dod >> done) & ((1u << take) - 1)) << shift);
+
+                done += take;
+                bitpos += take;
+            }
         }
 
-        if (!encode_object_inline(b, val))
-            return false;
+        delta = newdelta;
+        prev = num;
     }
 
-    b->recursion--;
+    b->offset += size;
 
+    *written = true;
     return true;
 }
 
-static _always_inline bool write_extension(buffer_t *b, PyObject *obj)
+// Decode a packed integer array into a list
+static PyObject *decode_int_array(buffer_t *b, const char *buf, size_t size)
 {
-    // Attempt to encode the object as an extension type
-    char id = 0;
-    PyObject *result = attempt_encode_ext(b, obj, &id);
+    if (size < 21)
+        return PyErr_Format(PyExc_ValueError, "Expected packed integer arrays to hold at least 21 bytes, but got %zu", size);
+    
+    const size_t nitems = (size_t)cm_load_u32(buf);
+    const unsigned int width = (unsigned char)buf[4];
 
-    if (!result)
-        return false;
+    if (nitems < 2 || width == 0 || width > 64 || size != 21 + ((nitems - 2) * width + 7) / 8)
+        return PyErr_Format(PyExc_ValueError, "Got a packed integer array of %zu items with a bit width of %u, which doesn't match its size of %zu bytes", nitems, width, size);
     
-    Py_buffer buf;
-    if (PyObject_GetBuffer(result, &buf, PyBUF_SIMPLE) < 0)
-    {
-        PyErr_Format(PyExc_TypeError, "Expected to receive a bytes-like object from extension encode functions, but got an object of type '%s'", Py_TYPE(result)->tp_name);
-        Py_DECREF(result);
-        return false;
-    }
+    PyObject *list = PyList_New((Py_ssize_t)nitems);
 
-    size_t size = (size_t)buf.len;
+    if (!list)
+        return NULL;
+    
+    const unsigned char *in = (const unsigned char *)buf + 21;
+    const uint64_t mask = width == 64 ? UINT64_MAX : ((uint64_t)1 << width) - 1;
 
-    if (!ensure_space(b, 6 + size))
-        return false;
+    uint64_t num = cm_load_u64(buf + 5);
+    uint64_t delta = zigzag_decode(cm_load_u64(buf + 13));
+    size_t bitpos = 0;
 
-    // If the size is a base of 2 and not larger than 16, it can be represented with a fixsize mask
-    const bool is_baseof2 = size != 0 && (size & (size - 1)) == 0;
-    if (size <= 16 && is_baseof2)
+    for (size_t i = 0; i < nitems; ++i)
     {
-        const unsigned char fixmask = (
-            size ==  8 ? DT_EXT_FIX8  :
-            size == 16 ? DT_EXT_FIX16 :
-            size ==  4 ? DT_EXT_FIX4  :
-            size ==  2 ? DT_EXT_FIX2  :
-                         DT_EXT_FIX1
-        );
+        if (i >= 2)
+        {
+            // Read the bytes holding the value, and shift out the bits before it
+            const size_t byte = bitpos >> 3;
+            const unsigned int shift = bitpos & 7;
+            const size_t nbytes = (shift + width + 7) / 8;
+
+            uint64_t bits = 0;
+            for (size_t j = 0; j < nbytes && j < 8; ++j)
+                bits |= (uint64_t)in[byte + j] << (j * 8);
+            
+            bits >>= shift;
 
-        INCBYTE = fixmask;
-    }
-    else if (size <= LIMIT_SMALL)
-    {
-        write_mask(b, DT_EXT_SMALL, size, 1);
-    }
-    else if (size <= LIMIT_MEDIUM)
-    {
-        write_mask(b, DT_EXT_MEDIUM, size, 2);
-    }
-    else if (size <= LIMIT_LARGE)
-    {
-        write_mask(b, DT_EXT_LARGE, size, 4);
-    }
-    else
-    {
-        Py_DECREF(result);
+            // With a width over 56 bits, the value can span 9 bytes
+            if (nbytes == 9)
+                bits |= (uint64_t)in[byte + 8] << (64 - shift);
+            
+            delta += zigzag_decode(bits & mask);
+            bitpos += width;
+        }
 
-        error_size_limit(Ext, size);
-        return false;
-    }
+        if (i >= 1)
+            num += delta;
+        
+        const int64_t val = (int64_t)num;
+        PyObject *item = val >= -INTEGER_CACHE_NNEG && val <= 255 ? get_cached_int(b, (int)val) : PyLong_FromLongLong(val);
 
-    INCBYTE = id;
+        if (!item)
+        {
+            Py_DECREF(list);
+            return NULL;
+        }
 
-    memcpy(b->offset, buf.buf, size);
-    b->offset += size;
+        PyList_SET_ITEM(list, i, item);
+    }
 
-    PyBuffer_Release(&buf);
-    Py_DECREF(result);
+    // The list stands in for an array, so it's numbered like one with shared references
+    if (!decoding_add_ref(b, list))
+    {
+        Py_DECREF(list);
+        return NULL;
+    }
 
-    return true;
+    return list;
 }
 
 
 /////////////////////
-//  OBJECT CACHES  //
+//   EXT LOOKUPS   //
 /////////////////////
 
-#define MM2_CONSTANT 0x5BD1E995
-
-static _always_inline uint32_t murmur2_hash(char *data, size_t size)
+// Find the ext item registered for the type of OBJ or one of its base types
+static _always_inline ext_dictitem_t *find_encode_ext(buffer_t *b, PyObject *obj)
 {
-    uint32_t hash = size;
+    // We're guaranteed to have an ExtTypesEncode object due to the global one
 
-    while (size >= 4)
+    // Attempt to get an item for all subclasses of OBJ, up until Type
+    ext_dictitem_t *item = NULL;
+    PyTypeObject *type = Py_TYPE(obj);
+    while (type != &PyType_Type)
     {
-        uint32_t chunk;
-        memcpy(&chunk, data, 4);
+        item = (ext_dictitem_t *)PyDict_GetItem(b->ext.dict, (PyObject *)type);
 
-        chunk *= MM2_CONSTANT;
-        chunk ^= chunk >> 24;
-        chunk *= MM2_CONSTANT;
+        if (item)
+            break;
+        
+        type = Py_TYPE(type);
+    }
 
-        hash *= MM2_CONSTANT;
-        hash ^= chunk;
+    // If we didn't find an item, the object is of an invalid type, unless it can be written as binary data
+    if (!item && !PyObject_CheckBuffer(obj))
+        PyErr_Format(PyExc_TypeError, "Received unsupported type '%s'"
+            "\n\tHint: Did you mean to add this type to the Extension Types?", Py_TYPE(obj)->tp_name);
+    
+    return item;
+}
 
-        data += 4;
-        size -= 4;
-    }
+// Decode ext data holding an encoded object, and pass the object to FUNC
+static PyObject *decode_nested_ext(buffer_t *b, PyObject *func, char *buf, size_t size)
+{
+    // The data is fully in memory at this point, also when reading from a file
+    buffer_t nb = *b;
+    nb.offset = buf;
+    nb.maxoffset = buf + size;
+    nb.file = NULL;
+    nb.dio = NULL;
+    nb.depth = 0;
+    nb.raw_depth = 0;
 
-    switch (size)
+    // Placeholders can't be passed to FUNC, so batched types are decoded right away
+    nb.batch = NULL;
+
+    PyObject *obj = decode_bytes(&nb);
+
+    if (!obj)
+        return NULL;
+    
+    if (nb.offset != nb.maxoffset)
     {
-    case 3: hash ^= data[2] << 16;
-    case 2: hash ^= data[1] <<  8;
-    case 1: hash ^= data[0];
-            hash *= MM2_CONSTANT;
+        Py_DECREF(obj);
+        return PyErr_Format(PyExc_ValueError, "The encoded object in nested extension data ended before the extension data ended");
     }
 
-    hash ^= hash >> 13;
-    hash *= MM2_CONSTANT;
-    hash ^= hash >> 15;
+    PyObject *result = PyObject_CallOneArg(func, obj);
+    Py_DECREF(obj);
 
-    return hash;
+    return result;
 }
 
-// Attempt to get a string from the string cache before constructing it from scratch
-static _always_inline PyObject *get_cached_str(char *ptr, size_t size, strcache_t *cache)
+// Attempt to decode an ext type object. Returns the object from the type's decode function
+static _always_inline PyObject *attempt_decode_ext(buffer_t *b, char *buf, size_t size, char id)
 {
-    // Calculate the hash of the string
-    const size_t hash = murmur2_hash(ptr, size) % STRING_CACHE_SLOTS;
-
-    // Lock the cache slot
-    lock_flag(&cache->locks[hash]);
+    // We're guaranteed to have an ExtTypesDecode object due to the global one
 
-    // Load the match stored at the hash index
-    PyASCIIObject *match = cache->slots[hash];
+    if (b->refs && id == CM_EXT_ID_SHARED_REF)
+        return decode_shared_ref(b, buf, size);
+    
+    if (b->oob && id == CM_EXT_ID_OOB_BUFFER)
+        return decode_oob_buffer(b, buf, size);
+    
+    if (b->int_arrays && id == CM_EXT_ID_INT_ARRAY)
+        return decode_int_array(b, buf, size);
 
-    if (match)
-    {
-        // Get the match's base and size
-        const char *mbase = (const char *)(match + 1);
-        const size_t msize = match->length;
+    // Native functions take the data as-is
+    const ext_native_t *native = &b->ext.natives[(unsigned char)id];
 
-        // Compare the match to the required string
-        if (msize == size && memcmp(mbase, ptr, size) == 0)
-        {
-            // Get reference to the match object
-            Py_INCREF(match);
+    if (native->func)
+        return native->func(buf, size, native->ctx);
 
-            // Increase match strength as we matched again
-            cache->match_strength[hash]++;
+    // See if there's a function for this ID
+    PyObject *func = b->ext.funcs[(unsigned char)id];
 
-            // Release the lock
-            unlock_flag(&cache->locks[hash]);
+    if (!func)
+        return PyErr_Format(PyExc_TypeError, "Found an extension type with ID %i, but no function was registered for this ID"
+            "\n\tHint: Did you forget to add a decoding function to the extension types, or is there a mismatch between IDs?", id);
+    
+    if (b->ext.nested[(unsigned char)id])
+        return decode_nested_ext(b, func, buf, size);
 
-            return (PyObject *)match;
-        }
-    }
+    // Whether the value should be added to the batch instead of decoded right away
+    const bool batch = b->ext.batch[(unsigned char)id];
+    const bool defer = batch && b->batch;
 
-    // No common value, create a new one
-    PyObject *obj = PyUnicode_DecodeUTF8(ptr, size, NULL);
+    // Decide if we should return a bytes or memoryview object
+    PyObject *bufobj;
 
-    // If ASCII, it can be cached
-    if (PyUnicode_IS_COMPACT_ASCII(obj))
+    // Deferred values from files are passed as bytes, as the file buffer gets overwritten before the function is called
+    if (b->ext.pass_memview && !(defer && b->file))
     {
-        // Decrease match strength as a match failed
-        cache->match_strength[hash]--;
-
-        // Replace the match if the strength reached zero
-        if (cache->match_strength[hash] == 0)
-        {
-            // Lose reference to the match and keep reference to the new object
-            Py_XDECREF(match);
-            Py_INCREF(obj);
+        bufobj = PyMemoryView_FromMemory(buf, (Py_ssize_t)size, PyBUF_READ);
+    }
+    else
+    {
+        bufobj = PyBytes_FromStringAndSize(buf, (Py_ssize_t)size);
+    }
 
-            // Assign the object to the cache and initialize match strength at 3
-            cache->slots[hash] = (PyASCIIObject *)obj;
-            cache->match_strength[hash] = 3;
-        }
+    if (!bufobj)
+        return PyErr_NoMemory();
+    
+    if (defer)
+    {
+        if (!batch_push(b->batch, bufobj, func))
+            return NULL;
+        
+        return Py_NewRef(b->states->batch_placeholder);
     }
+    
+    // Call the decode function
+    const uint64_t start = usdt_clock(ext__decode);
 
-    // Release the lock
-    unlock_flag(&cache->locks[hash]);
+    PyObject *result = batch ? batch_call_single(func, bufobj) : PyObject_CallOneArg(func, bufobj);
 
-    return obj;
-}
+    usdt_probe(ext__decode, (int)id, size, _monotonic_ns() - start);
 
-// Get a cached integer, must be between -128 and 1023
-static _always_inline PyObject *get_cached_int(buffer_t *b, int n)
-{
-    return (PyObject *)&b->states->caches.integers.slots[n + INTEGER_CACHE_NNEG];
+    Py_DECREF(bufobj);
+    return result;
 }
 
-/////////////////////////
-//  CREATE CONTAINERS  //
-/////////////////////////
 
-static _always_inline PyObject *create_array(buffer_t *b, const size_t nitems)
+/////////////////////
+//   RAW OBJECTS   //
+/////////////////////
+
+// Create a raw object holding SIZE bytes at DATA, which must be part of the buffer of OWNER
+static PyObject *create_raw(PyObject *owner, char *data, size_t size)
 {
-    PyObject *list = PyList_New(nitems);
+    raw_t *raw = PyObject_New(raw_t, &RawObj);
 
-    if (!list)
-        return NULL;
+    if (!raw)
+        return PyErr_NoMemory();
 
-    for (size_t i = 0; i < nitems; ++i)
+    // Get a separate view of the owner, so that the data stays valid for as long as the raw object exists
+    if (PyObject_GetBuffer(owner, &raw->view, PyBUF_SIMPLE) < 0)
     {
-        PyObject *item = decode_bytes(b);
-
-        if (item == NULL)
-        {
-            Py_DECREF(list);
-            return NULL;
-        }
-        
-        PyList_SET_ITEM(list, i, item);
+        PyObject_Del(raw);
+        return NULL;
     }
 
-    return list;
+    raw->data = data;
+    raw->size = size;
+
+    return (PyObject *)raw;
 }
 
-static _always_inline PyObject *create_map(buffer_t *b, const size_t npairs)
+// Create a Raw object
+static PyObject *Raw(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
 {
-    PyObject *dict = _PyDict_NewPresized(npairs);
-
-    if (!dict)
-        return PyErr_NoMemory();
+    const Py_ssize_t npositional = 1;
+    if (!min_positional(nargs, npositional))
+        return NULL;
 
-    for (size_t i = 0; i < npairs; ++i)
-    {
-        PyObject *key;
+    PyObject *encoded = parse_positional(args, 0, NULL, "encoded");
 
-        if (!overread_check(b, 1))
-        {
-            Py_DECREF(dict);
-            return NULL;
-        }
+    if (!encoded)
+        return NULL;
 
-        // Special case for fixsize strings
-        const unsigned char mask = b->offset[0];
-        if ((mask & 224) == DT_STR_FIXED)
-        {
-            b->offset++;
+    mstates_t *states = get_mstates(self);
 
-            const size_t size = mask & 31;
+    PyObject *validate = Py_False;
 
-            if (!overread_check(b, size))
-            {
-                Py_DECREF(dict);
-                return NULL;
-            }
+    keyarg_t keyargs[] = {
+        KEYARG(&validate, &PyBool_Type, states->interned.validate),
+    };
 
-            key = get_cached_str(b->offset, size, &b->states->caches.strings);
-            b->offset += size;
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
 
-            if (!key)
-            {
-                Py_DECREF(dict);
-                return NULL;
-            }
-        }
-        else
-        {
-            key = decode_bytes(b);
+    raw_t *raw = PyObject_New(raw_t, &RawObj);
 
-            if (!key)
-            {
-                Py_DECREF(dict);
-                return NULL;
-            }
+    if (!raw)
+        return PyErr_NoMemory();
 
-            if (b->str_keys && !PyUnicode_CheckExact(key))
-            {
-                Py_DECREF(dict);
-                Py_DECREF(key);
+    if (PyObject_GetBuffer(encoded, &raw->view, PyBUF_SIMPLE) < 0)
+    {
+        PyObject_Del(raw);
+        return NULL;
+    }
 
-                PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(key)->tp_name);
-                return NULL;
-            }
-        }
+    raw->data = raw->view.buf;
+    raw->size = (size_t)raw->view.len;
 
-        PyObject *val = decode_bytes(b);
+    // Check if the data holds exactly one encoded object
+    if (validate == Py_True)
+    {
+        buffer_t b;
+        b.file = NULL;
+        b.offset = raw->data;
+        b.maxoffset = raw->data + raw->size;
 
-        if (val == NULL)
+        if (!skip_object(&b))
         {
-            Py_DECREF(key);
-            Py_DECREF(dict);
+            Py_DECREF(raw);
             return NULL;
         }
 
-        PyDict_SetItem(dict, (PyObject *)key, val);
+        if (b.offset != b.maxoffset)
+        {
+            Py_DECREF(raw);
 
-        Py_DECREF(key);
-        Py_DECREF(val);
+            PyErr_SetString(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
+            return NULL;
+        }
     }
 
-    return dict;
+    return (PyObject *)raw;
+}
+
+static void raw_dealloc(raw_t *raw)
+{
+    PyBuffer_Release(&raw->view);
+    PyObject_Del(raw);
+}
+
+// Expose the encoded data through the buffer protocol, so that raw objects can be decoded directly
+static int raw_getbuffer(raw_t *raw, Py_buffer *view, int flags)
+{
+    return PyBuffer_FillInfo(view, (PyObject *)raw, raw->data, (Py_ssize_t)raw->size, 1, flags);
 }
 
 
 ////////////////////
-//    ENCODING    //
+//  WRITING DATA  //
 ////////////////////
 
-static bool encode_object(buffer_t *b, PyObject *obj, PyTypeObject *tp)
+// Get the current offset's byte and increment afterwards
+#define INCBYTE ((b->offset++)[0])
+
+// Separate from `write_str` for re-use in other places, for getting string data
+static _always_inline void py_str_data(PyObject *obj, char **base, size_t *size)
 {
-    if (tp == &PyList_Type || PyList_Check(obj))
-    {
-        return write_list(b, obj);
-    }
-    else if (tp == &PyDict_Type || PyDict_Check(obj))
-    {
-        return write_dict(b, obj);
-    }
-    else if (tp == &PyTuple_Type || PyTuple_Check(obj))
-    {
-        return write_tuple(b, obj);
-    }
-    else if (PyBytes_Check(obj))
-    {
-        return write_bytes(b, obj);
-    }
-    else if (PyByteArray_Check(obj))
-    {
-        return write_bytearray(b, obj);
-    }
-    else if (PyMemoryView_Check(obj))
+    // Check if the object is compact ASCII, use quick path for that
+    if (PyUnicode_IS_COMPACT_ASCII(obj))
     {
-        return write_memoryview(b, obj);
+        *size = ((PyASCIIObject *)obj)->length;
+        *base = (char *)(((PyASCIIObject *)obj) + 1);
     }
     else
     {
-        return write_extension(b, obj);
+        // Otherwise simply get data through this
+        *base = (char *)PyUnicode_AsUTF8AndSize(obj, (Py_ssize_t *)size);
+
+        if (base == NULL)
+            PyErr_SetString(PyExc_BufferError, "Unable to get the internal buffer of a string");
     }
 }
 
-static _always_inline bool encode_object_inline(buffer_t *b, PyObject *obj)
+// Write a header and the SIZE bytes at DATA straight to the file, for data larger than the chunk size.
+// Only the header goes through the buffer, so the data isn't copied into it and the buffer stays within the chunk size
+static bool encoding_write_direct(buffer_t *b, const char *header, size_t nheader, const char *data, size_t size)
 {
-    PyTypeObject *tp = Py_TYPE(obj);
+    if (!ensure_space(b, nheader))
+        return false;
+    
+    memcpy(b->offset, header, nheader);
+    b->offset += nheader;
 
-    if (tp == &PyUnicode_Type)
+    // Write out everything before the data, which also takes the write lock
+    if (!encoding_flush(b))
+        return false;
+    
+    // The GIL is kept, as the data can belong to a mutable object such as a bytearray
+    flush_t *flush = b->flush;
+    const size_t written = fwrite(data, 1, size, flush->file);
+
+    flush->flushed += written;
+
+    if (written != size)
     {
-        return write_string(b, obj);
+        PyErr_SetFromErrno(PyExc_OSError);
+        return false;
     }
 
-    // A lot of cases below require 9 or less space, ensure globally for all of them here
-    if (!ensure_space(b, 9))
+    return true;
+}
+
+static _always_inline bool write_string(buffer_t *b, PyObject *obj)
+{
+    char *base;
+    size_t size;
+    py_str_data(obj, &base, &size);
+
+    if (base == NULL)
         return false;
 
-    if (tp == &PyLong_Type)
-    {
-        return write_integer(b, obj);
-    }
-    else if (tp == &PyFloat_Type)
-    {
-        return write_double(b, obj);
-    }
-    else if (tp == &PyBool_Type)
+    if (b->flush && size > b->flush->size)
     {
-        return write_bool(b, obj);
-    }
-    else if (obj == Py_None)
-    {
-        return write_nil(b, obj);
+        char header[CM_MAX_HEADER_SIZE];
+        const size_t nheader = cm_write_str_header(header, size);
+
+        if (nheader == 0)
+        {
+            error_size_limit(String, size);
+            return false;
+        }
+
+        return encoding_write_direct(b, header, nheader, base, size);
     }
-    else
+
+    if (!ensure_space(b, size + 5))
+        return false;
+
+    const size_t nwritten = cm_write_str_header(b->offset, size);
+
+    if (nwritten == 0)
     {
-        return encode_object(b, obj, tp);
+        error_size_limit(String, size);
+        return false;
     }
-}
 
+    b->offset += nwritten;
 
-////////////////////
-//    DECODING    //
-////////////////////
-
-// INCBYTE but type-casted to ensure we operate with a single byte
-#define SIZEBYTE ((unsigned char)(b->offset++)[0])
+    memcpy(b->offset, base, size);
+    b->offset += size;
 
-// Masks away the top 3 bits of a mask for varlen cases, as they all have the same upper 3 bits
-#define VARLEN_DT(mask) (mask & 31)
+    return true;
+}
 
-// Decoding of fixsize objects
-static _always_inline PyObject *decode_bytes_fixsize(buffer_t *b, unsigned char mask)
+static _always_inline bool write_binary(buffer_t *b, char *base, size_t size)
 {
-    // Check which type we got
-    if ((mask & 224) == DT_STR_FIXED)
+    if (b->flush && size > b->flush->size)
     {
-        mask &= 31;
-
-        if (!overread_check(b, mask))
-            return NULL;
+        char header[CM_MAX_HEADER_SIZE];
+        const size_t nheader = cm_write_bin_header(header, size);
 
-        PyObject *obj = PyUnicode_DecodeUTF8(b->offset, mask, NULL);
-        b->offset += mask;
+        if (nheader == 0)
+        {
+            error_size_limit(Binary, size);
+            return false;
+        }
 
-        return obj;
-    }
-    else if ((mask & 128) == DT_UINT_FIXED) // Uint only has upper bit set to 0
-    {
-        return get_cached_int(b, mask);
+        return encoding_write_direct(b, header, nheader, base, size);
     }
-    else if ((mask & 224) == DT_INT_FIXED)
-    {
-        int8_t num = mask & 31;
 
-        // Sign-extend the number if it's negative
-        if ((num & 16) == 16)
-            num |= ~31;
+    if (!ensure_space(b, size + 5))
+        return false;
 
-        return get_cached_int(b, num);
-    }
-    else if ((mask & 240) == DT_ARR_FIXED) // The 5th bit is used on ARR and MAP too, instead of just the upper 3
-    {
-        return create_array(b, mask & 0x0F);
-    }
-    else if ((mask & 240) == DT_MAP_FIXED)
-    {
-        return create_map(b, mask & 0x0F);
-    }
-    else
+    const size_t nwritten = cm_write_bin_header(b->offset, size);
+
+    if (nwritten == 0)
     {
-        return PyErr_Format(PyExc_ValueError, "Got an invalid header (0x%02X) while decoding data", mask);
+        error_size_limit(Binary, size);
+        return false;
     }
+
+    b->offset += nwritten;
+
+    memcpy(b->offset, base, size);
+    b->offset += size;
+
+    return true;
 }
 
-// Decoding of varlen objects
-static _always_inline PyObject *decode_bytes_varlen(buffer_t *b, const unsigned char mask)
+static _always_inline bool write_bytes(buffer_t *b, PyObject *obj)
 {
-    // Global variable to hold the size across multiple cases
-    uint64_t n = 0;
+    char *base = PyBytes_AS_STRING(obj);
+    size_t size = PyBytes_GET_SIZE(obj);
 
-    // Switch over the varlen mask
-    const unsigned int varlen_mask = VARLEN_DT(mask);
-    switch (varlen_mask)
-    {
-    case VARLEN_DT(DT_STR_LARGE):
-    {
-        if (!overread_check(b, 4))
-            return NULL;
+    if (b->oob && size >= OOB_MIN_SIZE)
+        return write_oob_buffer(b, obj);
 
-        n |= SIZEBYTE << 24;
-        n |= SIZEBYTE << 16;
-    }
-    case VARLEN_DT(DT_STR_MEDIUM):
-    {
-        if (!overread_check(b, 2))
-            return NULL;
+    return write_binary(b, base, size);
+}
 
-        n |= SIZEBYTE << 8;
-    }
-    case VARLEN_DT(DT_STR_SMALL):
-    {
-        if (!overread_check(b, 1))
-            return NULL;
+static _always_inline bool write_bytearray(buffer_t *b, PyObject *obj)
+{
+    char *base = PyByteArray_AS_STRING(obj);
+    size_t size = PyByteArray_GET_SIZE(obj);
 
-        n |= SIZEBYTE;
+    if (b->oob && size >= OOB_MIN_SIZE)
+        return write_oob_buffer(b, obj);
 
-        if (!overread_check(b, n))
-            return NULL;
+    return write_binary(b, base, size);
+}
 
-        PyObject *obj = PyUnicode_DecodeUTF8(b->offset, n, NULL);
-        b->offset += n;
+// Write the data of a buffer view as binary data, in C order if it's not contiguous
+static bool write_buffer_view(buffer_t *b, Py_buffer *view)
+{
+    const size_t size = (size_t)view->len;
 
-        return obj;
-    }
+    if (PyBuffer_IsContiguous(view, 'C'))
+        return write_binary(b, view->buf, size);
+    
+    if (!ensure_space(b, size + 5))
+        return false;
+
+    const size_t nwritten = cm_write_bin_header(b->offset, size);
 
-    case VARLEN_DT(DT_UINT_BIT8):
+    if (nwritten == 0)
     {
-        if (!overread_check(b, 1))
-            return NULL;
+        error_size_limit(Binary, size);
+        return false;
+    }
 
-        uint8_t num = SIZEBYTE;
+    // Gather the data into the output directly
+    if (PyBuffer_ToContiguous(b->offset + nwritten, view, (Py_ssize_t)size, 'C') < 0)
+        return false;
 
-        return get_cached_int(b, num);
+    b->offset += nwritten + size;
+
+    return true;
+}
+
+static _always_inline bool write_memoryview(buffer_t *b, PyObject *obj)
+{
+    Py_buffer *view = PyMemoryView_GET_BUFFER(obj);
+
+    if (b->oob && (size_t)view->len >= OOB_MIN_SIZE)
+        return write_oob_buffer(b, obj);
+
+    return write_buffer_view(b, view);
+}
+
+// Write the data of any other object that exports a buffer, such as `mmap.mmap` or `array.array` objects
+static bool write_buffer(buffer_t *b, PyObject *obj)
+{
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_FULL_RO) < 0)
+        return false;
+    
+    const bool success = b->oob && (size_t)view.len >= OOB_MIN_SIZE ? write_oob_buffer(b, obj) : write_buffer_view(b, &view);
+
+    PyBuffer_Release(&view);
+    return success;
+}
+
+// Write already-encoded data into the buffer as-is
+static _always_inline bool write_raw(buffer_t *b, const char *data, size_t size)
+{
+    if (!ensure_space(b, size))
+        return false;
+
+    memcpy(b->offset, data, size);
+    b->offset += size;
+
+    return true;
+}
+
+static _always_inline bool write_double(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    b->offset += cm_write_double(b->offset, PyFloat_AS_DOUBLE(obj));
+
+    return true;
+}
+
+static _always_inline bool write_integer(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    // Cast the object to a LongObject for easy internals access
+    PyLongObject *lobj = (PyLongObject *)obj;
+
+    // Get the long_value fields for easy access
+    digit *digits = lobj->long_value.ob_digit;
+    uintptr_t tag = lobj->long_value.lv_tag;
+
+    // Get the number of digits and whether the number is positive
+    size_t ndigits = tag >> _PyLong_NON_SIZE_BITS;
+    bool positive = (tag & 3) != 2; // Check if the number is positive (or zero)
+
+    // Start the number off with the first digit
+    uint64_t num = digits[0];
+
+    // Iterate over the digits besides the first digit, using `ndigits` as the index to `digits`
+    while (ndigits > 1)
+    {
+        // Decrement to get it as index, working from top to bottom
+        --ndigits;
+
+        uint64_t dig = digits[ndigits];
+
+        // Calculate the shift amount for this digit
+        int shift = PyLong_SHIFT * ndigits;
+
+        // Shift the digit in place
+        uint64_t shifted = dig << shift;
+
+        // Check for overflow
+        if ((shifted >> shift) != dig)
+        {
+            overflow_case: // Jump label for the extra 64-bit negative check
+
+            PyErr_SetString(PyExc_OverflowError, "Integer values cannot exceed `2^64-1` or `-2^63` (must be within the 64-bit boundary)");
+            return false;
+        }
+
+        // Add the shifted digit to the total number
+        num |= shifted;
+    }
+
+    if (positive)
+    {
+        b->offset += cm_write_uint(b->offset, num);
+    }
+    else
+    {
+        // Get the number as signed and negative
+        int64_t snum = -num;
+
+        // Test if the limit was exceeded by checking if the negative number shows up as positive
+        if (snum >= 0)
+            goto overflow_case;
+
+        b->offset += cm_write_int(b->offset, snum);
+    }
+
+    return true;
+}
+
+static _always_inline bool write_bool(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    b->offset += cm_write_bool(b->offset, obj == Py_True);
+    return true;
+}
+
+static _always_inline bool write_nil(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    b->offset += cm_write_nil(b->offset);
+    return true;
+}
+
+// Recursion check for container types
+static _always_inline bool recursion_check(buffer_t *b)
+{
+    if (b->recursion > RECURSION_LIMIT)
+    {
+        PyErr_SetString(PyExc_RecursionError, "Exceeded the maximum recursion depth");
+        return false;
+    }
+
+    return true;
+}
+
+static _always_inline bool write_array_header(buffer_t *b, size_t nitems)
+{
+    // No ensure_space, already done globally
+
+    const size_t nwritten = cm_write_array_header(b->offset, nitems);
+
+    if (nwritten == 0)
+    {
+        error_size_limit(Array, nitems);
+        return false;
+    }
+
+    b->offset += nwritten;
+    return true;
+}
+
+static _always_inline bool write_map_header(buffer_t *b, size_t npairs)
+{
+    // No ensure_space, already done globally
+
+    const size_t nwritten = cm_write_map_header(b->offset, npairs);
+
+    if (nwritten == 0)
+    {
+        error_size_limit(Map, npairs);
+        return false;
+    }
+
+    b->offset += nwritten;
+    return true;
+}
+
+static _always_inline bool write_list(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    size_t nitems = PyList_GET_SIZE(obj);
+
+    if (b->int_arrays && nitems >= INT_ARRAY_MIN_ITEMS)
+    {
+        bool written;
+        if (!write_int_array(b, ((PyListObject *)obj)->ob_item, nitems, &written))
+            return false;
+        
+        if (written)
+            return true;
+    }
+
+    b->recursion++;
+
+    if (!recursion_check(b))
+        return false;
+
+    if (!write_array_header(b, nitems))
+        return false;
+    
+    for (size_t i = 0; i < nitems; ++i)
+    {
+        PyObject *item = PyList_GET_ITEM(obj, i);
+        
+        if (!encode_object_inline(b, item))
+            return false;
+    }
+
+    b->recursion--;
+
+    return true;
+}
+
+static _always_inline bool write_tuple(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    size_t nitems = PyTuple_GET_SIZE(obj);
+
+    if (b->int_arrays && nitems >= INT_ARRAY_MIN_ITEMS)
+    {
+        bool written;
+        if (!write_int_array(b, ((PyTupleObject *)obj)->ob_item, nitems, &written))
+            return false;
+        
+        if (written)
+            return true;
+    }
+
+    b->recursion++;
+
+    if (!recursion_check(b))
+        return false;
+
+    if (!write_array_header(b, nitems))
+        return false;
+    
+    for (size_t i = 0; i < nitems; ++i)
+    {
+        PyObject *item = PyTuple_GET_ITEM(obj, i);
+        
+        if (!encode_object_inline(b, item))
+            return false;
+    }
+
+    b->recursion--;
+
+    return true;
+}
+
+static _always_inline bool write_dict(buffer_t *b, PyObject *obj)
+{
+    // No ensure_space, already done globally
+
+    b->recursion++;
+
+    if (!recursion_check(b))
+        return false;
+
+    const size_t npairs = PyDict_GET_SIZE(obj);
+
+    if (!write_map_header(b, npairs))
+        return false;
+
+    Py_ssize_t pos = 0;
+    for (size_t i = 0; i < npairs; ++i)
+    {
+        PyObject *key;
+        PyObject *val;
+        PyDict_Next(obj, &pos, &key, &val);
+
+        if (!b->str_keys)
+        {
+            if (!encode_object_inline(b, key))
+                return false;
+        }
+        else if (PyUnicode_CheckExact(key))
+        {
+            if (!write_string(b, obj))
+                return false;
+        }
+        else
+        {
+            PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(key)->tp_name);
+            return false;
+        }
+
+        if (!encode_object_inline(b, val))
+            return false;
+    }
+
+    b->recursion--;
+
+    return true;
+}
+
+// Write an ext type using a native function, which writes the data to the buffer directly
+static bool write_native_extension(buffer_t *b, ext_dictitem_t *item, PyObject *obj)
+{
+    // Reserve space for the largest header, and let the function write whatever fits after it
+    if (!ensure_space(b, 6))
+        return false;
+    
+    char *data = b->offset + 6;
+    size_t avail = (size_t)(b->maxoffset - data);
+
+    Py_ssize_t written = item->native(obj, data, avail, item->ctx);
+
+    // Call it again with enough space if the data didn't fit
+    if (written > (Py_ssize_t)avail)
+    {
+        const size_t required = (size_t)written;
+
+        if (!ensure_space(b, 6 + required))
+            return false;
+        
+        data = b->offset + 6;
+        written = item->native(obj, data, required, item->ctx);
+
+        if (written > (Py_ssize_t)required)
+        {
+            PyErr_Format(PyExc_ValueError, "Native extension encode function for ID %i required %zi bytes after being given the %zu bytes it asked for", item->id, written, required);
+            return false;
+        }
+    }
+
+    if (written < 0)
+    {
+        if (!PyErr_Occurred())
+            PyErr_Format(PyExc_ValueError, "Native extension encode function for ID %i failed without setting an exception", item->id);
+        
+        return false;
+    }
+
+    const size_t size = (size_t)written;
+
+    char header[CM_MAX_HEADER_SIZE];
+    const size_t nheader = cm_write_ext_header(header, item->id, size);
+
+    if (nheader == 0)
+    {
+        error_size_limit(Ext, size);
+        return false;
+    }
+
+    // Move the data to right after the header, which is smaller than the reserved space for small sizes
+    memmove(b->offset + nheader, data, size);
+    memcpy(b->offset, header, nheader);
+
+    b->offset += nheader + size;
+
+    return true;
+}
+
+// Write an ext type using a function that writes to a memoryview of the output buffer, and returns the number of bytes written
+static bool write_sized_extension(buffer_t *b, ext_dictitem_t *item, PyObject *obj)
+{
+    const size_t size = item->size;
+
+    // Write the data after the header for the full size, it's moved back if less gets written
+    char header[CM_MAX_HEADER_SIZE];
+    size_t nheader = cm_write_ext_header(header, item->id, size);
+
+    if (!ensure_space(b, nheader + size))
+        return false;
+    
+    char *data = b->offset + nheader;
+
+    PyObject *view = PyMemoryView_FromMemory(data, (Py_ssize_t)size, PyBUF_WRITE);
+
+    if (!view)
+        return false;
+    
+    PyObject *args[] = {obj, view};
+    PyObject *result = PyObject_Vectorcall(item->func, args, 2, NULL);
+
+    // Release the view, as the output buffer can be moved once we continue. Keep the function's exception aside while doing so
+    PyObject *exc = PyErr_GetRaisedException();
+    PyObject *released = PyObject_CallMethodNoArgs(view, b->states->interned.release);
+
+    if (exc)
+        PyErr_SetRaisedException(exc);
+
+    // Views derived from the view (such as slices) share its managed buffer, which stays usable if any are left.
+    // Mark the managed buffer as released so that they can't access the output buffer anymore, and fail the call
+    _PyManagedBufferObject *mbuf = ((PyMemoryViewObject *)view)->mbuf;
+
+    if (released && mbuf->exports != 0)
+    {
+        mbuf->flags |= _Py_MANAGED_BUFFER_RELEASED;
+
+        if (result)
+        {
+            PyErr_SetString(PyExc_BufferError, "Extension encode functions with a size can't keep views of the output buffer after returning");
+            Py_CLEAR(released);
+        }
+    }
+
+    Py_DECREF(view);
+
+    if (!released)
+    {
+        Py_XDECREF(result);
+        return false;
+    }
+
+    Py_DECREF(released);
+
+    if (!result)
+        return false;
+    
+    if (!PyLong_Check(result))
+    {
+        PyErr_Format(PyExc_TypeError, "Expected to receive the number of bytes written from extension encode functions with a size, but got an object of type '%s'", Py_TYPE(result)->tp_name);
+        Py_DECREF(result);
+        return false;
+    }
+
+    const Py_ssize_t written = PyLong_AsSsize_t(result);
+    Py_DECREF(result);
+
+    if (written == -1 && PyErr_Occurred())
+        return false;
+    
+    if (written < 0 || (size_t)written > size)
+    {
+        PyErr_Format(PyExc_ValueError, "Expected extension encode functions to write between 0 and %zu bytes, but got %zi", size, written);
+        return false;
+    }
+
+    // Smaller sizes can use a smaller header
+    if ((size_t)written != size)
+    {
+        nheader = cm_write_ext_header(header, item->id, (size_t)written);
+        memmove(b->offset + nheader, data, (size_t)written);
+    }
+
+    memcpy(b->offset, header, nheader);
+    b->offset += nheader + (size_t)written;
+
+    return true;
+}
+
+// Write an ext type holding the encoded object returned by the function
+static bool write_nested_extension(buffer_t *b, ext_dictitem_t *item, PyObject *obj)
+{
+    // The returned object can hold the same type again, so this nests like a container
+    b->recursion++;
+
+    if (!recursion_check(b))
+        return false;
+
+    PyObject *result = PyObject_CallOneArg(item->func, obj);
+
+    if (!result)
+        return false;
+    
+    // Reserve space for the largest header, the base can move while encoding so track the position as an offset
+    if (!ensure_space(b, 6))
+    {
+        Py_DECREF(result);
+        return false;
+    }
+
+    const size_t start = (size_t)(b->offset - PyBytes_AS_STRING(b->base));
+    b->offset += 6;
+
+    // Batched types would be written outside of the ext data, so they're written right away.
+    // The header is written after the data, so the data has to stay in the buffer until then
+    batch_t *batch = b->batch;
+    flush_t *flush = b->flush;
+    b->batch = NULL;
+    b->flush = NULL;
+
+    const bool success = encode_object_inline(b, result);
+
+    b->batch = batch;
+    b->flush = flush;
+    Py_DECREF(result);
+
+    if (!success)
+        return false;
+    
+    char *base = PyBytes_AS_STRING(b->base);
+    const size_t size = (size_t)(b->offset - base) - start - 6;
+
+    char header[CM_MAX_HEADER_SIZE];
+    const size_t nheader = cm_write_ext_header(header, item->id, size);
+
+    if (nheader == 0)
+    {
+        error_size_limit(Ext, size);
+        return false;
+    }
+
+    memmove(base + start + nheader, base + start + 6, size);
+    memcpy(base + start, header, nheader);
+
+    b->offset = base + start + nheader + size;
+    b->recursion--;
+
+    return true;
+}
+
+static _always_inline bool write_extension(buffer_t *b, PyObject *obj)
+{
+    // Attempt to encode the object as an extension type
+    ext_dictitem_t *item = find_encode_ext(b, obj);
+
+    // Objects without an ext type that export a buffer are written as binary data
+    if (!item)
+        return PyObject_CheckBuffer(obj) && write_buffer(b, obj);
+    
+    if (item->native)
+        return write_native_extension(b, item, obj);
+    
+    if (item->size != 0)
+        return write_sized_extension(b, item, obj);
+    
+    if (item->nested)
+        return write_nested_extension(b, item, obj);
+    
+    // Batched types are written once the whole object is encoded, at the current position
+    if (item->batch && b->batch)
+    {
+        batch_entry_t *entry = batch_push(b->batch, Py_NewRef(obj), item->func);
+
+        if (!entry)
+            return false;
+        
+        entry->pos = (size_t)(b->offset - PyBytes_AS_STRING(b->base));
+        entry->id = item->id;
+
+        return true;
+    }
+
+    const char id = item->id;
+    const uint64_t start = usdt_clock(ext__encode);
+
+    PyObject *result = item->batch ? batch_call_single(item->func, obj) : PyObject_CallOneArg(item->func, obj);
+
+    usdt_probe(ext__encode, (int)id, _monotonic_ns() - start);
+
+    if (!result)
+        return false;
+    
+    Py_buffer buf;
+    if (PyObject_GetBuffer(result, &buf, PyBUF_SIMPLE) < 0)
+    {
+        PyErr_Format(PyExc_TypeError, "Expected to receive a bytes-like object from extension encode functions, but got an object of type '%s'", Py_TYPE(result)->tp_name);
+        Py_DECREF(result);
+        return false;
+    }
+
+    size_t size = (size_t)buf.len;
+
+    if (!ensure_space(b, 6 + size))
+    {
+        PyBuffer_Release(&buf);
+        Py_DECREF(result);
+        return false;
+    }
+
+    const size_t nwritten = cm_write_ext_header(b->offset, id, size);
+
+    if (nwritten == 0)
+    {
+        PyBuffer_Release(&buf);
+        Py_DECREF(result);
+
+        error_size_limit(Ext, size);
+        return false;
+    }
+
+    b->offset += nwritten;
+
+    memcpy(b->offset, buf.buf, size);
+    b->offset += size;
+
+    PyBuffer_Release(&buf);
+    Py_DECREF(result);
+
+    return true;
+}
+
+
+/////////////////////
+//  OBJECT CACHES  //
+/////////////////////
+
+#define MM2_CONSTANT 0x5BD1E995
+
+static _always_inline uint32_t murmur2_hash(char *data, size_t size)
+{
+    uint32_t hash = size;
+
+    while (size >= 4)
+    {
+        uint32_t chunk;
+        memcpy(&chunk, data, 4);
+
+        chunk *= MM2_CONSTANT;
+        chunk ^= chunk >> 24;
+        chunk *= MM2_CONSTANT;
+
+        hash *= MM2_CONSTANT;
+        hash ^= chunk;
+
+        data += 4;
+        size -= 4;
+    }
+
+    switch (size)
+    {
+    case 3: hash ^= data[2] << 16;
+    case 2: hash ^= data[1] <<  8;
+    case 1: hash ^= data[0];
+            hash *= MM2_CONSTANT;
+    }
+
+    hash ^= hash >> 13;
+    hash *= MM2_CONSTANT;
+    hash ^= hash >> 15;
+
+    return hash;
+}
+
+// Attempt to get a string from the string cache before constructing it from scratch
+static _always_inline PyObject *get_cached_str(char *ptr, size_t size, strcache_t *cache)
+{
+    // Calculate the hash of the string
+    const size_t hash = murmur2_hash(ptr, size) % STRING_CACHE_SLOTS;
+
+    // Lock the cache slot
+    lock_flag(&cache->locks[hash]);
+
+    // Load the match stored at the hash index
+    PyASCIIObject *match = cache->slots[hash];
+
+    if (match)
+    {
+        // Get the match's base and size
+        const char *mbase = (const char *)(match + 1);
+        const size_t msize = match->length;
+
+        // Compare the match to the required string
+        if (msize == size && memcmp(mbase, ptr, size) == 0)
+        {
+            // Get reference to the match object
+            Py_INCREF(match);
+
+            // Increase match strength as we matched again
+            cache->match_strength[hash]++;
+
+            // Release the lock
+            unlock_flag(&cache->locks[hash]);
+
+            return (PyObject *)match;
+        }
+    }
+
+    // No common value, create a new one
+    PyObject *obj = PyUnicode_DecodeUTF8(ptr, size, NULL);
+
+    // If ASCII, it can be cached
+    if (PyUnicode_IS_COMPACT_ASCII(obj))
+    {
+        // Decrease match strength as a match failed
+        cache->match_strength[hash]--;
+
+        // Replace the match if the strength reached zero
+        if (cache->match_strength[hash] == 0)
+        {
+            // Lose reference to the match and keep reference to the new object
+            Py_XDECREF(match);
+            Py_INCREF(obj);
+
+            // Assign the object to the cache and initialize match strength at 3
+            cache->slots[hash] = (PyASCIIObject *)obj;
+            cache->match_strength[hash] = 3;
+        }
+    }
+
+    // Release the lock
+    unlock_flag(&cache->locks[hash]);
+
+    return obj;
+}
+
+// Get a cached integer, must be between -128 and 1023
+static _always_inline PyObject *get_cached_int(buffer_t *b, int n)
+{
+    return (PyObject *)&b->states->caches.integers.slots[n + INTEGER_CACHE_NNEG];
+}
+
+/////////////////////////
+//  CREATE CONTAINERS  //
+/////////////////////////
+
+// Skip over an object and return it as a raw object holding its encoded data
+static _always_inline PyObject *decode_raw(buffer_t *b)
+{
+    char *start = b->offset;
+
+    if (!skip_object(b))
+        return NULL;
+
+    return create_raw(b->owner, start, (size_t)(b->offset - start));
+}
+
+static _always_inline PyObject *create_array(buffer_t *b, const size_t nitems)
+{
+    PyObject *list = PyList_New(nitems);
+
+    if (!list)
+        return NULL;
+    
+    if (!decoding_add_ref(b, list))
+    {
+        Py_DECREF(list);
+        return NULL;
+    }
+
+    // Check if the items of this array should be kept encoded
+    const bool raw = ++b->depth == b->raw_depth;
+
+    for (size_t i = 0; i < nitems; ++i)
+    {
+        PyObject *item = raw ? decode_raw(b) : decode_bytes(b);
+
+        if (item == NULL)
+        {
+            Py_DECREF(list);
+            return NULL;
+        }
+        
+        PyList_SET_ITEM(list, i, item);
+
+        if (item == b->states->batch_placeholder)
+            batch_track(b->batch, list, NULL, i);
+    }
+
+    b->depth--;
+
+    return list;
+}
+
+static _always_inline PyObject *create_map(buffer_t *b, const size_t npairs)
+{
+    PyObject *dict = _PyDict_NewPresized(npairs);
+
+    if (!dict)
+        return PyErr_NoMemory();
+    
+    if (!decoding_add_ref(b, dict))
+    {
+        Py_DECREF(dict);
+        return NULL;
+    }
+
+    // Check if the values of this map should be kept encoded, keys are always decoded
+    const bool raw = ++b->depth == b->raw_depth;
+
+    for (size_t i = 0; i < npairs; ++i)
+    {
+        PyObject *key;
+
+        if (!overread_check(b, 1))
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        // Special case for fixsize strings
+        const unsigned char mask = b->offset[0];
+        if ((mask & 224) == CM_DT_STR_FIXED)
+        {
+            b->offset++;
+
+            const size_t size = mask & 31;
+
+            if (!overread_check(b, size))
+            {
+                Py_DECREF(dict);
+                return NULL;
+            }
+
+            key = get_cached_str(b->offset, size, &b->states->caches.strings);
+            b->offset += size;
+
+            if (!key)
+            {
+                Py_DECREF(dict);
+                return NULL;
+            }
+        }
+        else
+        {
+            key = decode_bytes(b);
+
+            if (!key)
+            {
+                Py_DECREF(dict);
+                return NULL;
+            }
+
+            // Keys of batched ext types are needed right away
+            if (key == b->states->batch_placeholder)
+            {
+                Py_DECREF(key);
+                key = batch_resolve_last(b->batch);
+
+                if (!key)
+                {
+                    Py_DECREF(dict);
+                    return NULL;
+                }
+            }
+
+            if (b->str_keys && !PyUnicode_CheckExact(key))
+            {
+                Py_DECREF(dict);
+                Py_DECREF(key);
+
+                PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(key)->tp_name);
+                return NULL;
+            }
+        }
+
+        PyObject *val = raw ? decode_raw(b) : decode_bytes(b);
+
+        if (val == NULL)
+        {
+            Py_DECREF(key);
+            Py_DECREF(dict);
+            return NULL;
+        }
+
+        PyDict_SetItem(dict, (PyObject *)key, val);
+
+        if (val == b->states->batch_placeholder)
+            batch_track(b->batch, dict, key, 0);
+
+        Py_DECREF(key);
+        Py_DECREF(val);
+    }
+
+    b->depth--;
+
+    return dict;
+}
+
+
+////////////////////
+//    ENCODING    //
+////////////////////
+
+static bool encode_object(buffer_t *b, PyObject *obj, PyTypeObject *tp)
+{
+    // Containers that were written before are written as a reference to the first one
+    if (b->refs && (PyList_Check(obj) || PyDict_Check(obj) || PyTuple_Check(obj)))
+    {
+        bool written;
+        if (!write_shared_ref(b, obj, &written))
+            return false;
+        
+        if (written)
+            return true;
+    }
+    else if (b->refs && tp == &RawObj && !number_raw_containers(b, ((raw_t *)obj)->data, ((raw_t *)obj)->size))
+    {
+        return false;
+    }
+
+    if (tp == &PyList_Type || PyList_Check(obj))
+    {
+        return write_list(b, obj);
+    }
+    else if (tp == &PyDict_Type || PyDict_Check(obj))
+    {
+        return write_dict(b, obj);
+    }
+    else if (tp == &PyTuple_Type || PyTuple_Check(obj))
+    {
+        return write_tuple(b, obj);
+    }
+    else if (PyBytes_Check(obj))
+    {
+        return write_bytes(b, obj);
+    }
+    else if (PyByteArray_Check(obj))
+    {
+        return write_bytearray(b, obj);
+    }
+    else if (PyMemoryView_Check(obj))
+    {
+        return write_memoryview(b, obj);
+    }
+    else if (tp == &RawObj)
+    {
+        return write_raw(b, ((raw_t *)obj)->data, ((raw_t *)obj)->size);
+    }
+    else
+    {
+        return write_extension(b, obj);
+    }
+}
+
+static _always_inline bool encode_object_inline(buffer_t *b, PyObject *obj)
+{
+    PyTypeObject *tp = Py_TYPE(obj);
+
+    if (tp == &PyUnicode_Type)
+    {
+        return write_string(b, obj);
+    }
+
+    // A lot of cases below require 9 or less space, ensure globally for all of them here
+    if (!ensure_space(b, 9))
+        return false;
+
+    if (tp == &PyLong_Type)
+    {
+        return write_integer(b, obj);
+    }
+    else if (tp == &PyFloat_Type)
+    {
+        return write_double(b, obj);
+    }
+    else if (tp == &PyBool_Type)
+    {
+        return write_bool(b, obj);
+    }
+    else if (obj == Py_None)
+    {
+        return write_nil(b, obj);
+    }
+    else
+    {
+        return encode_object(b, obj, tp);
+    }
+}
+
+
+////////////////////
+//    DECODING    //
+////////////////////
+
+// INCBYTE but type-casted to ensure we operate with a single byte
+#define SIZEBYTE ((unsigned char)(b->offset++)[0])
+
+// Masks away the top 3 bits of a mask for varlen cases, as they all have the same upper 3 bits
+#define VARLEN_DT(mask) (mask & 31)
+
+// Decoding of fixsize objects
+static _always_inline PyObject *decode_bytes_fixsize(buffer_t *b, unsigned char mask)
+{
+    // Check which type we got
+    if ((mask & 224) == CM_DT_STR_FIXED)
+    {
+        mask &= 31;
+
+        if (!overread_check(b, mask))
+            return NULL;
+
+        PyObject *obj = PyUnicode_DecodeUTF8(b->offset, mask, NULL);
+        b->offset += mask;
+
+        return obj;
+    }
+    else if ((mask & 128) == CM_DT_UINT_FIXED) // Uint only has upper bit set to 0
+    {
+        return get_cached_int(b, mask);
+    }
+    else if ((mask & 224) == CM_DT_INT_FIXED)
+    {
+        int8_t num = mask & 31;
+
+        // Sign-extend the number if it's negative
+        if ((num & 16) == 16)
+            num |= ~31;
+
+        return get_cached_int(b, num);
+    }
+    else if ((mask & 240) == CM_DT_ARR_FIXED) // The 5th bit is used on ARR and MAP too, instead of just the upper 3
+    {
+        return create_array(b, mask & 0x0F);
+    }
+    else if ((mask & 240) == CM_DT_MAP_FIXED)
+    {
+        return create_map(b, mask & 0x0F);
+    }
+    else
+    {
+        return PyErr_Format(PyExc_ValueError, "Got an invalid header (0x%02X) while decoding data", mask);
+    }
+}
+
+// Decoding of varlen objects
+static _always_inline PyObject *decode_bytes_varlen(buffer_t *b, const unsigned char mask)
+{
+    // Global variable to hold the size across multiple cases
+    uint64_t n = 0;
+
+    // Switch over the varlen mask
+    const unsigned int varlen_mask = VARLEN_DT(mask);
+    switch (varlen_mask)
+    {
+    case VARLEN_DT(CM_DT_STR_LARGE):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+
+        n |= SIZEBYTE << 24;
+        n |= SIZEBYTE << 16;
+    }
+    case VARLEN_DT(CM_DT_STR_MEDIUM):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+
+        n |= SIZEBYTE << 8;
+    }
+    case VARLEN_DT(CM_DT_STR_SMALL):
+    {
+        if (!overread_check(b, 1))
+            return NULL;
+
+        n |= SIZEBYTE;
+
+        // Read values that don't fit in the file buffer straight from the file
+        if (b->file && n > b->fbuf_size)
+            return decoding_read_file_direct(b, n, true);
+
+        if (!overread_check(b, n))
+            return NULL;
+
+        PyObject *obj = PyUnicode_DecodeUTF8(b->offset, n, NULL);
+        b->offset += n;
+
+        return obj;
+    }
+
+    case VARLEN_DT(CM_DT_UINT_BIT8):
+    {
+        if (!overread_check(b, 1))
+            return NULL;
+
+        uint8_t num = SIZEBYTE;
+
+        return get_cached_int(b, num);
+    }
+    case VARLEN_DT(CM_DT_UINT_BIT16):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+
+        uint16_t num = SIZEBYTE << 8;
+        num |= SIZEBYTE;
+        
+        return PyLong_FromUnsignedLongLong(num);
+    }
+    case VARLEN_DT(CM_DT_UINT_BIT32):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+
+        uint32_t num = (uint32_t)cm_load_u32(b->offset);
+        b->offset += 4;
+
+        return PyLong_FromUnsignedLongLong(num);
+    }
+    case VARLEN_DT(CM_DT_UINT_BIT64):
+    {
+        if (!overread_check(b, 8))
+            return NULL;
+
+        uint64_t num = (uint64_t)cm_load_u64(b->offset);
+        b->offset += 8;
+
+        return PyLong_FromUnsignedLongLong(num);
+    }
+
+    case VARLEN_DT(CM_DT_INT_BIT8):
+    {
+        if (!overread_check(b, 1))
+            return NULL;
+
+        int8_t num = SIZEBYTE;
+
+        return get_cached_int(b, num);
+    }
+    case VARLEN_DT(CM_DT_INT_BIT16):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+
+        int16_t num = (int16_t)SIZEBYTE << 8;
+        num |= SIZEBYTE;
+        
+        return PyLong_FromLongLong(num);
+    }
+    case VARLEN_DT(CM_DT_INT_BIT32):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+
+        int32_t num = (int32_t)cm_load_u32(b->offset);
+        b->offset += 4;
+
+        return PyLong_FromLongLong(num);
+    }
+    case VARLEN_DT(CM_DT_INT_BIT64):
+    {
+        if (!overread_check(b, 8))
+            return NULL;
+
+        int64_t num = (int64_t)cm_load_u64(b->offset);
+        b->offset += 8;
+
+        return PyLong_FromLongLong(num);
+    }
+
+    case VARLEN_DT(CM_DT_ARR_LARGE):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+        
+        n |= SIZEBYTE << 24;
+        n |= SIZEBYTE << 16;
+    }
+    case VARLEN_DT(CM_DT_ARR_MEDIUM):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+        
+        n |= SIZEBYTE << 8;
+        n |= SIZEBYTE;
+
+        return create_array(b, n);
+    }
+
+    case VARLEN_DT(CM_DT_MAP_LARGE):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+        
+        n |= SIZEBYTE << 24;
+        n |= SIZEBYTE << 16;
+    }
+    case VARLEN_DT(CM_DT_MAP_MEDIUM):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+
+        n |= SIZEBYTE << 8;
+        n |= SIZEBYTE;
+
+        return create_map(b, n);
+    }
+
+    case VARLEN_DT(CM_DT_NIL):
+    {
+        return Py_None;
+    }
+    case VARLEN_DT(CM_DT_TRUE):
+    {
+        return Py_True;
+    }
+    case VARLEN_DT(CM_DT_FALSE):
+    {
+        return Py_False;
+    }
+
+    case VARLEN_DT(CM_DT_FLOAT_BIT32):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+
+        double num = cm_load_float(b->offset);
+        b->offset += 4;
+
+        return PyFloat_FromDouble(num);
+    }
+    case VARLEN_DT(CM_DT_FLOAT_BIT64):
+    {
+        if (!overread_check(b, 8))
+            return NULL;
+
+        double num = cm_load_double(b->offset);
+        b->offset += 8;
+
+        return PyFloat_FromDouble(num);
+    }
+
+    case VARLEN_DT(CM_DT_BIN_LARGE):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+
+        n |= SIZEBYTE << 24;
+        n |= SIZEBYTE << 16;
+    }
+    case VARLEN_DT(CM_DT_BIN_MEDIUM):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+
+        n |= SIZEBYTE << 8;
+    }
+    case VARLEN_DT(CM_DT_BIN_SMALL):
+    {
+        if (!overread_check(b, 1))
+            return NULL;
+
+        n |= SIZEBYTE;
+
+        // Read values that don't fit in the file buffer straight from the file
+        if (b->file && n > b->fbuf_size)
+            return decoding_read_file_direct(b, n, false);
+
+        if (!overread_check(b, n))
+            return NULL;
+
+        PyObject *obj = PyBytes_FromStringAndSize(b->offset, n);
+        b->offset += n;
+
+        return obj;
+    }
+
+    case VARLEN_DT(CM_DT_EXT_FIX1):
+    {
+        n = 1;
+        goto ext_handling;
+    }
+    case VARLEN_DT(CM_DT_EXT_FIX2):
+    {
+        n = 2;
+        goto ext_handling;
+    }
+    case VARLEN_DT(CM_DT_EXT_FIX4):
+    {
+        n = 4;
+        goto ext_handling;
+    }
+    case VARLEN_DT(CM_DT_EXT_FIX8):
+    {
+        n = 8;
+        goto ext_handling;
+    }
+    case VARLEN_DT(CM_DT_EXT_FIX16):
+    {
+        n = 16;
+        goto ext_handling;
+    }
+
+    case VARLEN_DT(CM_DT_EXT_LARGE):
+    {
+        if (!overread_check(b, 4))
+            return NULL;
+            
+        n |= SIZEBYTE << 24;
+        n |= SIZEBYTE << 16;
+    }
+    case VARLEN_DT(CM_DT_EXT_MEDIUM):
+    {
+        if (!overread_check(b, 2))
+            return NULL;
+
+        n |= SIZEBYTE << 8;
+    }
+    case VARLEN_DT(CM_DT_EXT_SMALL):
+    {
+        if (!overread_check(b, 1))
+            return NULL;
+
+        n |= SIZEBYTE;
+
+        ext_handling: // Jump label for fixsize cases
+        NULL; // No-op statement for pre-C23 standards (declarations not allowed after labels)
+
+        if (!overread_check(b, 1 + n))
+            return NULL;
+
+        const char id = SIZEBYTE;
+
+        PyObject *obj = attempt_decode_ext(b, b->offset, n, id);
+        b->offset += n;
+
+        if (obj == NULL)
+        {
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_ValueError, "Failed to match an extension type with ID %i", id);
+            
+            return NULL;
+        }
+
+        return obj;
+    }
+
+    default:
+    {
+        return PyErr_Format(PyExc_ValueError, "Got an invalid header (0x%02X) while decoding data", mask);
+    }
+    }
+}
+
+static PyObject *decode_bytes(buffer_t *b)
+{
+    // Check if it's safe to read the mask
+    if (!overread_check(b, 1))
+            return NULL;
+
+    // The mask is stored on the next byte
+    const unsigned char mask = SIZEBYTE;
+
+    // Only fixsize values don't have `110` set on the upper 3 mask bits
+    if ((mask & 224) != 192)
+    {
+        return decode_bytes_fixsize(b, mask);
+    }
+    else
+    {
+        // Otherwise, it's a varlen object
+        return decode_bytes_varlen(b, mask);
+    }
+}
+
+
+////////////////////
+//    SKIPPING    //
+////////////////////
+
+// These use the core functions on the in-memory buffer, and don't refresh file buffers
+
+// Set the Python exception for an error from the core functions, with OFFSET pointing to the header that caused it
+static void set_core_error(cm_error_t error, const char *offset)
+{
+    if (error == CM_ERROR_INVALID_HEADER)
+        PyErr_Format(PyExc_ValueError, "Got an invalid header (0x%02X) while decoding data", (unsigned char)*offset);
+    else
+        PyErr_SetString(PyExc_ValueError, cm_error_string(error));
+}
+
+// Skip over a single encoded object without creating any Python objects
+static bool skip_object(buffer_t *b)
+{
+    const char *offset = b->offset;
+    cm_error_t error = cm_skip(&offset, b->maxoffset);
+
+    if (error != CM_OK)
+    {
+        set_core_error(error, offset);
+        return false;
+    }
+
+    b->offset = (char *)offset;
+    return true;
+}
+
+// Read the header of a container, and get the number of items (pairs for maps) it holds
+static _always_inline bool read_container_header(buffer_t *b, bool map, size_t *nitems)
+{
+    const char *offset = b->offset;
+
+    cm_header_t header;
+    cm_error_t error = cm_read_header(&offset, b->maxoffset, &header);
+
+    if (error == CM_ERROR_INCOMPLETE)
+    {
+        set_core_error(error, offset);
+        return false;
+    }
+
+    // The offset wasn't moved, so the caller sees the header again
+    if (error != CM_OK || header.type != (map ? CM_TYPE_MAP : CM_TYPE_ARRAY))
+    {
+        error_unexpected_header(map ? "map" : "array", (unsigned char)*b->offset);
+        return false;
+    }
+
+    b->offset = (char *)offset;
+    *nitems = header.size;
+
+    return true;
+}
+
+
+///////////////////////////
+//  ADAPTIVE ALLOCATION  //
+///////////////////////////
+
+// Global averages, made thread-local for thread safety
+_Thread_local double avg_item_size = AVG_ITEM_SIZE_DEFAULT;
+_Thread_local double avg_fluctuation = AVG_FLUCTUATION_DEFAULT;
+
+static _always_inline void update_adaptive_allocation(buffer_t *b, size_t nitems, double *_avg_item_size, double *_avg_fluctuation)
+{
+    if (nitems == 0)
+        return;
+    
+    double avg_item_size = *_avg_item_size;
+    double avg_fluctuation = *_avg_fluctuation;
+
+    double used  = (double)(b->offset - PyBytes_AS_STRING(b->base)) / nitems;
+    double extra = (double)(b->maxoffset - b->offset) / nitems;
+
+    double fluctuation = extra / used;
+
+    if (used < avg_item_size)
+    {
+        avg_item_size = ((avg_item_size * 3) + used) / 4;
+    }
+    else
+    {
+        avg_item_size = (avg_item_size + (used * 2)) / 3;
+    }
+
+    avg_fluctuation = ((avg_fluctuation * 3) + fluctuation) / 4;
+
+    // Ensure a minimum avg size of 6
+    if (avg_item_size < 6)
+        avg_item_size = 6;
+    
+    // Ensure a maximum avg fluctuation of 0.8
+    if (avg_fluctuation > 0.8)
+        avg_fluctuation = 0.8;
+    
+    *_avg_item_size = avg_item_size;
+    *_avg_fluctuation = avg_fluctuation;
+}
+
+
+/////////////////////
+//  FILE  READING  //
+/////////////////////
+
+#ifdef _DIRECT_IO_SUPPORTED
+
+// Read N bytes at the reader's position into DEST, returns the number of bytes read (less than N on EOF or an error)
+static size_t directio_read(directio_t *dio, char *dest, size_t n)
+{
+    size_t total = 0;
+
+    while (total < n)
+    {
+        // Refill the block buffer if the position isn't inside it
+        if (dio->pos < dio->start || dio->pos >= dio->start + dio->len)
+        {
+            // Start at the block holding the position, as offsets must be aligned. This also re-reads a partial last block, in case the file grew
+            dio->start = dio->pos & ~(size_t)(DIRECTIO_ALIGN - 1);
+
+            const ssize_t nread = pread(dio->fd, dio->buf, dio->size, (off_t)dio->start);
+
+            if (nread < 0)
+            {
+                dio->err = errno;
+                dio->len = 0;
+                break;
+            }
+
+            dio->len = (size_t)nread;
+
+            // Reached EOF
+            if (dio->pos >= dio->start + dio->len)
+                break;
+        }
+
+        const size_t available = dio->start + dio->len - dio->pos;
+        const size_t ncopy = available < n - total ? available : n - total;
+
+        memcpy(dest + total, dio->buf + (dio->pos - dio->start), ncopy);
+
+        dio->pos += ncopy;
+        total += ncopy;
+    }
+
+    return total;
+}
+
+#endif
+
+// Read up to N bytes from the file into DEST
+static size_t decoding_read(buffer_t *b, char *dest, size_t n)
+{
+#ifdef _DIRECT_IO_SUPPORTED
+    if (b->dio)
+        return directio_read(b->dio, dest, n);
+#endif
+
+    return fread(dest, 1, n, b->file);
+}
+
+// Set the error for a read that returned less data than required
+static bool decoding_read_error(buffer_t *b)
+{
+    if (b->dio && b->dio->err != 0)
+    {
+        const int err = b->dio->err;
+        b->dio->err = 0;
+
+        PyErr_Format(PyExc_OSError, "Unable to read from the file, received errno %i: '%s'", err, strerror(err));
+    }
+    else
+    {
+        PyErr_SetString(PyExc_EOFError, "Reached EOF before finishing the decoding run");
+    }
+
+    return false;
+}
+
+// Enable direct I/O for reading, or advise the kernel to not keep read pages cached if it isn't supported
+static bool filestream_enable_directio(filestream_t *stream)
+{
+    directio_t *dio = &stream->dio;
+
+    dio->fd = -1;
+    dio->err = 0;
+    dio->buf = NULL;
+    dio->start = 0;
+    dio->len = 0;
+    dio->pos = 0;
+    dio->dropped = 0;
+
+#ifdef _DIRECT_IO_SUPPORTED
+    // The block buffer has to be aligned, and is kept large to limit the number of uncached reads
+    size_t size = stream->chunk_size > DIRECTIO_MINSIZE ? stream->chunk_size : DIRECTIO_MINSIZE;
+    size = (size + DIRECTIO_ALIGN - 1) & ~(size_t)(DIRECTIO_ALIGN - 1);
+
+    void *buf;
+    if (posix_memalign(&buf, DIRECTIO_ALIGN, size) != 0)
+    {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    const int fd = open(stream->fname, O_RDONLY | O_DIRECT);
+
+    if (fd >= 0)
+    {
+        dio->fd = fd;
+        dio->buf = (char *)buf;
+        dio->size = size;
+
+        return true;
+    }
+
+    // The file system doesn't support direct I/O, so fall back to fadvise
+    free(buf);
+#endif
+
+    _fadvise(stream->file, 0, 0, SEQUENTIAL);
+    return true;
+}
+
+static void filestream_disable_directio(filestream_t *stream)
+{
+    directio_t *dio = &stream->dio;
+
+    if (dio->fd >= 0)
+        close(dio->fd);
+
+    free(dio->buf);
+
+    dio->fd = -1;
+    dio->buf = NULL;
+
+    _fadvise(stream->file, 0, 0, NORMAL);
+}
+
+
+/////////////////////
+//  ENC/DEC START  //
+/////////////////////
+
+// Whether this thread is running the slow hook, to not report messages from within it
+static _Thread_local bool slow_reporting = false;
+
+// State of the random number generator for sampling, per thread so that it isn't shared between threads
+static _Thread_local uint64_t slow_rng = 0;
+
+// Check if the slow hook is set, for deciding whether to time a run
+#define slow_enabled(states) (atomic_load_explicit(&(states)->slow.enabled, memory_order_relaxed))
+
+// Check if a message of SIZE bytes that started at START crosses a threshold of the slow hook, and is sampled for reporting.
+// Sets DURATION to the duration in nanoseconds. Returns a new reference to the callback if the message is reported,
+// and sets PREFIX_SIZE to the number of bytes of the message to pass to it
+static PyObject *slow_crossed(mstates_t *states, uint64_t start, size_t size, uint64_t *duration, size_t *prefix_size)
+{
+    slowhook_t *slow = &states->slow;
+
+    *duration = _monotonic_ns() - start;
+
+    // We might be called from within the callback
+    if (slow_reporting)
+        return NULL;
+
+    // The settings can be changed by other threads, so read them and take a reference to the callback under the lock
+    lock_flag(&slow->lock);
+
+    PyObject *callback = NULL;
+
+    if (slow->callback && ((slow->threshold_ns != 0 && *duration >= slow->threshold_ns) || (slow->max_bytes != 0 && size >= slow->max_bytes)))
+    {
+        // Xorshift64 needs a non-zero state, and sampling only needs to be roughly uniform
+        uint64_t x = slow_rng != 0 ? slow_rng : (_monotonic_ns() ^ (uint64_t)(uintptr_t)&slow_rng) | 1;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        slow_rng = x;
+
+        if ((x >> 32) < slow->sample_limit)
+        {
+            callback = Py_NewRef(slow->callback);
+            *prefix_size = size < slow->prefix_size ? size : slow->prefix_size;
+        }
+    }
+
+    unlock_flag(&slow->lock);
+
+    return callback;
+}
+
+// Call CALLBACK (stolen) of the slow hook with the metrics of a message and PREFIX (stolen), the start of the message.
+// Errors in the callback are reported as unraisable, so they don't affect the result of the encode/decode call
+static void slow_report(PyObject *callback, PyObject *kind, uint64_t duration, size_t size, PyObject *prefix)
+{
+    PyObject *duration_us = PyFloat_FromDouble((double)duration / 1000.0);
+    PyObject *size_obj = PyLong_FromSize_t(size);
+
+    if (prefix && duration_us && size_obj)
+    {
+        PyObject *args[] = {kind, duration_us, size_obj, prefix};
+
+        slow_reporting = true;
+        PyObject *result = PyObject_Vectorcall(callback, args, 4, NULL);
+        slow_reporting = false;
+
+        Py_XDECREF(result);
+    }
+
+    if (PyErr_Occurred())
+        PyErr_WriteUnraisable(callback);
+
+    Py_DECREF(callback);
+    Py_XDECREF(duration_us);
+    Py_XDECREF(size_obj);
+    Py_XDECREF(prefix);
+}
+
+// Report a message of SIZE bytes at DATA to the slow hook if it crossed a threshold
+static void slow_check(mstates_t *states, PyObject *kind, uint64_t start, const char *data, size_t size)
+{
+    uint64_t duration;
+    size_t prefix_size;
+    PyObject *callback = slow_crossed(states, start, size, &duration, &prefix_size);
+
+    if (!callback)
+        return;
+
+    slow_report(callback, kind, duration, size, PyBytes_FromStringAndSize(data, (Py_ssize_t)prefix_size));
+}
+
+// Report a record of SIZE bytes at OFFSET in the file of FSTREAM to the slow hook if it crossed a threshold.
+// The start of the record is read from the file again, as it's no longer in the buffer
+static void slow_check_file(mstates_t *states, PyObject *kind, uint64_t start, filestream_t *fstream, size_t offset, size_t size)
+{
+    uint64_t duration;
+    size_t prefix_size;
+    PyObject *callback = slow_crossed(states, start, size, &duration, &prefix_size);
+
+    if (!callback)
+        return;
+    
+    PyObject *prefix = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)prefix_size);
+
+    if (prefix)
+    {
+        size_t read = 0;
+
+        // The next decode seeks to its own offset, and writes always append, so the file position can be moved freely
+        if (fseek(fstream->file, offset, SEEK_SET) == 0)
+            read = fread(PyBytes_AS_STRING(prefix), 1, prefix_size, fstream->file);
+        
+        Py_SET_SIZE(prefix, read);
+        PyBytes_AS_STRING(prefix)[read] = 0;
+    }
+
+    slow_report(callback, kind, duration, size, prefix);
+}
+
+// Acquire a lock of a stream, waiting without the GIL so that the thread holding it can finish
+static void stream_acquire_lock(PyThread_type_lock lock)
+{
+    if (!PyThread_acquire_lock(lock, NOWAIT_LOCK))
+    {
+        Py_BEGIN_ALLOW_THREADS
+            PyThread_acquire_lock(lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+// Acquire the write lock of a stream and record this thread as its OWNER. Fails when this thread already holds it,
+// as a record written from inside another one (such as from an extension function) would wait on itself
+static bool write_lock_acquire(PyThread_type_lock lock, unsigned long *owner)
+{
+    const unsigned long ident = PyThread_get_thread_ident();
+
+    if (*owner == ident)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to write a record to the file while this thread is still writing another record to it");
+        return false;
+    }
+
+    stream_acquire_lock(lock);
+    *owner = ident;
+
+    return true;
+}
+
+static void write_lock_release(PyThread_type_lock lock, unsigned long *owner)
+{
+    *owner = 0;
+    PyThread_release_lock(lock);
+}
+
+// Write the data in the buffer to the file and empty the buffer, to keep it within the chunk size while encoding to a file
+static bool encoding_flush(buffer_t *b)
+{
+    flush_t *flush = b->flush;
+
+    // Batched types are written at their positions once the object is encoded, which only works while everything is in the buffer.
+    // Write them now before the first flush, and encode the rest of the object without batching
+    if (b->batch)
+    {
+        if (b->batch->n != 0 && !encoding_resolve_batch(b))
+            return false;
+        
+        batch_clear(b->batch);
+        b->batch = NULL;
+    }
+
+    char *base = PyBytes_AS_STRING(b->base);
+    const size_t size = (size_t)(b->offset - base);
+
+    // Hold the write lock until the whole object is written, so that records from other threads don't end up in between
+    if (!flush->started)
+    {
+        if (!write_lock_acquire(flush->lock, flush->owner))
+            return false;
+        
+        flush->started = true;
+
+        // Data is appended, so the object starts at the end of the file
+        long start;
+        if (fseek(flush->file, 0, SEEK_END) != 0 || (start = ftell(flush->file)) < 0)
+        {
+            PyErr_SetFromErrno(PyExc_OSError);
+            return false;
+        }
+
+        flush->start = (size_t)start;
+    }
+
+    size_t written;
+    Py_BEGIN_ALLOW_THREADS
+        written = fwrite(base, 1, size, flush->file);
+    Py_END_ALLOW_THREADS
+
+    flush->flushed += written;
+
+    if (written != size)
+    {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return false;
+    }
+
+    b->offset = base;
+    return true;
+}
+
+// Remove the part of an object that was written to the file before encoding it failed, and release the write lock
+static void encoding_abort_flush(flush_t *flush)
+{
+    if (!flush->started)
+        return;
+    
+    // Write out what stdio still buffers first, so that it doesn't end up in the file after truncating
+    fflush(flush->file);
+
+    if (flush->flushed != 0 && _ftruncate(flush->file, flush->start))
+    {
+        PyObject *exc = PyErr_GetRaisedException();
+
+        PyErr_Format(PyExc_OSError, "Encoding failed after part of the object was written to the file, and truncation failed. "
+            "Incomplete data was written on position %zu, and %zu bytes were written.", flush->start, flush->flushed);
+        
+        PyObject *new_exc = PyErr_GetRaisedException();
+        PyException_SetContext(new_exc, exc);
+        PyErr_SetRaisedException(new_exc);
+    }
+
+    write_lock_release(flush->lock, flush->owner);
+}
+
+// Write the encoded data in the buffer to the file. Returns the sequence number of the written record
+static _always_inline PyObject *encoding_write_file(buffer_t *b, filestream_t *fstream, size_t datasize)
+{
+    // Objects that were written in parts already hold the write lock
+    const bool started = b->flush && b->flush->started;
+    const size_t flushed = started ? b->flush->flushed : 0;
+
+    if (!started && !write_lock_acquire(fstream->write_lock, &fstream->write_owner))
+    {
+        Py_DECREF(b->base);
+        return NULL;
+    }
+
+    // Write the data to the file
+    size_t written;
+    Py_BEGIN_ALLOW_THREADS
+        written = fwrite(PyBytes_AS_STRING(b->base), 1, datasize, fstream->file);
+    Py_END_ALLOW_THREADS
+
+    // Remove reference to the bytes object as we won't return it
+    Py_DECREF(b->base);
+
+    // Check if all data was written
+    if (written != datasize)
+    {
+        // Get the errno
+        const int err = errno;
+
+        // The offset before the written data, including parts written while encoding
+        size_t start_offset = started ? b->flush->start : ftell(fstream->file) - written;
+
+        // Check if anything was written and otherwise attempt to truncate the file
+        if (written + flushed == 0)
+        {
+            PyErr_Format(PyExc_OSError, "Attempted to write encoded data, but no data was written."
+                "\n\tErrno %i: %s", err, strerror(err));
+        }
+        else if (fflush(fstream->file), _ftruncate(fstream->file, start_offset))
+        {
+            PyErr_Format(PyExc_OSError, "Attempted to write encoded data, but the write could not be completed and truncation failed. "
+                "Incomplete data was written on position %zu, and %zu bytes were written."
+                "\n\tErrno %i: %s", start_offset, written + flushed, err, strerror(err));
+        }
+        else
+        {
+            PyErr_Format(PyExc_OSError, "Attempted to write encoded data, but the write could not be completed. The incomplete data was removed."
+                "\n\tErrno %i: %s", err, strerror(err));
+        }
+
+        write_lock_release(fstream->write_lock, &fstream->write_owner);
+        return NULL;
+    }
+
+    // Number the record and apply the durability policy while holding the lock, so that records from concurrent writers
+    // get sequence numbers in the order they were written, and none are counted twice
+    const uint64_t seq = ++fstream->written_seq;
+
+    const bool sync_due = (fstream->sync_records != 0 && seq - fstream->durable_seq >= fstream->sync_records) ||
+        (fstream->sync_ns != 0 && _monotonic_ns() - fstream->last_sync >= fstream->sync_ns);
+    
+    // The record is written even if the sync fails
+    const bool synced = !sync_due || filestream_sync_to(fstream, seq);
+
+    write_lock_release(fstream->write_lock, &fstream->write_owner);
+
+    return synced ? PyLong_FromUnsignedLongLong(seq) : NULL;
+}
+
+// Write the results of the batched ext types at their recorded positions, moving the data after them back
+static bool encoding_resolve_batch(buffer_t *b)
+{
+    batch_t *batch = b->batch;
+
+    PyObject *values = batch_call_all(batch);
+
+    if (!values)
+        return false;
+    
+    Py_buffer *views = (Py_buffer *)PyMem_Malloc(batch->n * sizeof(Py_buffer));
+
+    if (!views)
+    {
+        Py_DECREF(values);
+        PyErr_NoMemory();
+        return false;
+    }
+
+    bool success = false;
+
+    // The number of views acquired so far, and the total size the results take up
+    size_t nviews = 0;
+    size_t extra = 0;
+
+    for (; nviews < batch->n; ++nviews)
+    {
+        PyObject *value = PyList_GET_ITEM(values, nviews);
+
+        if (PyObject_GetBuffer(value, &views[nviews], PyBUF_SIMPLE) < 0)
+        {
+            PyErr_Format(PyExc_TypeError, "Expected to receive a bytes-like object from extension encode functions, but got an object of type '%s'", Py_TYPE(value)->tp_name);
+            goto cleanup;
+        }
+
+        const size_t size = (size_t)views[nviews].len;
+
+        if (size > CM_LIMIT_LARGE)
+        {
+            ++nviews;
+            error_size_limit(Ext, size);
+            goto cleanup;
+        }
+
+        char header[CM_MAX_HEADER_SIZE];
+        extra += cm_write_ext_header(header, (int8_t)batch->entries[nviews].id, size) + size;
+    }
+
+    // The data after the positions is moved, so grow the buffer instead of writing it to the file
+    flush_t *flush = b->flush;
+    b->flush = NULL;
+
+    const bool expanded = ensure_space(b, extra);
+    b->flush = flush;
+
+    if (!expanded)
+        goto cleanup;
+    
+    char *start = PyBytes_AS_STRING(b->base);
+
+    // Work from the back so that every byte is moved only once. SHIFT is how far the data after the current entry moves
+    size_t end = (size_t)(b->offset - start);
+    size_t shift = extra;
+
+    for (size_t i = batch->n; i-- > 0;)
+    {
+        const size_t pos = batch->entries[i].pos;
+        const size_t size = (size_t)views[i].len;
+
+        memmove(start + pos + shift, start + pos, end - pos);
+
+        char header[CM_MAX_HEADER_SIZE];
+        const size_t nheader = cm_write_ext_header(header, (int8_t)batch->entries[i].id, size);
+
+        shift -= nheader + size;
+
+        memcpy(start + pos + shift, header, nheader);
+        memcpy(start + pos + shift + nheader, views[i].buf, size);
+
+        end = pos;
+    }
+
+    b->offset += extra;
+    success = true;
+
+    cleanup:
+
+    for (size_t i = 0; i < nviews; ++i)
+        PyBuffer_Release(&views[i]);
+    
+    PyMem_Free(views);
+    Py_DECREF(values);
+
+    return success;
+}
+
+static _always_inline PyObject *encoding_start(PyObject *obj, mstates_t *states, PyObject *ext, bool str_keys, bool shared_refs, bool int_arrays, oob_t *oob, filestream_t *fstream, double *avg_item_size, double *avg_fluctuation)
+{
+    buffer_t b;
+
+    usdt_probe(encode__start, Py_TYPE(obj)->tp_name);
+    const uint64_t start = usdt_clock(encode__done);
+
+    // Only time the run when the slow hook is set
+    const uint64_t slow_start = slow_enabled(states) ? _monotonic_ns() : 0;
+
+    // Assign non-buffer fields (not filedata, that's not used for encoding)
+    b.ext = ((extensions_t *)ext)->data;
+    b.str_keys = str_keys;
+    b.states = states;
+    b.recursion = 0;
+    b.oob = oob;
+    b.int_arrays = int_arrays;
+
+    batch_t batch = {0};
+    b.batch = &batch;
+
+    // When encoding to a file, the buffer is written to the file whenever it would grow past the chunk size
+    flush_t flush = {0};
+    b.flush = NULL;
+
+    if (fstream && fstream->chunk_size != 0)
+    {
+        flush.file = fstream->file;
+        flush.lock = fstream->write_lock;
+        flush.owner = &fstream->write_owner;
+        flush.size = fstream->chunk_size;
+
+        b.flush = &flush;
+    }
+
+    // This will hold the number of items of the object if it's a container type
+    size_t nitems = 0;
+
+    // This will hold the size of the allocated buffer
+    size_t buffersize;
+
+    // Check if the object is a list/tuple/dict for adaptive allocation
+    if (PyList_Check(obj) || PyTuple_Check(obj) || PyDict_Check(obj))
+    {
+        // Set the fluctuation weight to at least 0.15
+        double fluctuation_weight = *avg_fluctuation < 0.15 ? 0.15 : *avg_fluctuation;
+
+        nitems = Py_SIZE(obj);
+
+        // Add the fluctuation weight to allow headroom for fluctuations in data size, and add 1 to ensure it's not zero
+        buffersize = (*avg_item_size * nitems * (1.0 + fluctuation_weight)) + 1;
+
+        // Don't allocate more than the chunk size when we can write to the file instead
+        if (b.flush && buffersize > b.flush->size)
+            buffersize = b.flush->size;
+
+        b.base = (char *)PyBytes_FromStringAndSize(NULL, buffersize);
+
+        // Do a flat allocation if we couldn't allocate with this
+        if (!b.base)
+            goto flat_alloc;
+    }
+    else
+    {
+        flat_alloc:
+
+        buffersize = 256;
+        b.base = (char *)PyBytes_FromStringAndSize(NULL, buffersize);
+
+        if (!b.base)
+            return PyErr_NoMemory();
+    }
+    
+    // Set the offset and max offset
+    b.offset = PyBytes_AS_STRING(b.base);
+    b.maxoffset = b.offset + buffersize;
+
+    refs_t refs = {0};
+    b.refs = NULL;
+
+    if (shared_refs)
+    {
+        if (!refs_setup(&refs, true))
+        {
+            Py_DECREF(b.base);
+            return NULL;
+        }
+
+        b.refs = &refs;
+    }
+
+    // Attempt to encode the object, and write the batched ext types after
+    const bool success = encode_object_inline(&b, obj) && (batch.n == 0 || encoding_resolve_batch(&b));
+
+    batch_clear(&batch);
+
+    if (b.refs)
+        refs_clear(&refs);
+
+    if (!success)
+    {
+        usdt_probe(encode__done, (size_t)0, _monotonic_ns() - start, 0);
+
+        if (b.flush)
+            encoding_abort_flush(&flush);
+
+        Py_DECREF(b.base);
+        return NULL;
+    }
+    
+    // Calculate the size of the encoded data, of which FLUSHED bytes might be written to the file already
+    size_t datasize = (size_t)(b.offset - PyBytes_AS_STRING(b.base));
+    Py_SET_SIZE(b.base, datasize);
+
+    usdt_probe(encode__done, datasize + flush.flushed, _monotonic_ns() - start, 1);
+
+    // Update the adaptive allocation, unless the buffer was flushed as its usage doesn't reflect the object's size then
+    if (!flush.started)
+        update_adaptive_allocation(&b, nitems, avg_item_size, avg_fluctuation);
+
+    // If not streaming, just return the object
+    if (!fstream)
+    {
+        if (slow_start != 0)
+            slow_check(states, states->interned.encode, slow_start, PyBytes_AS_STRING(b.base), datasize);
+
+        return (PyObject *)b.base;
+    }
+
+    // Otherwise, write the data to the file
+    if (slow_start == 0)
+        return encoding_write_file(&b, fstream, datasize);
+    
+    // Keep the data for the slow hook, as writing it to the file releases it
+    PyObject *encoded = Py_NewRef((PyObject *)b.base);
+    PyObject *result = encoding_write_file(&b, fstream, datasize);
+
+    // The start of objects that were written in parts has to be read back from the file
+    if (result && flush.started)
+        slow_check_file(states, states->interned.encode, slow_start, fstream, flush.start, flush.flushed + datasize);
+    else if (result)
+        slow_check(states, states->interned.encode, slow_start, PyBytes_AS_STRING(encoded), datasize);
+
+    Py_DECREF(encoded);
+    return result;
+}
+
+// Replace the placeholders of batched ext types in RESULT by their values. Returns the (possibly replaced) result
+static PyObject *decoding_resolve_batch(buffer_t *b, PyObject *result)
+{
+    batch_t *batch = b->batch;
+
+    if (!result || batch->n == 0)
+        return result;
+    
+    PyObject *values = batch_call_all(batch);
+
+    if (!values)
+    {
+        Py_DECREF(result);
+        return NULL;
+    }
+
+    PyObject *placeholder = b->states->batch_placeholder;
+
+    // Work from the back, so that the last of duplicate map keys wins like it does for regular values
+    for (size_t i = batch->n; i-- > 0;)
+    {
+        batch_entry_t *entry = &batch->entries[i];
+        PyObject *value = PyList_GET_ITEM(values, i);
+
+        // Only replace slots that still hold the placeholder, as map values can be overwritten by duplicate keys
+        if (!entry->container)
+        {
+            if (result == placeholder)
+                Py_SETREF(result, Py_NewRef(value));
+        }
+        else if (entry->key)
+        {
+            if (PyDict_GetItemWithError(entry->container, entry->key) == placeholder &&
+                PyDict_SetItem(entry->container, entry->key, value) < 0)
+            {
+                Py_DECREF(values);
+                Py_DECREF(result);
+                return NULL;
+            }
+        }
+        else if (PyList_GET_ITEM(entry->container, entry->pos) == placeholder)
+        {
+            PyList_SetItem(entry->container, entry->pos, Py_NewRef(value));
+        }
+    }
+
+    Py_DECREF(values);
+    return result;
+}
+
+// Start a decoding run
+static _always_inline PyObject *decoding_start(PyObject *encoded, mstates_t *states, PyObject *ext, bool str_keys, size_t raw_depth, bool shared_refs, bool int_arrays, oob_t *oob, filestream_t *fstream)
+{
+    buffer_t b;
+
+    // Assign non-buffer fields
+    b.ext = ((extensions_t *)ext)->data;
+    b.str_keys = str_keys;
+    b.states = states;
+    b.depth = 0;
+    b.raw_depth = raw_depth;
+    b.owner = encoded;
+    b.oob = oob;
+    b.int_arrays = int_arrays;
+
+    batch_t batch = {0};
+    b.batch = &batch;
+
+    refs_t refs = {0};
+    b.refs = NULL;
+
+    if (shared_refs)
+    {
+        if (!refs_setup(&refs, false))
+            return NULL;
+
+        b.refs = &refs;
+    }
+
+    // Simply decode and return if not file streaming
+    if (!fstream)
+    {
+        // Set the file to NULL for overread checks
+        b.file = NULL;
+
+        // Get the buffer of the object
+        Py_buffer buf;
+        if (PyObject_GetBuffer(encoded, &buf, PyBUF_SIMPLE) < 0)
+        {
+            if (b.refs)
+                refs_clear(&refs);
+            
+            return NULL;
+        }
+        
+        // Set the buffer fields (base not used for regular decoding)
+        b.offset = buf.buf;
+        b.maxoffset = (char *)buf.buf + buf.len;
+
+        usdt_probe(decode__start, (size_t)buf.len);
+        const uint64_t start = usdt_clock(decode__done);
+        const uint64_t slow_start = slow_enabled(states) ? _monotonic_ns() : 0;
+        
+        // Decode the data
+        PyObject *result = decode_bytes(&b);
+
+        // Check if we reached the end of the buffer
+        if (result != NULL && b.offset != b.maxoffset)
+        {
+            Py_DECREF(result);
+            result = NULL;
+
+            PyErr_SetString(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
+        }
+
+        // Resolve the batched ext types while memoryviews passed to them are still valid
+        result = decoding_resolve_batch(&b, result);
+        batch_clear(&batch);
+
+        if (b.refs)
+            refs_clear(&refs);
+
+        usdt_probe(decode__done, (size_t)(b.offset - (char *)buf.buf), _monotonic_ns() - start, result != NULL);
+
+        if (slow_start != 0 && result)
+            slow_check(states, states->interned.decode, slow_start, buf.buf, (size_t)buf.len);
+
+        // Release the buffer
+        PyBuffer_Release(&buf);
+
+        return result;
+    }
+
+    // This path is reached when file streaming
+
+    // Assign the file-related fields (maxoffset is assigned based on how many bytes are read later)
+    b.fbuf_size = fstream->fbuf_size;
+    b.file = fstream->file;
+    b.base = fstream->fbuf;
+    b.offset = b.base;
+    b.dio = fstream->direct_io && fstream->dio.fd >= 0 ? &fstream->dio : NULL;
+    
+    // Seek the file to the current offset
+    if (b.dio)
+        b.dio->pos = fstream->foff;
+    else
+        fseek(b.file, fstream->foff, SEEK_SET);
+
+    usdt_probe(decode__start, (size_t)0);
+    const uint64_t start = usdt_clock(decode__done);
+    const uint64_t slow_start = slow_enabled(states) ? _monotonic_ns() : 0;
+    const size_t record_offset = fstream->foff;
+
+    // Read data from the file into the buffer
+    size_t read;
+    Py_BEGIN_ALLOW_THREADS
+        read = decoding_read(&b, b.base, b.fbuf_size);
+    Py_END_ALLOW_THREADS
+
+    b.maxoffset = b.base + read; // Set the max buffer offset based on how much data we read
+
+    // Decode the read data
+    PyObject *result = decode_bytes(&b);
+
+    result = decoding_resolve_batch(&b, result);
+    batch_clear(&batch);
+
+    if (b.refs)
+        refs_clear(&refs);
+
+    // Calculate up to where we had to read from the file (up until the data of the next encoded data block)
+    size_t end_offset = b.dio ? b.dio->pos : (size_t)ftell(b.file);
+    size_t buffer_unused = (size_t)(b.maxoffset - b.offset);
+    size_t new_offset = end_offset - buffer_unused;
+    usdt_probe(decode__done, new_offset - (size_t)fstream->foff, _monotonic_ns() - start, result != NULL);
+
+    // Update the reading offset. A record that failed to decode isn't consumed, so that a truncated record can be read again once it's complete
+    if (result)
+        fstream->foff = new_offset;
+
+    // Without direct I/O support, drop the pages we read past from the page cache in large steps
+    if (fstream->direct_io && !b.dio && new_offset >= fstream->dio.dropped + DIRECTIO_MINSIZE)
+    {
+        _fadvise(b.file, 0, new_offset, DONTNEED);
+        fstream->dio.dropped = new_offset;
+    }
+
+    // Shrink the file buffer back down after an oversized record, so that it doesn't keep the size of the largest record
+    if (b.fbuf_size > fstream->chunk_size && fstream->chunk_size != 0)
+    {
+        char *fbuf = (char *)PyMem_RawRealloc(b.base, fstream->chunk_size);
+
+        // Keep the larger buffer if shrinking failed
+        if (fbuf)
+        {
+            b.base = fbuf;
+            b.fbuf_size = fstream->chunk_size;
+        }
+    }
+
+    // Update the file buffer address and size
+    fstream->fbuf = b.base;
+    fstream->fbuf_size = b.fbuf_size;
+
+    if (slow_start != 0 && result)
+        slow_check_file(states, states->interned.decode, slow_start, fstream, record_offset, new_offset - record_offset);
+
+    return result;
+}
+
+// Expand the encoding buffer when it doesn't have enough space
+static bool encoding_expand_buffer(buffer_t *b, size_t required)
+{
+    // Get the number of bytes already written, the base is invalidated by the realloc
+    size_t used = (size_t)(b->offset - PyBytes_AS_STRING(b->base));
+
+    // When encoding to a file, write out the data so far instead of growing the buffer past the chunk size
+    if (b->flush && used != 0 && used + required > b->flush->size)
+    {
+        if (!encoding_flush(b))
+            return false;
+        
+        if (required <= (size_t)(b->maxoffset - b->offset))
+            return true;
+        
+        used = 0;
+    }
+
+    // Scale the size by a factor of 1.5
+    const size_t allocsize = (used + required) * 1.5;
+
+    // Reallocate the object (also allocate space for the bytes object itself)
+    char *reallocd = PyObject_Realloc(b->base, allocsize + sizeof(PyBytesObject));
+
+    if (reallocd == NULL)
+    {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    usdt_probe(buffer__expand, used, allocsize);
+
+    // Update the offsets
+    b->offset = PyBytes_AS_STRING(reallocd) + used;
+    b->maxoffset = PyBytes_AS_STRING(reallocd) + allocsize;
+    b->base = reallocd;
+
+    return true;
+}
+
+// Refresh the file buffer with new data while decoding
+static bool decoding_refresh_fbuf(buffer_t *b, size_t required)
+{
+    // Calculate how much from the buffer is unused
+    size_t unused = (size_t)(b->maxoffset - b->offset);
+
+    // Move the unused data to the start of the buffer
+    memmove(b->base, b->offset, unused);
+
+    // Check if the required size exceeds the buffer size
+    if (required > b->fbuf_size)
+    {
+        size_t newsize = required * 1.2;
+        char *fbuf = (char *)PyMem_RawRealloc(b->base, newsize);
+
+        if (!fbuf)
+            return PyErr_NoMemory();
+        
+        b->base = fbuf;
+        b->fbuf_size = newsize;
+    }
+
+    // Read new data into the buffer above the unused data
+    size_t read;
+    Py_BEGIN_ALLOW_THREADS
+        read = decoding_read(b, b->base + unused, b->fbuf_size - unused);
+    Py_END_ALLOW_THREADS
+
+    usdt_probe(file__refill, unused, read, b->fbuf_size);
+
+    // Check if we have less data than required, meaning we reached EOF
+    if (read + unused < required)
+        return decoding_read_error(b);
+
+    // Update the offsets
+    b->offset = b->base;
+    b->maxoffset = b->base + unused + read;
+
+    return true;
+}
+
+// Read a str/bin value of SIZE bytes from the file into the object's own storage, without staging it in the file buffer
+static PyObject *decoding_read_file_direct(buffer_t *b, size_t size, bool str)
+{
+    // Strings are read into a temporary bytes object first, as their size is only known after UTF-8 decoding
+    PyObject *bytes = PyBytes_FromStringAndSize(NULL, size);
+
+    if (!bytes)
+        return NULL;
+
+    char *data = PyBytes_AS_STRING(bytes);
+
+    // Copy the part that is already in the file buffer, which is less than SIZE as SIZE exceeds the buffer size
+    const size_t buffered = (size_t)(b->maxoffset - b->offset);
+    memcpy(data, b->offset, buffered);
+
+    // Read the rest directly from the file
+    size_t read;
+    Py_BEGIN_ALLOW_THREADS
+        read = decoding_read(b, data + buffered, size - buffered);
+    Py_END_ALLOW_THREADS
+
+    if (read != size - buffered)
+    {
+        Py_DECREF(bytes);
+
+        decoding_read_error(b);
+        return NULL;
+    }
+
+    // The file buffer is fully consumed now
+    b->offset = b->maxoffset;
+
+    if (!str)
+        return bytes;
+
+    PyObject *obj = PyUnicode_DecodeUTF8(data, size, NULL);
+    Py_DECREF(bytes);
+
+    return obj;
+}
+
+// Ensure enough space is in the encoding buffer
+static _always_inline bool ensure_space(buffer_t *b, size_t required)
+{
+    if (b->offset + required >= b->maxoffset)
+        return encoding_expand_buffer(b, required);
+    
+    return true;
+}
+
+// Check if we aren't overreading the buffer when reading REQUIRED bytes
+static _always_inline bool overread_check(buffer_t *b, size_t required)
+{
+    // Check if the offset would exceed the max offset
+    if (b->offset + required > b->maxoffset)
+    {
+        // If we have a file, we need to refresh the file buffer
+        if (b->file)
+        {
+            return decoding_refresh_fbuf(b, required);
+        }
+        else
+        {
+            // Otherwise, we'll overread the data, so set an exception
+            PyErr_SetString(PyExc_ValueError, "Received incomplete encoded data, the buffer ended before the encoded data pattern ended");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/////////////////////
+//  BASIC ENC/DEC  //
+/////////////////////
+
+// Parse the value of a non-negative integer argument called ARGNAME
+static bool parse_size_arg(PyObject *obj, const char *argname, size_t *size)
+{
+    Py_ssize_t num = PyLong_AsSsize_t(obj);
+
+    if (num == -1 && PyErr_Occurred())
+        return false;
+
+    if (num < 0)
+    {
+        PyErr_Format(PyExc_ValueError, "The value of argument '%s' was smaller than 0, but must be positive", argname);
+        return false;
+    }
+
+    *size = (size_t)num;
+    return true;
+}
+
+// Parse the name of a hash algorithm, where NULL and None mean no hash
+static bool parse_hash_arg(PyObject *obj, cm_hash_t *hash)
+{
+    if (!obj || obj == Py_None)
+    {
+        *hash = CM_HASH_NONE;
+    }
+    else if (PyUnicode_Check(obj) && PyUnicode_CompareWithASCIIString(obj, "xxh64") == 0)
+    {
+        *hash = CM_HASH_XXH64;
+    }
+    else if (PyUnicode_Check(obj) && PyUnicode_CompareWithASCIIString(obj, "crc32c") == 0)
+    {
+        *hash = CM_HASH_CRC32C;
+    }
+    else if (PyUnicode_Check(obj) && PyUnicode_CompareWithASCIIString(obj, "xxh3") == 0)
+    {
+        // XXH3 needs the xxHash library, the portable XXH64 is implemented instead
+        PyErr_SetString(PyExc_ValueError, "The 'xxh3' hash is not supported, use 'xxh64' (64-bit xxHash) or 'crc32c' instead");
+        return false;
+    }
+    else
+    {
+        PyErr_Format(PyExc_ValueError, "Expected argument 'hash' to be 'xxh64', 'crc32c', or None, but got %R", obj);
+        return false;
+    }
+
+    return true;
+}
+
+// Get the name of a hash algorithm, or None
+static PyObject *hash_name(cm_hash_t hash)
+{
+    switch (hash)
+    {
+    case CM_HASH_XXH64:
+        return PyUnicode_FromString("xxh64");
+    case CM_HASH_CRC32C:
+        return PyUnicode_FromString("crc32c");
+    default:
+        Py_RETURN_NONE;
+    }
+}
+
+// Return a tuple of ENCODED (stolen) and its hash, or just ENCODED if not hashing.
+// The data is hashed right after encoding, while it's still in the cache
+static PyObject *encoding_add_hash(PyObject *encoded, cm_hash_t hash)
+{
+    if (!encoded || hash == CM_HASH_NONE)
+        return encoded;
+    
+    const char *data = PyBytes_AS_STRING(encoded);
+    const size_t size = (size_t)PyBytes_GET_SIZE(encoded);
+
+    PyObject *digest = hash == CM_HASH_XXH64 ?
+        PyLong_FromUnsignedLongLong(cm_xxh64(data, size, 0)) :
+        PyLong_FromUnsignedLong(cm_crc32c(0, data, size));
+    
+    PyObject *tuple = digest ? PyTuple_New(2) : NULL;
+
+    if (!tuple)
+    {
+        Py_DECREF(encoded);
+        Py_XDECREF(digest);
+        return NULL;
+    }
+
+    PyTuple_SET_ITEM(tuple, 0, encoded);
+    PyTuple_SET_ITEM(tuple, 1, digest);
+
+    return tuple;
+}
+
+static PyObject *encode(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    const Py_ssize_t npositional = 1;
+    if (!min_positional(nargs, npositional))
+        return NULL;
+
+    PyObject *obj = parse_positional(args, 0, NULL, "obj");
+
+    if (!obj)
+        return NULL;
+
+    mstates_t *states = get_mstates(self);
+
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+    PyObject *hash = NULL;
+    PyObject *shared_refs = Py_False;
+    PyObject *buffer_callback = Py_None;
+    PyObject *int_arrays = Py_False;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+        KEYARG(&hash, NULL, states->interned.hash),
+        KEYARG(&shared_refs, &PyBool_Type, states->interned.shared_refs),
+        KEYARG(&buffer_callback, NULL, states->interned.buffer_callback),
+        KEYARG(&int_arrays, &PyBool_Type, states->interned.int_arrays),
+    };
+
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    cm_hash_t hash_alg;
+    if (!parse_hash_arg(hash, &hash_alg))
+        return NULL;
+    
+    oob_t oob = {0};
+
+    if (buffer_callback != Py_None)
+    {
+        if (!PyCallable_Check(buffer_callback))
+            return PyErr_Format(PyExc_TypeError, "Expected 'buffer_callback' to be callable or None, but got an object of type '%s'", Py_TYPE(buffer_callback)->tp_name);
+        
+        oob.callback = buffer_callback;
     }
-    case VARLEN_DT(DT_UINT_BIT16):
+
+    PyObject *encoded = encoding_start(obj, states, ext, str_keys == Py_True, shared_refs == Py_True, int_arrays == Py_True, oob.callback ? &oob : NULL, NULL, &avg_item_size, &avg_fluctuation);
+
+    return encoding_add_hash(encoded, hash_alg);
+}
+
+static PyObject *decode(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    const Py_ssize_t npositional = 1;
+    if (!min_positional(nargs, npositional))
+        return NULL;
+
+    PyObject *encoded = parse_positional(args, 0, NULL, "encoded");
+
+    if (!encoded)
+        return NULL;
+
+    mstates_t *states = get_mstates(self);
+
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+    PyObject *raw_depth = NULL;
+    PyObject *shared_refs = Py_False;
+    PyObject *buffers = Py_None;
+    PyObject *int_arrays = Py_False;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+        KEYARG(&raw_depth, &PyLong_Type, states->interned.raw_depth),
+        KEYARG(&shared_refs, &PyBool_Type, states->interned.shared_refs),
+        KEYARG(&buffers, NULL, states->interned.buffers),
+        KEYARG(&int_arrays, &PyBool_Type, states->interned.int_arrays),
+    };
+
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    size_t raw_depth_num = 0;
+    if (raw_depth && !parse_size_arg(raw_depth, "raw_depth", &raw_depth_num))
+        return NULL;
+    
+    if (shared_refs == Py_True && raw_depth_num != 0)
+        return error_refs_rawdepth();
+    
+    if (buffers == Py_None)
+        return decoding_start(encoded, states, ext, str_keys == Py_True, raw_depth_num, shared_refs == Py_True, int_arrays == Py_True, NULL, NULL);
+    
+    oob_t oob = {0};
+    oob.buffers = PySequence_Fast(buffers, "Expected 'buffers' to be an iterable of buffer objects");
+
+    if (!oob.buffers)
+        return NULL;
+    
+    PyObject *result = decoding_start(encoded, states, ext, str_keys == Py_True, raw_depth_num, shared_refs == Py_True, int_arrays == Py_True, &oob, NULL);
+
+    Py_DECREF(oob.buffers);
+    return result;
+}
+
+
+///////////////////
+//   SLOW HOOK   //
+///////////////////
+
+static PyObject *on_slow(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    const Py_ssize_t npositional = 3;
+    if (!min_positional(nargs, npositional))
+        return NULL;
+
+    PyObject *threshold_us = parse_positional(args, 0, &PyLong_Type, "threshold_us");
+    PyObject *max_bytes = parse_positional(args, 1, &PyLong_Type, "max_bytes");
+    PyObject *callback = args[2];
+
+    if (!threshold_us || !max_bytes)
+        return NULL;
+
+    mstates_t *states = get_mstates(self);
+
+    PyObject *sample_rate = NULL;
+    PyObject *prefix_size = NULL;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&sample_rate, NULL, states->interned.sample_rate),
+        KEYARG(&prefix_size, &PyLong_Type, states->interned.prefix_size),
+    };
+
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    if (callback != Py_None && !PyCallable_Check(callback))
+        return PyErr_Format(PyExc_TypeError, "Expected argument 'callback' to be callable or None, but got an object of type '%s'", Py_TYPE(callback)->tp_name);
+
+    size_t threshold_num, max_bytes_num, prefix_size_num = 64;
+    if (!parse_size_arg(threshold_us, "threshold_us", &threshold_num) ||
+        !parse_size_arg(max_bytes, "max_bytes", &max_bytes_num) ||
+        (prefix_size && !parse_size_arg(prefix_size, "prefix_size", &prefix_size_num)))
+        return NULL;
+
+    double rate = 1.0;
+    if (sample_rate)
     {
-        if (!overread_check(b, 2))
+        rate = PyFloat_AsDouble(sample_rate);
+
+        if (rate == -1.0 && PyErr_Occurred())
             return NULL;
 
-        uint16_t num = SIZEBYTE << 8;
-        num |= SIZEBYTE;
-        
-        return PyLong_FromUnsignedLongLong(num);
+        if (!(rate >= 0.0 && rate <= 1.0))
+            return PyErr_Format(PyExc_ValueError, "Expected argument 'sample_rate' to be between 0.0 and 1.0, but got %R", sample_rate);
+    }
+
+    slowhook_t *slow = &states->slow;
+    callback = callback == Py_None ? NULL : Py_NewRef(callback);
+
+    lock_flag(&slow->lock);
+
+    PyObject *old_callback = slow->callback;
+
+    slow->callback = callback;
+    slow->threshold_ns = (uint64_t)threshold_num * 1000;
+    slow->max_bytes = max_bytes_num;
+    slow->sample_limit = (uint64_t)(rate * 4294967296.0);
+    slow->prefix_size = prefix_size_num;
+    atomic_store_explicit(&slow->enabled, callback != NULL, memory_order_relaxed);
+
+    unlock_flag(&slow->lock);
+
+    // Released outside of the lock as its deallocation could run other code. Reports running in other threads hold their own reference
+    Py_XDECREF(old_callback);
+
+    Py_RETURN_NONE;
+}
+
+
+//////////////////////
+//  PATCHING  DATA  //
+//////////////////////
+
+// Set up a buffer for encoding, with SIZE bytes allocated up front
+static _always_inline bool patching_setup_output(buffer_t *b, mstates_t *states, PyObject *ext, bool str_keys, size_t size)
+{
+    b->ext = ((extensions_t *)ext)->data;
+    b->str_keys = str_keys;
+    b->states = states;
+    b->recursion = 0;
+    b->file = NULL;
+    b->batch = NULL;
+    b->refs = NULL;
+    b->oob = NULL;
+    b->int_arrays = false;
+    b->flush = NULL;
+
+    b->base = (char *)PyBytes_FromStringAndSize(NULL, size);
+
+    if (!b->base)
+        return false;
+
+    b->offset = PyBytes_AS_STRING(b->base);
+    b->maxoffset = b->offset + size;
+
+    return true;
+}
+
+// Shrink the output object to the written size and return it
+static _always_inline PyObject *patching_finish_output(buffer_t *b)
+{
+    Py_SET_SIZE(b->base, (size_t)(b->offset - PyBytes_AS_STRING(b->base)));
+    return (PyObject *)b->base;
+}
+
+// Set up a buffer for reading the data held by BUF
+static _always_inline void patching_setup_input(buffer_t *b, Py_buffer *buf, mstates_t *states, PyObject *ext, bool str_keys)
+{
+    b->ext = ((extensions_t *)ext)->data;
+    b->str_keys = str_keys;
+    b->states = states;
+    b->file = NULL;
+    b->depth = 0;
+    b->raw_depth = 0;
+    b->owner = NULL;
+    b->batch = NULL;
+    b->refs = NULL;
+    b->oob = NULL;
+    b->int_arrays = false;
+
+    b->base = buf->buf;
+    b->offset = buf->buf;
+    b->maxoffset = (char *)buf->buf + buf->len;
+}
+
+// Decode a map key, enforcing string keys if requested
+static _always_inline PyObject *patching_decode_key(buffer_t *b)
+{
+    PyObject *key = decode_bytes(b);
+
+    if (key && b->str_keys && !PyUnicode_CheckExact(key))
+    {
+        PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(key)->tp_name);
+        Py_DECREF(key);
+        return NULL;
+    }
+
+    return key;
+}
+
+// Find the pair in a map with the given key. Leaves the offset at the value of the pair on a match, or at the end of the map otherwise
+static int patching_find_key(buffer_t *b, size_t npairs, PyObject *key)
+{
+    for (size_t i = 0; i < npairs; ++i)
+    {
+        PyObject *k = patching_decode_key(b);
+
+        if (!k)
+            return -1;
+
+        int match = PyObject_RichCompareBool(k, key, Py_EQ);
+        Py_DECREF(k);
+
+        if (match != 0)
+            return match;
+
+        if (!skip_object(b))
+            return -1;
+    }
+
+    return 0;
+}
+
+static PyObject *patch(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    const Py_ssize_t npositional = 3;
+    if (!min_positional(nargs, npositional))
+        return NULL;
+
+    PyObject *encoded = parse_positional(args, 0, NULL, "encoded");
+    PyObject *path = parse_positional(args, 1, NULL, "path");
+    PyObject *value = parse_positional(args, 2, NULL, "value");
+
+    if (!encoded || !path || !value)
+        return NULL;
+
+    if (!PyTuple_CheckExact(path) && !PyList_CheckExact(path))
+        return error_unexpected_argtype("path", "tuple' or 'list", Py_TYPE(path)->tp_name);
+
+    mstates_t *states = get_mstates(self);
+
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+    };
+
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    Py_buffer buf;
+    if (PyObject_GetBuffer(encoded, &buf, PyBUF_SIMPLE) < 0)
+        return NULL;
+
+    buffer_t r;
+    patching_setup_input(&r, &buf, states, ext, str_keys == Py_True);
+
+    // The data after the patched value is copied as-is, so check up front that it ends with the top-level object
+    if (!skip_object(&r))
+        goto error;
+    
+    if (r.offset != r.maxoffset)
+    {
+        PyErr_SetString(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
+        goto error;
+    }
+
+    r.offset = r.base;
+
+    // Start of the map that receives a new key, if the last key of the path doesn't exist yet
+    char *header_start = NULL;
+
+    PyObject *new_key = NULL;
+
+    const Py_ssize_t depth = PySequence_Fast_GET_SIZE(path);
+    for (Py_ssize_t i = 0; i < depth; ++i)
+    {
+        PyObject *key = PySequence_Fast_GET_ITEM(path, i);
+
+        if (!overread_check(&r, 1))
+            goto error;
+
+        const unsigned char mask = r.offset[0];
+        char *container_start = r.offset;
+        size_t nitems;
+
+        if ((mask & 240) == CM_DT_MAP_FIXED || mask == CM_DT_MAP_MEDIUM || mask == CM_DT_MAP_LARGE)
+        {
+            if (!read_container_header(&r, true, &nitems))
+                goto error;
+
+            const int found = patching_find_key(&r, nitems, key);
+
+            if (found < 0)
+                goto error;
+
+            if (found == 0)
+            {
+                // A missing key can only be added as the last key of the path
+                if (i != depth - 1)
+                {
+                    PyErr_SetObject(PyExc_KeyError, key);
+                    goto error;
+                }
+
+                header_start = container_start;
+                new_key = key;
+            }
+        }
+        else if ((mask & 240) == CM_DT_ARR_FIXED || mask == CM_DT_ARR_MEDIUM || mask == CM_DT_ARR_LARGE)
+        {
+            if (!read_container_header(&r, false, &nitems))
+                goto error;
+
+            if (!PyLong_Check(key))
+            {
+                PyErr_Format(PyExc_TypeError, "Expected path item %zi to be of type 'int' to index an array, but got an object of type '%s'", i, Py_TYPE(key)->tp_name);
+                goto error;
+            }
+
+            Py_ssize_t idx = PyLong_AsSsize_t(key);
+
+            if (idx == -1 && PyErr_Occurred())
+                goto error;
+
+            // Support negative indexing like Python lists
+            if (idx < 0)
+                idx += (Py_ssize_t)nitems;
+
+            if (idx < 0 || (size_t)idx >= nitems)
+            {
+                PyErr_Format(PyExc_IndexError, "Path item %zi is out of range for an array with %zu items", i, nitems);
+                goto error;
+            }
+
+            for (Py_ssize_t j = 0; j < idx; ++j)
+            {
+                if (!skip_object(&r))
+                    goto error;
+            }
+        }
+        else
+        {
+            PyErr_Format(PyExc_TypeError, "Expected a map or array at path item %zi, but got header byte '0x%02X'", i, mask);
+            goto error;
+        }
+    }
+
+    // Get the span of the value to replace, which is empty when adding a new key
+    char *value_start = r.offset;
+
+    if (!new_key && !skip_object(&r))
+        goto error;
+
+    char *value_end = r.offset;
+
+    buffer_t w;
+    if (!patching_setup_output(&w, states, ext, str_keys == Py_True, buf.len + 64))
+        goto error;
+
+    if (new_key)
+    {
+        // Re-read the original header to rewrite it with the new number of pairs
+        size_t header_npairs = 0;
+        r.offset = header_start;
+        read_container_header(&r, true, &header_npairs);
+        char *header_end = r.offset;
+
+        if (!write_raw(&w, r.base, (size_t)(header_start - r.base)) ||
+            !ensure_space(&w, 5) ||
+            !write_map_header(&w, header_npairs + 1) ||
+            !write_raw(&w, header_end, (size_t)(value_start - header_end)))
+            goto error_output;
+
+        if (w.str_keys && !PyUnicode_CheckExact(new_key))
+        {
+            PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(new_key)->tp_name);
+            goto error_output;
+        }
+
+        if (!encode_object_inline(&w, new_key))
+            goto error_output;
+    }
+    else
+    {
+        if (!write_raw(&w, r.base, (size_t)(value_start - r.base)))
+            goto error_output;
+    }
+
+    if (!encode_object_inline(&w, value) ||
+        !write_raw(&w, value_end, (size_t)(r.maxoffset - value_end)))
+        goto error_output;
+
+    PyBuffer_Release(&buf);
+    return patching_finish_output(&w);
+
+error_output:
+    Py_DECREF(w.base);
+error:
+    PyBuffer_Release(&buf);
+    return NULL;
+}
+
+static PyObject *merge_maps(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    const Py_ssize_t npositional = 2;
+    if (!min_positional(nargs, npositional))
+        return NULL;
+
+    PyObject *encoded_a = parse_positional(args, 0, NULL, "a");
+    PyObject *encoded_b = parse_positional(args, 1, NULL, "b");
+
+    if (!encoded_a || !encoded_b)
+        return NULL;
+
+    mstates_t *states = get_mstates(self);
+
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+    };
+
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    Py_buffer buf_a, buf_b;
+    if (PyObject_GetBuffer(encoded_a, &buf_a, PyBUF_SIMPLE) < 0)
+        return NULL;
+
+    if (PyObject_GetBuffer(encoded_b, &buf_b, PyBUF_SIMPLE) < 0)
+    {
+        PyBuffer_Release(&buf_a);
+        return NULL;
+    }
+
+    buffer_t ra, rb, w;
+    patching_setup_input(&ra, &buf_a, states, ext, str_keys == Py_True);
+    patching_setup_input(&rb, &buf_b, states, ext, str_keys == Py_True);
+
+    w.base = NULL;
+
+    PyObject *keys_b = PySet_New(NULL);
+    size_t npairs_a, npairs_b;
+
+    if (!keys_b ||
+        !read_container_header(&ra, true, &npairs_a) ||
+        !read_container_header(&rb, true, &npairs_b))
+        goto error;
+
+    // Collect the keys of B, as those override the pairs of A
+    char *pairs_b = rb.offset;
+    for (size_t i = 0; i < npairs_b; ++i)
+    {
+        PyObject *key = patching_decode_key(&rb);
+
+        if (!key)
+            goto error;
+
+        int status = PySet_Add(keys_b, key);
+        Py_DECREF(key);
+
+        if (status < 0 || !skip_object(&rb))
+            goto error;
     }
-    case VARLEN_DT(DT_UINT_BIT32):
+
+    if (rb.offset != rb.maxoffset)
     {
-        if (!overread_check(b, 4))
-            return NULL;
+        PyErr_SetString(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
+        goto error;
+    }
 
-        uint32_t num;
-        memcpy(&num, b->offset, 4);
-        b->offset += 4;
+    if (!patching_setup_output(&w, states, ext, str_keys == Py_True, buf_a.len + buf_b.len + 5))
+        goto error;
 
-        num = BIG_32(num);
-        
-        return PyLong_FromUnsignedLongLong(num);
-    }
-    case VARLEN_DT(DT_UINT_BIT64):
+    // Reserve space for the largest map header, as the number of pairs is only known afterwards
+    w.offset += 5;
+
+    size_t npairs = npairs_b;
+
+    // Copy the pairs of A that aren't overridden, merging adjacent pairs into a single copy
+    char *run_start = ra.offset;
+    for (size_t i = 0; i < npairs_a; ++i)
     {
-        if (!overread_check(b, 8))
-            return NULL;
+        char *pair_start = ra.offset;
+        PyObject *key = patching_decode_key(&ra);
 
-        uint64_t num;
-        memcpy(&num, b->offset, 8);
-        b->offset += 8;
+        if (!key)
+            goto error;
 
-        num = BIG_64(num);
-        
-        return PyLong_FromUnsignedLongLong(num);
+        int overridden = PySet_Contains(keys_b, key);
+        Py_DECREF(key);
+
+        if (overridden < 0 || !skip_object(&ra))
+            goto error;
+
+        if (overridden)
+        {
+            if (!write_raw(&w, run_start, (size_t)(pair_start - run_start)))
+                goto error;
+
+            run_start = ra.offset;
+        }
+        else
+        {
+            npairs++;
+        }
     }
 
-    case VARLEN_DT(DT_INT_BIT8):
+    if (ra.offset != ra.maxoffset)
     {
-        if (!overread_check(b, 1))
-            return NULL;
+        PyErr_SetString(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
+        goto error;
+    }
 
-        int8_t num = SIZEBYTE;
+    if (!write_raw(&w, run_start, (size_t)(ra.offset - run_start)) ||
+        !write_raw(&w, pairs_b, (size_t)(rb.maxoffset - pairs_b)))
+        goto error;
 
-        return get_cached_int(b, num);
+    // Write the header into the reserved space, and move the pairs down to it
+    char *start = PyBytes_AS_STRING(w.base);
+    char *pairs = start + 5;
+    const size_t pairs_size = (size_t)(w.offset - pairs);
+
+    w.offset = start;
+    if (!write_map_header(&w, npairs))
+        goto error;
+
+    memmove(w.offset, pairs, pairs_size);
+    w.offset += pairs_size;
+
+    Py_DECREF(keys_b);
+    PyBuffer_Release(&buf_a);
+    PyBuffer_Release(&buf_b);
+
+    return patching_finish_output(&w);
+
+error:
+    Py_XDECREF(w.base);
+    Py_XDECREF(keys_b);
+    PyBuffer_Release(&buf_a);
+    PyBuffer_Release(&buf_b);
+    return NULL;
+}
+
+////////////////////
+//  DECODE CACHE  //
+////////////////////
+
+/* # Decode cache
+ * 
+ * Streams can cache the objects that messages of up to `DECODE_CACHE_MAXSIZE` bytes were decoded to, keyed by the xxHash
+ * of the message. A hit is compared against the stored message byte-for-byte, and skips decoding entirely.
+ * 
+ * Decoded objects can be modified by the caller, so the cache holds its own copy, and each hit returns a new copy of it.
+ * Copying only creates the lists and dicts, all other objects are shared. Because of that, only objects consisting of
+ * lists, dicts, and immutable built-in types are cached.
+ */
+
+static void dcache_free_entries(dcache_entry_t *entries, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        Py_XDECREF(entries[i].encoded);
+        Py_XDECREF(entries[i].result);
     }
-    case VARLEN_DT(DT_INT_BIT16):
+
+    free(entries);
+}
+
+// Replace the cache by an empty one with room for at least CAPACITY entries, 0 to disable it
+static bool dcache_resize(dcache_t *cache, size_t capacity)
+{
+    const size_t nsets = (capacity + DECODE_CACHE_WAYS - 1) / DECODE_CACHE_WAYS;
+    dcache_entry_t *entries = NULL;
+
+    if (nsets != 0)
     {
-        if (!overread_check(b, 2))
-            return NULL;
+        entries = (dcache_entry_t *)calloc(nsets * DECODE_CACHE_WAYS, sizeof(dcache_entry_t));
 
-        int16_t num = (int16_t)SIZEBYTE << 8;
-        num |= SIZEBYTE;
-        
-        return PyLong_FromLongLong(num);
+        if (!entries)
+        {
+            PyErr_NoMemory();
+            return false;
+        }
     }
-    case VARLEN_DT(DT_INT_BIT32):
-    {
-        if (!overread_check(b, 4))
-            return NULL;
 
-        int32_t num;
-        memcpy(&num, b->offset, 4);
-        b->offset += 4;
+    lock_flag(&cache->lock);
 
-        num = BIG_32(num);
-        
-        return PyLong_FromLongLong(num);
-    }
-    case VARLEN_DT(DT_INT_BIT64):
-    {
-        if (!overread_check(b, 8))
-            return NULL;
+    dcache_entry_t *old = cache->entries;
+    const size_t nold = cache->nsets * DECODE_CACHE_WAYS;
 
-        int64_t num;
-        memcpy(&num, b->offset, 8);
-        b->offset += 8;
+    cache->entries = entries;
+    cache->nsets = nsets;
+    cache->hits = 0;
+    cache->misses = 0;
 
-        num = BIG_64(num);
+    unlock_flag(&cache->lock);
 
-        return PyLong_FromLongLong(num);
-    }
+    // Objects are released outside of the lock, as their deallocation could run other code
+    dcache_free_entries(old, nold);
+    return true;
+}
+
+// Empty the cache, for when the options that decoding depends on change
+static _always_inline bool dcache_clear(dcache_t *cache)
+{
+    return cache->nsets == 0 || dcache_resize(cache, cache->nsets * DECODE_CACHE_WAYS);
+}
+
+// Check if OBJ is immutable, so that it can be shared between the cached object and its copies
+static bool dcache_immutable(PyObject *obj, size_t depth)
+{
+    PyTypeObject *tp = Py_TYPE(obj);
 
-    case VARLEN_DT(DT_ARR_LARGE):
+    if (tp == &PyUnicode_Type || tp == &PyLong_Type || tp == &PyFloat_Type || tp == &PyBytes_Type || tp == &PyBool_Type || obj == Py_None)
+        return true;
+    
+    // Tuples are only immutable if their items are
+    if (tp == &PyTuple_Type && depth < RECURSION_LIMIT)
     {
-        if (!overread_check(b, 4))
-            return NULL;
-        
-        n |= SIZEBYTE << 24;
-        n |= SIZEBYTE << 16;
+        for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(obj); ++i)
+        {
+            if (!dcache_immutable(PyTuple_GET_ITEM(obj, i), depth + 1))
+                return false;
+        }
+
+        return true;
     }
-    case VARLEN_DT(DT_ARR_MEDIUM):
+
+    return false;
+}
+
+// Copy the lists and dicts in OBJ. Returns NULL without an exception set if OBJ holds objects that can't be cached
+static PyObject *dcache_copy(PyObject *obj, size_t depth)
+{
+    PyTypeObject *tp = Py_TYPE(obj);
+
+    if (dcache_immutable(obj, depth))
+        return Py_NewRef(obj);
+    
+    if (depth >= RECURSION_LIMIT)
+        return NULL;
+    
+    if (tp == &PyList_Type)
     {
-        if (!overread_check(b, 2))
+        const Py_ssize_t nitems = PyList_GET_SIZE(obj);
+        PyObject *copy = PyList_New(nitems);
+
+        if (!copy)
             return NULL;
         
-        n |= SIZEBYTE << 8;
-        n |= SIZEBYTE;
+        for (Py_ssize_t i = 0; i < nitems; ++i)
+        {
+            PyObject *item = dcache_copy(PyList_GET_ITEM(obj, i), depth + 1);
 
-        return create_array(b, n);
+            if (!item)
+            {
+                Py_DECREF(copy);
+                return NULL;
+            }
+
+            PyList_SET_ITEM(copy, i, item);
+        }
+
+        return copy;
     }
 
-    case VARLEN_DT(DT_MAP_LARGE):
+    if (tp == &PyDict_Type)
     {
-        if (!overread_check(b, 4))
+        PyObject *copy = PyDict_New();
+
+        if (!copy)
             return NULL;
         
-        n |= SIZEBYTE << 24;
-        n |= SIZEBYTE << 16;
+        Py_ssize_t pos = 0;
+        PyObject *key, *val;
+
+        // Keys are shared instead of copied, so only immutable keys can be cached. Hashable objects can still be mutable
+        while (PyDict_Next(obj, &pos, &key, &val))
+        {
+            if (!dcache_immutable(key, depth + 1))
+            {
+                Py_DECREF(copy);
+                return NULL;
+            }
+
+            PyObject *item = dcache_copy(val, depth + 1);
+
+            if (!item || PyDict_SetItem(copy, key, item) < 0)
+            {
+                Py_XDECREF(item);
+                Py_DECREF(copy);
+                return NULL;
+            }
+
+            Py_DECREF(item);
+        }
+
+        return copy;
     }
-    case VARLEN_DT(DT_MAP_MEDIUM):
+
+    return NULL;
+}
+
+// Get a new reference to the cached object of the message at DATA, or NULL if it's not cached
+static PyObject *dcache_lookup(dcache_t *cache, uint64_t hash, const char *data, size_t size)
+{
+    PyObject *result = NULL;
+
+    lock_flag(&cache->lock);
+
+    if (cache->nsets != 0)
     {
-        if (!overread_check(b, 2))
-            return NULL;
+        dcache_entry_t *set = cache->entries + (hash % cache->nsets) * DECODE_CACHE_WAYS;
 
-        n |= SIZEBYTE << 8;
-        n |= SIZEBYTE;
+        for (size_t i = 0; i < DECODE_CACHE_WAYS && set[i].encoded; ++i)
+        {
+            dcache_entry_t *entry = &set[i];
 
-        return create_map(b, n);
+            if (entry->hash != hash || (size_t)PyBytes_GET_SIZE(entry->encoded) != size ||
+                memcmp(PyBytes_AS_STRING(entry->encoded), data, size) != 0)
+                continue;
+            
+            result = Py_NewRef(entry->result);
+
+            // Move the entry to the front of its set
+            const dcache_entry_t hit = *entry;
+            memmove(set + 1, set, i * sizeof(dcache_entry_t));
+            set[0] = hit;
+
+            break;
+        }
+
+        if (result)
+            cache->hits++;
+        else
+            cache->misses++;
     }
 
-    case VARLEN_DT(DT_NIL):
+    unlock_flag(&cache->lock);
+
+    return result;
+}
+
+// Add an entry to the front of its set, evicting the least recently used entry of the set. Steals ENCODED and RESULT
+static void dcache_insert(dcache_t *cache, uint64_t hash, PyObject *encoded, PyObject *result)
+{
+    dcache_entry_t evicted = {0, encoded, result};
+
+    lock_flag(&cache->lock);
+
+    // The cache could have been disabled since the lookup
+    if (cache->nsets != 0)
     {
-        return Py_None;
+        dcache_entry_t *set = cache->entries + (hash % cache->nsets) * DECODE_CACHE_WAYS;
+
+        evicted = set[DECODE_CACHE_WAYS - 1];
+
+        memmove(set + 1, set, (DECODE_CACHE_WAYS - 1) * sizeof(dcache_entry_t));
+        set[0] = (dcache_entry_t){hash, encoded, result};
     }
-    case VARLEN_DT(DT_TRUE):
+
+    unlock_flag(&cache->lock);
+
+    Py_XDECREF(evicted.encoded);
+    Py_XDECREF(evicted.result);
+}
+
+
+////////////////////
+//  STREAM CLASS  //
+////////////////////
+
+static PyObject *Stream(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    mstates_t *states = get_mstates(self);
+
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+    PyObject *raw_depth = NULL;
+    PyObject *hash = NULL;
+    PyObject *shared_refs = Py_False;
+    PyObject *decode_cache = NULL;
+    PyObject *int_arrays = Py_False;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+        KEYARG(&raw_depth, &PyLong_Type, states->interned.raw_depth),
+        KEYARG(&hash, NULL, states->interned.hash),
+        KEYARG(&shared_refs, &PyBool_Type, states->interned.shared_refs),
+        KEYARG(&decode_cache, &PyLong_Type, states->interned.decode_cache),
+        KEYARG(&int_arrays, &PyBool_Type, states->interned.int_arrays),
+    };
+
+    if (!parse_keywords(0, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    size_t raw_depth_num = 0;
+    if (raw_depth && !parse_size_arg(raw_depth, "raw_depth", &raw_depth_num))
+        return NULL;
+    
+    size_t decode_cache_num = 0;
+    if (decode_cache && !parse_size_arg(decode_cache, "decode_cache", &decode_cache_num))
+        return NULL;
+    
+    if (shared_refs == Py_True && raw_depth_num != 0)
+        return error_refs_rawdepth();
+
+    cm_hash_t hash_alg;
+    if (!parse_hash_arg(hash, &hash_alg))
+        return NULL;
+
+
+    // Allocate the stream object based on if we got a file to use or not
+    stream_t *stream = PyObject_New(stream_t, &StreamObj);
+
+    if (!stream)
+        return PyErr_NoMemory();
+
+    // Set the object fields
+    stream->ext = ext;
+    stream->states = states;
+    stream->str_keys = str_keys == Py_True;
+    stream->raw_depth = raw_depth_num;
+    stream->hash = hash_alg;
+    stream->shared_refs = shared_refs == Py_True;
+    stream->int_arrays = int_arrays == Py_True;
+
+    stream->avg_item_size = AVG_ITEM_SIZE_DEFAULT;
+    stream->avg_fluctuation = AVG_FLUCTUATION_DEFAULT;
+
+    stream->cache.entries = NULL;
+    stream->cache.nsets = 0;
+    clear_flag(&stream->cache.lock);
+
+    // Keep a reference to the module
+    Py_INCREF(self);
+    stream->module = self;
+
+    // Keep a reference to the ext object
+    Py_INCREF(ext);
+
+    if (!dcache_resize(&stream->cache, decode_cache_num))
     {
-        return Py_True;
+        Py_DECREF(stream);
+        return NULL;
     }
-    case VARLEN_DT(DT_FALSE):
+
+    return (PyObject *)stream;
+}
+
+static void stream_dealloc(stream_t *stream)
+{
+    Py_DECREF(stream->module);
+    Py_DECREF(stream->ext);
+
+    dcache_free_entries(stream->cache.entries, stream->cache.nsets * DECODE_CACHE_WAYS);
+
+    PyObject_Del(stream);
+}
+
+static PyObject *stream_encode(stream_t *stream, PyObject *obj)
+{
+    PyObject *encoded = encoding_start(obj, stream->states, stream->ext, stream->str_keys, stream->shared_refs, stream->int_arrays, NULL, NULL, &stream->avg_item_size, &stream->avg_fluctuation);
+
+    return encoding_add_hash(encoded, stream->hash);
+}
+
+// Decode through the decode cache
+static PyObject *stream_decode_cached(stream_t *stream, PyObject *encoded)
+{
+    Py_buffer buf;
+    if (PyObject_GetBuffer(encoded, &buf, PyBUF_SIMPLE) < 0)
+        return NULL;
+    
+    if ((size_t)buf.len > DECODE_CACHE_MAXSIZE)
     {
-        return Py_False;
+        PyBuffer_Release(&buf);
+        return decoding_start(encoded, stream->states, stream->ext, stream->str_keys, stream->raw_depth, false, stream->int_arrays, NULL, NULL);
     }
 
-    case VARLEN_DT(DT_FLOAT_BIT32):
-    {
-        if (!overread_check(b, 4))
-            return NULL;
+    const uint64_t hash = cm_xxh64(buf.buf, (size_t)buf.len, 0);
+    PyObject *cached = dcache_lookup(&stream->cache, hash, buf.buf, (size_t)buf.len);
 
-        float num_float;
-        memcpy(&num_float, b->offset, 4);
-        b->offset += 4;
-        
-        // Use type promotion to convert to double
-        double num = (double)num_float;
+    if (cached)
+    {
+        PyBuffer_Release(&buf);
 
-        BIG_DOUBLE(num);
+        PyObject *result = dcache_copy(cached, 0);
+        Py_DECREF(cached);
 
-        return PyFloat_FromDouble(num);
+        return result;
     }
-    case VARLEN_DT(DT_FLOAT_BIT64):
-    {
-        if (!overread_check(b, 8))
-            return NULL;
 
-        double num;
-        memcpy(&num, b->offset, 8);
-        b->offset += 8;
+    PyObject *result = decoding_start(encoded, stream->states, stream->ext, stream->str_keys, stream->raw_depth, false, stream->int_arrays, NULL, NULL);
 
-        BIG_DOUBLE(num);
+    if (result)
+    {
+        PyObject *copy = dcache_copy(result, 0);
+        PyObject *key = copy ? PyBytes_FromStringAndSize(buf.buf, buf.len) : NULL;
 
-        return PyFloat_FromDouble(num);
+        if (key)
+            dcache_insert(&stream->cache, hash, key, copy);
+        else
+            Py_XDECREF(copy);
+        
+        // Failing to cache the object doesn't affect the result
+        PyErr_Clear();
     }
 
-    case VARLEN_DT(DT_BIN_LARGE):
-    {
-        if (!overread_check(b, 4))
-            return NULL;
+    PyBuffer_Release(&buf);
+    return result;
+}
 
-        n |= SIZEBYTE << 24;
-        n |= SIZEBYTE << 16;
-    }
-    case VARLEN_DT(DT_BIN_MEDIUM):
-    {
-        if (!overread_check(b, 2))
-            return NULL;
+static PyObject *stream_decode(stream_t *stream, PyObject *encoded)
+{
+    if (stream->shared_refs && stream->raw_depth != 0)
+        return error_refs_rawdepth();
+    
+    // Copies of cached objects wouldn't keep the shared identity of containers
+    if (stream->cache.nsets != 0 && !stream->shared_refs)
+        return stream_decode_cached(stream, encoded);
 
-        n |= SIZEBYTE << 8;
-    }
-    case VARLEN_DT(DT_BIN_SMALL):
-    {
-        if (!overread_check(b, 1))
-            return NULL;
+    return decoding_start(encoded, stream->states, stream->ext, stream->str_keys, stream->raw_depth, stream->shared_refs, stream->int_arrays, NULL, NULL);
+}
 
-        n |= SIZEBYTE;
+static PyObject *stream_get_strkey(stream_t *stream, void *closure)
+{
+    return stream->str_keys == true ? Py_True : Py_False;
+}
 
-        if (!overread_check(b, n))
-            return NULL;
+static PyObject *stream_get_rawdepth(stream_t *stream, void *closure)
+{
+    return PyLong_FromSize_t(stream->raw_depth);
+}
 
-        PyObject *obj = PyBytes_FromStringAndSize(b->offset, n);
-        b->offset += n;
+static PyObject *stream_get_hash(stream_t *stream, void *closure)
+{
+    return hash_name(stream->hash);
+}
 
-        return obj;
-    }
+static PyObject *stream_get_sharedrefs(stream_t *stream, void *closure)
+{
+    return PyBool_FromLong(stream->shared_refs);
+}
 
-    case VARLEN_DT(DT_EXT_FIX1):
-    {
-        n = 1;
-        goto ext_handling;
-    }
-    case VARLEN_DT(DT_EXT_FIX2):
-    {
-        n = 2;
-        goto ext_handling;
-    }
-    case VARLEN_DT(DT_EXT_FIX4):
-    {
-        n = 4;
-        goto ext_handling;
-    }
-    case VARLEN_DT(DT_EXT_FIX8):
-    {
-        n = 8;
-        goto ext_handling;
-    }
-    case VARLEN_DT(DT_EXT_FIX16):
-    {
-        n = 16;
-        goto ext_handling;
-    }
+static PyObject *stream_get_intarrays(stream_t *stream, void *closure)
+{
+    return PyBool_FromLong(stream->int_arrays);
+}
 
-    case VARLEN_DT(DT_EXT_LARGE):
-    {
-        if (!overread_check(b, 4))
-            return NULL;
-            
-        n |= SIZEBYTE << 24;
-        n |= SIZEBYTE << 16;
-    }
-    case VARLEN_DT(DT_EXT_MEDIUM):
-    {
-        if (!overread_check(b, 2))
-            return NULL;
+static PyObject *stream_get_extensions(stream_t *stream, void *closure)
+{
+    PyObject *ext = stream->ext;
 
-        n |= SIZEBYTE << 8;
-    }
-    case VARLEN_DT(DT_EXT_SMALL):
-    {
-        if (!overread_check(b, 1))
-            return NULL;
+    Py_INCREF(ext);
+    return ext;
+}
 
-        n |= SIZEBYTE;
+static PyObject *stream_get_decodecache(stream_t *stream, void *closure)
+{
+    return PyLong_FromSize_t(stream->cache.nsets * DECODE_CACHE_WAYS);
+}
 
-        ext_handling: // Jump label for fixsize cases
-        NULL; // No-op statement for pre-C23 standards (declarations not allowed after labels)
+static PyObject *stream_get_cachestats(stream_t *stream, void *closure)
+{
+    dcache_t *cache = &stream->cache;
 
-        if (!overread_check(b, 1 + n))
-            return NULL;
+    lock_flag(&cache->lock);
 
-        const char id = SIZEBYTE;
+    const uint64_t hits = cache->hits;
+    const uint64_t misses = cache->misses;
+    const size_t capacity = cache->nsets * DECODE_CACHE_WAYS;
 
-        PyObject *obj = attempt_decode_ext(b, b->offset, n, id);
-        b->offset += n;
+    size_t size = 0;
+    for (size_t i = 0; i < capacity; ++i)
+        size += cache->entries[i].encoded != NULL;
+    
+    unlock_flag(&cache->lock);
 
-        if (obj == NULL)
-        {
-            if (!PyErr_Occurred())
-                PyErr_Format(PyExc_ValueError, "Failed to match an extension type with ID %i", id);
-            
-            return NULL;
-        }
+    return Py_BuildValue("{s:K,s:K,s:n,s:n}", "hits", (unsigned long long)hits, "misses", (unsigned long long)misses,
+        "size", (Py_ssize_t)size, "capacity", (Py_ssize_t)capacity);
+}
 
-        return obj;
-    }
+static int stream_set_strkey(stream_t *stream, PyObject *arg, void *closure)
+{
+    stream->str_keys = arg == Py_True;
+    return dcache_clear(&stream->cache) ? 0 : -1;
+}
 
-    default:
+static int stream_set_rawdepth(stream_t *stream, PyObject *arg, void *closure)
+{
+    if (Py_TYPE(arg) != &PyLong_Type)
     {
-        return PyErr_Format(PyExc_ValueError, "Got an invalid header (0x%02X) while decoding data", mask);
-    }
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
     }
+
+    if (!parse_size_arg(arg, "raw_depth", &stream->raw_depth))
+        return -1;
+
+    return dcache_clear(&stream->cache) ? 0 : -1;
 }
 
-static PyObject *decode_bytes(buffer_t *b)
+static int stream_set_hash(stream_t *stream, PyObject *arg, void *closure)
 {
-    // Check if it's safe to read the mask
-    if (!overread_check(b, 1))
-            return NULL;
+    return parse_hash_arg(arg, &stream->hash) ? 0 : -1;
+}
 
-    // The mask is stored on the next byte
-    const unsigned char mask = SIZEBYTE;
+static int stream_set_sharedrefs(stream_t *stream, PyObject *arg, void *closure)
+{
+    stream->shared_refs = arg == Py_True;
+    return 0;
+}
 
-    // Only fixsize values don't have `110` set on the upper 3 mask bits
-    if ((mask & 224) != 192)
+static int stream_set_intarrays(stream_t *stream, PyObject *arg, void *closure)
+{
+    stream->int_arrays = arg == Py_True;
+    return dcache_clear(&stream->cache) ? 0 : -1;
+}
+
+static int stream_set_extensions(stream_t *stream, PyObject *arg, void *closure)
+{
+    if (Py_TYPE(arg) != &ExtensionsObj)
     {
-        return decode_bytes_fixsize(b, mask);
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'cmsgpack.Extensions', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
     }
-    else
+    
+    Py_DECREF(stream->ext);
+    Py_INCREF(arg);
+
+    stream->ext = arg;
+    return dcache_clear(&stream->cache) ? 0 : -1;
+}
+
+static int stream_set_decodecache(stream_t *stream, PyObject *arg, void *closure)
+{
+    if (Py_TYPE(arg) != &PyLong_Type)
     {
-        // Otherwise, it's a varlen object
-        return decode_bytes_varlen(b, mask);
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
     }
-}
 
+    size_t capacity;
+    if (!parse_size_arg(arg, "decode_cache", &capacity))
+        return -1;
+    
+    return dcache_resize(&stream->cache, capacity) ? 0 : -1;
+}
 
-///////////////////////////
-//  ADAPTIVE ALLOCATION  //
-///////////////////////////
 
-// Global averages, made thread-local for thread safety
-_Thread_local double avg_item_size = AVG_ITEM_SIZE_DEFAULT;
-_Thread_local double avg_fluctuation = AVG_FLUCTUATION_DEFAULT;
+/////////////////////////
+//  FILE STREAM CLASS  //
+/////////////////////////
 
-static _always_inline void update_adaptive_allocation(buffer_t *b, size_t nitems, double *_avg_item_size, double *_avg_fluctuation)
+static bool filestream_setup_fdata(filestream_t *stream, PyObject *filename, PyObject *reading_offset, PyObject *chunk_size)
 {
-    if (nitems == 0)
-        return;
-    
-    double avg_item_size = *_avg_item_size;
-    double avg_fluctuation = *_avg_fluctuation;
 
-    double used  = (double)(b->offset - PyBytes_AS_STRING(b->base)) / nitems;
-    double extra = (double)(b->maxoffset - b->offset) / nitems;
+    // Get the filename data if we got a filename object
+    size_t fname_size;
+    const char *fname = PyUnicode_AsUTF8AndSize(filename, (Py_ssize_t *)&fname_size);
 
-    double fluctuation = extra / used;
+    // Allocate the filename buffer
+    stream->fname = (char *)malloc(fname_size + 1);
 
-    if (used < avg_item_size)
-    {
-        avg_item_size = ((avg_item_size * 3) + used) / 4;
-    }
-    else
+    if (!stream->fname)
+        return PyErr_NoMemory();
+
+    // Copy the filename into the object and NULL-terminate it
+    memcpy(stream->fname, fname, fname_size);
+    stream->fname[fname_size] = 0;
+
+    // Decide the file buffer's size
+    stream->fbuf_size = FILEBUF_DEFAULTSIZE;
+    if (chunk_size)
     {
-        avg_item_size = (avg_item_size + (used * 2)) / 3;
-    }
+        int overflow = 0;
+        stream->fbuf_size = PyLong_AsLongLongAndOverflow(chunk_size, &overflow);
 
-    avg_fluctuation = ((avg_fluctuation * 3) + fluctuation) / 4;
+        if (overflow != 0)
+        {
+            free(stream->fname);
 
-    // Ensure a minimum avg size of 6
-    if (avg_item_size < 6)
-        avg_item_size = 6;
-    
-    // Ensure a maximum avg fluctuation of 0.8
-    if (avg_fluctuation > 0.8)
-        avg_fluctuation = 0.8;
-    
-    *_avg_item_size = avg_item_size;
-    *_avg_fluctuation = avg_fluctuation;
-}
+            PyErr_SetString(PyExc_ValueError, "The value of argument 'chunk_size' exceeded the 64-bit integer limit");
+            return false;
+        }
 
+        // Check if the number wasn't negative
+        if ((ssize_t)(stream->fbuf_size) < 0)
+        {
+            free(stream->fname);
+            
+            PyErr_SetString(PyExc_ValueError, "The value of argument 'chunk_size' was smaller than 0, but must be positive");
+            return false;
+        }
+    }
 
-/////////////////////
-//  ENC/DEC START  //
-/////////////////////
+    stream->chunk_size = stream->fbuf_size;
 
-static _always_inline PyObject *encoding_write_file(buffer_t *b, filestream_t *fstream, size_t datasize)
-{
-    // Write the data to the file
-    size_t written;
-    Py_BEGIN_ALLOW_THREADS
-        written = fwrite(PyBytes_AS_STRING(b->base), 1, datasize, fstream->file);
-    Py_END_ALLOW_THREADS
+    // Allocate the file buffer for decoding
+    stream->fbuf = (char *)PyMem_RawMalloc(stream->fbuf_size);
 
-    // Remove reference to the bytes object as we won't return it
-    Py_DECREF(b->base);
+    if (!stream->fbuf)
+    {
+        free(stream->fname);
+        return PyErr_NoMemory();
+    }
 
-    // Check if all data was written
-    if (written != datasize)
+    // Get the file offset
+    stream->foff = 0;
+    if (reading_offset)
     {
-        // Get the errno
-        const int err = errno;
+        int overflow = 0;
+        stream->foff = PyLong_AsLongLongAndOverflow(reading_offset, &overflow);
 
-        // Check if anything was written and otherwise attempt to truncate the file
-        size_t start_offset = ftell(fstream->file) - written; // The offset before the written data
-        if (written == 0 || _ftruncate(fstream->file, start_offset))
+        if (overflow != 0)
         {
-            PyErr_Format(PyExc_OSError, "Attempted to write encoded data, but no data was written."
-                "\n\tErrno %i: %s", err, strerror(err));
+            PyMem_RawFree(stream->fbuf);
+            free(stream->fname);
+            
+            PyErr_SetString(PyExc_ValueError, "The value of argument 'reading_offset' exceeded the 64-bit integer limit");
+            return false;
         }
-        else
+
+        // Check if the number wasn't negative
+        if ((ssize_t)(stream->foff) < 0)
         {
-            PyErr_Format(PyExc_OSError, "Attempted to write encoded data, but the write could not be completed and truncation failed. "
-                "Incomplete data was written on position %zu, and %zu bytes were written."
-                "\n\tErrno %i: %s", start_offset, written, err, strerror(err));
+            PyMem_RawFree(stream->fbuf);
+            free(stream->fname);
+            
+            PyErr_SetString(PyExc_ValueError, "The value of argument 'reading_offset' was smaller than 0, but must be positive");
+            return false;
         }
-
-        return NULL;
     }
 
-    Py_RETURN_NONE;
-}
+    // Attempt to open the file
+    stream->file = fopen(stream->fname, "a+b");
 
-static _always_inline PyObject *encoding_start(PyObject *obj, mstates_t *states, PyObject *ext, bool str_keys, filestream_t *fstream, double *avg_item_size, double *avg_fluctuation)
-{
-    buffer_t b;
+    if (!stream->file)
+    {
+        PyMem_RawFree(stream->fbuf);
+        free(stream->fname);
 
-    // Assign non-buffer fields (not filedata, that's not used for encoding)
-    b.ext = ((extensions_t *)ext)->data;
-    b.str_keys = str_keys;
-    b.states = states;
-    b.recursion = 0;
+        const int err = errno;
+        return error_cannot_open_file(fname, err);
+    }
 
-    // This will hold the number of items of the object if it's a container type
-    size_t nitems = 0;
+    // Disable file buffering as we already read/write in a chunk-like manner
+    setbuf(stream->file, NULL);
 
-    // This will hold the size of the allocated buffer
-    size_t buffersize;
+    return true;
+}
 
-    // Check if the object is a list/tuple/dict for adaptive allocation
-    if (PyList_Check(obj) || PyTuple_Check(obj) || PyDict_Check(obj))
-    {
-        // Set the fluctuation weight to at least 0.15
-        double fluctuation_weight = *avg_fluctuation < 0.15 ? 0.15 : *avg_fluctuation;
+static PyObject *FileStream(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    mstates_t *states = get_mstates(self);
 
-        nitems = Py_SIZE(obj);
+    PyObject *reading_offset = NULL;
+    PyObject *chunk_size = NULL;
+    PyObject *filename = NULL;
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+    PyObject *sync_records = NULL;
+    PyObject *sync_ms = NULL;
+    PyObject *direct_io = Py_False;
 
-        // Add the fluctuation weight to allow headroom for fluctuations in data size, and add 1 to ensure it's not zero
-        buffersize = (*avg_item_size * nitems * (1.0 + fluctuation_weight)) + 1;
+    keyarg_t keyargs[] = {
+        KEYARG(&filename, &PyUnicode_Type, states->interned.file_name),
+        KEYARG(&reading_offset, &PyLong_Type, states->interned.reading_offset),
+        KEYARG(&chunk_size, &PyLong_Type, states->interned.chunk_size),
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+        KEYARG(&sync_records, &PyLong_Type, states->interned.sync_records),
+        KEYARG(&sync_ms, &PyLong_Type, states->interned.sync_ms),
+        KEYARG(&direct_io, &PyBool_Type, states->interned.direct_io),
+    };
 
-        b.base = (char *)PyBytes_FromStringAndSize(NULL, buffersize);
+    if (!parse_keywords(0, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
 
-        // Do a flat allocation if we couldn't allocate with this
-        if (!b.base)
-            goto flat_alloc;
-    }
-    else
-    {
-        flat_alloc:
+    size_t sync_records_num = 0;
+    size_t sync_ms_num = 0;
 
-        buffersize = 256;
-        b.base = (char *)PyBytes_FromStringAndSize(NULL, buffersize);
+    if (sync_records && !parse_size_arg(sync_records, "sync_records", &sync_records_num))
+        return NULL;
 
-        if (!b.base)
-            return PyErr_NoMemory();
-    }
-    
-    // Set the offset and max offset
-    b.offset = PyBytes_AS_STRING(b.base);
-    b.maxoffset = b.offset + buffersize;
+    if (sync_ms && !parse_size_arg(sync_ms, "sync_ms", &sync_ms_num))
+        return NULL;
 
-    // Attempt to encode the object
-    if (!encode_object_inline(&b, obj))
+    // Check if we got the filename argument
+    if (!filename)
     {
-        Py_DECREF(b.base);
+        PyErr_SetString(PyExc_TypeError, "Did not receive mandatory argument 'file_name'");
         return NULL;
     }
-    
-    // Calculate the size of the encoded data
-    size_t datasize = (size_t)(b.offset - PyBytes_AS_STRING(b.base));
-    Py_SET_SIZE(b.base, datasize);
 
-    // Update the adaptive allocation
-    update_adaptive_allocation(&b, nitems, avg_item_size, avg_fluctuation);
-
-    // If not streaming, just return the object
-    if (!fstream)
-        return (PyObject *)b.base;
 
-    // Otherwise, write the data to the file
-    return encoding_write_file(&b, fstream, datasize);
-}
+    filestream_t *stream = PyObject_New(filestream_t, &FileStreamObj);
 
-// Start a decoding run
-static _always_inline PyObject *decoding_start(PyObject *encoded, mstates_t *states, PyObject *ext, bool str_keys, filestream_t *fstream)
-{
-    buffer_t b;
+    if (!stream)
+        return PyErr_NoMemory();
 
-    // Assign non-buffer fields
-    b.ext = ((extensions_t *)ext)->data;
-    b.str_keys = str_keys;
-    b.states = states;
+    stream->sync_lock = PyThread_allocate_lock();
+    stream->write_lock = PyThread_allocate_lock();
+    stream->write_owner = 0;
 
-    // Simply decode and return if not file streaming
-    if (!fstream)
+    if (!stream->sync_lock || !stream->write_lock)
     {
-        // Set the file to NULL for overread checks
-        b.file = NULL;
+        if (stream->sync_lock)
+            PyThread_free_lock(stream->sync_lock);
+        if (stream->write_lock)
+            PyThread_free_lock(stream->write_lock);
 
-        // Get the buffer of the object
-        Py_buffer buf;
-        if (PyObject_GetBuffer(encoded, &buf, PyBUF_SIMPLE) < 0)
-            return NULL;
-        
-        // Set the buffer fields (base not used for regular decoding)
-        b.offset = buf.buf;
-        b.maxoffset = (char *)buf.buf + buf.len;
-        
-        // Decode the data
-        PyObject *result = decode_bytes(&b);
+        PyObject_Del(stream);
+        return PyErr_NoMemory();
+    }
+    
+    // Set the file data
+    if (!filestream_setup_fdata(stream, filename, reading_offset, chunk_size))
+    {
+        PyThread_free_lock(stream->sync_lock);
+        PyThread_free_lock(stream->write_lock);
+        PyObject_Del(stream);
+        return NULL;
+    }
 
-        // Release the buffer
-        PyBuffer_Release(&buf);
+    // Set up direct I/O if requested
+    stream->direct_io = direct_io == Py_True;
+    stream->dio.fd = -1;
+    stream->dio.buf = NULL;
 
-        // Check if we reached the end of the buffer
-        if (result != NULL && b.offset != b.maxoffset)
-        {
-            PyErr_SetString(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
-            return NULL;
-        }
+    if (stream->direct_io && !filestream_enable_directio(stream))
+    {
+        PyMem_RawFree(stream->fbuf);
+        free(stream->fname);
+        fclose(stream->file);
 
-        return result;
+        PyThread_free_lock(stream->sync_lock);
+        PyThread_free_lock(stream->write_lock);
+        PyObject_Del(stream);
+        return NULL;
     }
 
-    // This path is reached when file streaming
+    // Set the durability policy
+    stream->written_seq = 0;
+    stream->durable_seq = 0;
+    stream->sync_records = sync_records_num;
+    stream->sync_ns = (uint64_t)sync_ms_num * 1000000;
+    stream->last_sync = _monotonic_ns();
 
-    // Assign the file-related fields (maxoffset is assigned based on how many bytes are read later)
-    b.fbuf_size = fstream->fbuf_size;
-    b.file = fstream->file;
-    b.base = fstream->fbuf;
-    b.offset = b.base;
-    
-    // Seek the file to the current offset
-    fseek(b.file, fstream->foff, SEEK_SET);
+    // Set the object fields
+    stream->ext = ext;
+    stream->states = states;
+    stream->str_keys = str_keys == Py_True;
 
-    // Read data from the file into the buffer
-    size_t read = fread(b.base, 1, b.fbuf_size, b.file);
-    b.maxoffset = b.base + read; // Set the max buffer offset based on how much data we read
+    stream->iterating = NULL;
 
-    // Decode the read data
-    PyObject *result = decode_bytes(&b);
+    stream->avg_item_size = AVG_ITEM_SIZE_DEFAULT;
+    stream->avg_fluctuation = AVG_FLUCTUATION_DEFAULT;
 
-    // Calculate up to where we had to read from the file (up until the data of the next encoded data block)
-    size_t end_offset = ftell(b.file);
-    size_t buffer_unused = (size_t)(b.maxoffset - b.offset);
-    size_t new_offset = end_offset - buffer_unused;
-    fstream->foff = new_offset; // Update the reading offset
+    // Keep a reference to the module
+    Py_INCREF(self);
+    stream->module = self;
 
-    // Update the file buffer address and size
-    fstream->fbuf = b.base;
-    fstream->fbuf_size = b.fbuf_size;
+    // Keep a reference to the ext object
+    Py_INCREF(ext);
 
-    return result;
+    return (PyObject *)stream;
 }
 
-// Expand the encoding buffer when it doesn't have enough space
-static bool encoding_expand_buffer(buffer_t *b, size_t required)
+static void filestream_dealloc(filestream_t *stream)
 {
-    // Scale the size by a factor of 1.5
-    const size_t allocsize = ((size_t)(b->offset - PyBytes_AS_STRING(b->base)) + required) * 1.5;
+    // Free the file buffer and file name, and close the file
+    PyMem_RawFree(stream->fbuf);
+    if (stream->direct_io)
+        filestream_disable_directio(stream);
 
-    // Reallocate the object (also allocate space for the bytes object itself)
-    char *reallocd = PyObject_Realloc(b->base, allocsize + sizeof(PyBytesObject));
+    free(stream->fname);
+    fclose(stream->file);
 
-    if (reallocd == NULL)
-    {
-        PyErr_NoMemory();
-        return false;
-    }
+    PyThread_free_lock(stream->sync_lock);
+    PyThread_free_lock(stream->write_lock);
 
-    // Update the offsets
-    b->offset = PyBytes_AS_STRING(reallocd) + (size_t)(b->offset - PyBytes_AS_STRING(b->base));
-    b->maxoffset = PyBytes_AS_STRING(reallocd) + allocsize;
-    b->base = reallocd;
+    Py_DECREF(stream->module);
+    Py_DECREF(stream->ext);
 
-    return true;
+    PyObject_Del(stream);
 }
 
-// Refresh the file buffer with new data while decoding
-static bool decoding_refresh_fbuf(buffer_t *b, size_t required)
+// Sync all written records to disk, unless a sync that finished while we waited for the lock already covered SEQ
+static bool filestream_sync_to(filestream_t *stream, uint64_t seq)
 {
-    // Calculate how much from the buffer is unused
-    size_t unused = (size_t)(b->maxoffset - b->offset);
-
-    // Move the unused data to the start of the buffer
-    memmove(b->base, b->offset, unused);
-
-    // Check if the required size exceeds the buffer size
-    if (required > b->fbuf_size)
+    // Wait for syncs in progress, without holding the GIL so that the syncing thread can finish
+    if (!PyThread_acquire_lock(stream->sync_lock, NOWAIT_LOCK))
     {
-        size_t newsize = required * 1.2;
-        char *fbuf = (char *)realloc(b->base, newsize);
-
-        if (!fbuf)
-            return PyErr_NoMemory();
-        
-        b->base = fbuf;
-        b->fbuf_size = newsize;
+        Py_BEGIN_ALLOW_THREADS
+            PyThread_acquire_lock(stream->sync_lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
     }
 
-    // Read new data into the buffer above the unused data
-    size_t read;
-    Py_BEGIN_ALLOW_THREADS
-        read = fread(b->base + unused, 1, b->fbuf_size - unused, b->file);
-    Py_END_ALLOW_THREADS
+    bool success = true;
 
-    // Check if we have less data than required, meaning we reached EOF
-    if (read + unused < required)
+    if (stream->durable_seq < seq)
     {
-        PyErr_SetString(PyExc_EOFError, "Reached EOF before finishing the decoding run");
-        return false;
-    }
-
-    // Update the offsets
-    b->offset = b->base;
-    b->maxoffset = b->base + unused + read;
-
-    return true;
-}
+        // Everything written up to now is covered by this sync
+        const uint64_t covered = stream->written_seq;
 
-// Ensure enough space is in the encoding buffer
-static _always_inline bool ensure_space(buffer_t *b, size_t required)
-{
-    if (b->offset + required >= b->maxoffset)
-        return encoding_expand_buffer(b, required);
-    
-    return true;
-}
+        bool failed;
+        Py_BEGIN_ALLOW_THREADS
+            failed = fflush(stream->file) != 0 || _fdatasync(stream->file);
+        Py_END_ALLOW_THREADS
 
-// Check if we aren't overreading the buffer when reading REQUIRED bytes
-static _always_inline bool overread_check(buffer_t *b, size_t required)
-{
-    // Check if the offset would exceed the max offset
-    if (b->offset + required > b->maxoffset)
-    {
-        // If we have a file, we need to refresh the file buffer
-        if (b->file)
+        if (failed)
         {
-            return decoding_refresh_fbuf(b, required);
+            const int err = errno;
+            PyErr_Format(PyExc_OSError, "Attempted to sync written data to disk, but the sync failed."
+                "\n\tErrno %i: %s", err, strerror(err));
+
+            success = false;
         }
         else
-        {
-            // Otherwise, we'll overread the data, so set an exception
-            PyErr_SetString(PyExc_ValueError, "Received incomplete encoded data, the buffer ended before the encoded data pattern ended");
-            return false;
+        {
+            stream->durable_seq = covered;
+            stream->last_sync = _monotonic_ns();
         }
     }
 
-    return true;
-}
+    PyThread_release_lock(stream->sync_lock);
 
+    return success;
+}
 
-/////////////////////
-//  BASIC ENC/DEC  //
-/////////////////////
+static PyObject *filestream_encode(filestream_t *stream, PyObject *obj)
+{
+    // Returns the sequence number of the record, which is assigned (and synced if required) while writing it
+    return encoding_start(obj, stream->states, stream->ext, stream->str_keys, false, false, NULL, stream, &stream->avg_item_size, &stream->avg_fluctuation);
+}
 
-static PyObject *encode(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+static PyObject *filestream_sync(filestream_t *stream, PyObject **args, Py_ssize_t nargs)
 {
-    const Py_ssize_t npositional = 1;
-    if (!min_positional(nargs, npositional))
-        return NULL;
+    if (nargs > 1)
+        return PyErr_Format(PyExc_TypeError, "Expected at most 1 argument, but got %zi", nargs);
 
-    PyObject *obj = parse_positional(args, 0, NULL, "obj");
+    // Sync up to the last written record by default
+    uint64_t seq = stream->written_seq;
 
-    if (!obj)
-        return NULL;
+    if (nargs == 1 && args[0] != Py_None)
+    {
+        if (!PyLong_CheckExact(args[0]))
+            return error_unexpected_argtype("seq", "int", Py_TYPE(args[0])->tp_name);
 
-    mstates_t *states = get_mstates(self);
+        size_t num;
+        if (!parse_size_arg(args[0], "seq", &num))
+            return NULL;
 
-    PyObject *str_keys = Py_False;
-    PyObject *ext = (PyObject *)&states->extensions;
+        if (num > stream->written_seq)
+            return PyErr_Format(PyExc_ValueError, "Sequence number %zu was not written yet, the last written sequence number is %llu", num, (unsigned long long)stream->written_seq);
 
-    keyarg_t keyargs[] = {
-        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
-        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
-    };
+        seq = num;
+    }
 
-    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+    if (!filestream_sync_to(stream, seq))
         return NULL;
 
-    return encoding_start(obj, states, ext, str_keys == Py_True, NULL, &avg_item_size, &avg_fluctuation);
+    return PyLong_FromUnsignedLongLong(stream->durable_seq);
 }
 
-static PyObject *decode(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+// Check that no item iterator is reading the file, as reading records in between its items would move the reading offset under it
+static bool filestream_check_iterating(filestream_t *stream)
 {
-    const Py_ssize_t npositional = 1;
-    if (!min_positional(nargs, npositional))
-        return NULL;
+    if (stream->iterating)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to read from the file while an item iterator over it is still active");
+        return false;
+    }
 
-    PyObject *encoded = parse_positional(args, 0, NULL, "encoded");
+    return true;
+}
 
-    if (!encoded)
+static PyObject *filestream_decode(filestream_t *stream)
+{
+    if (!filestream_check_iterating(stream))
         return NULL;
 
-    mstates_t *states = get_mstates(self);
+    return decoding_start(NULL, stream->states, stream->ext, stream->str_keys, 0, false, false, NULL, stream);
+}
 
-    PyObject *str_keys = Py_False;
-    PyObject *ext = (PyObject *)&states->extensions;
+static PyObject *filestream_get_readingoffset(filestream_t *stream, void *closure)
+{
+    PyObject *num = PyLong_FromLongLong(stream->foff);
 
-    keyarg_t keyargs[] = {
-        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
-        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
-    };
+    if (!num)
+        return PyErr_NoMemory();
+    
+    return num;
+}
 
-    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
-        return NULL;
+static PyObject *filestream_get_chunksize(filestream_t *stream, void *closure)
+{
+    PyObject *num = PyLong_FromLongLong(stream->chunk_size);
 
-    return decoding_start(encoded, states, ext, str_keys == Py_True, NULL);
+    if (!num)
+        return PyErr_NoMemory();
+    
+    return num;
 }
 
-////////////////////
-//  STREAM CLASS  //
-////////////////////
-
-static PyObject *Stream(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+static PyObject *filestream_get_directio(filestream_t *stream, void *closure)
 {
-    mstates_t *states = get_mstates(self);
-
-    PyObject *str_keys = Py_False;
-    PyObject *ext = (PyObject *)&states->extensions;
+    return stream->direct_io == true ? Py_True : Py_False;
+}
 
-    keyarg_t keyargs[] = {
-        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
-        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
-    };
+static PyObject *filestream_get_durableseq(filestream_t *stream, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(stream->durable_seq);
+}
 
-    if (!parse_keywords(0, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
-        return NULL;
+static PyObject *filestream_get_syncrecords(filestream_t *stream, void *closure)
+{
+    return PyLong_FromSize_t(stream->sync_records);
+}
 
+static PyObject *filestream_get_syncms(filestream_t *stream, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(stream->sync_ns / 1000000);
+}
 
-    // Allocate the stream object based on if we got a file to use or not
-    stream_t *stream = PyObject_New(stream_t, &StreamObj);
+static PyObject *filestream_get_strkey(filestream_t *stream, void *closure)
+{
+    return stream->str_keys == true ? Py_True : Py_False;
+}
 
-    if (!stream)
-        return PyErr_NoMemory();
+static PyObject *filestream_get_extensions(filestream_t *stream, void *closure)
+{
+    PyObject *ext = stream->ext;
 
-    // Set the object fields
-    stream->ext = ext;
-    stream->states = states;
-    stream->str_keys = str_keys == Py_True;
+    Py_INCREF(ext);
+    return ext;
+}
 
-    stream->avg_item_size = AVG_ITEM_SIZE_DEFAULT;
-    stream->avg_fluctuation = AVG_FLUCTUATION_DEFAULT;
+static int filestream_set_readingoffset(filestream_t *stream, PyObject *arg, void *closure)
+{
+    if (Py_TYPE(arg) != &PyLong_Type)
+    {
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
+    }
+    
+    int overflow = 0;
+    long num = PyLong_AsLongAndOverflow(arg, &overflow);
 
-    // Keep a reference to the module
-    Py_INCREF(self);
-    stream->module = self;
+    if (overflow)
+    {
+        PyErr_SetString(PyExc_ValueError, "Got an integer that exceeded the system word size");
+        return -1;
+    }
 
-    // Keep a reference to the ext object
-    Py_INCREF(ext);
+    if (!filestream_check_iterating(stream))
+        return -1;
 
-    return (PyObject *)stream;
+    stream->foff = num;
+    return 0;
 }
 
-static void stream_dealloc(stream_t *stream)
+static int filestream_set_chunksize(filestream_t *stream, PyObject *arg, void *closure)
 {
-    Py_DECREF(stream->module);
-    Py_DECREF(stream->ext);
+    if (Py_TYPE(arg) != &PyLong_Type)
+    {
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
+    }
+    
+    int overflow = 0;
+    long num = PyLong_AsLongAndOverflow(arg, &overflow);
 
-    PyObject_Del(stream);
-}
+    if (overflow)
+    {
+        PyErr_SetString(PyExc_ValueError, "Got an integer that exceeded the system word size");
+        return -1;
+    }
 
-static PyObject *stream_encode(stream_t *stream, PyObject *obj)
-{
-    return encoding_start(obj, stream->states, stream->ext, stream->str_keys, NULL, &stream->avg_item_size, &stream->avg_fluctuation);
+    if (num < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "The value of argument 'chunk_size' was smaller than 0, but must be positive");
+        return -1;
+    }
+
+    char *newbuf = (char *)PyMem_RawMalloc(num);
+
+    if (!newbuf)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    
+    PyMem_RawFree(stream->fbuf);
+    
+    stream->fbuf = newbuf;
+    stream->fbuf_size = num;
+    stream->chunk_size = num;
+
+    return 0;
 }
 
-static PyObject *stream_decode(stream_t *stream, PyObject *encoded)
+static int filestream_set_directio(filestream_t *stream, PyObject *arg, void *closure)
 {
-    return decoding_start(encoded, stream->states, stream->ext, stream->str_keys, NULL);
+    const bool direct_io = arg == Py_True;
+
+    if (direct_io == stream->direct_io)
+        return 0;
+
+    if (direct_io)
+    {
+        if (!filestream_enable_directio(stream))
+            return -1;
+    }
+    else
+    {
+        filestream_disable_directio(stream);
+    }
+
+    stream->direct_io = direct_io;
+    return 0;
 }
 
-static PyObject *stream_get_strkey(stream_t *stream, void *closure)
+static int filestream_set_syncrecords(filestream_t *stream, PyObject *arg, void *closure)
 {
-    return stream->str_keys == true ? Py_True : Py_False;
+    if (Py_TYPE(arg) != &PyLong_Type)
+    {
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
+    }
+
+    if (!parse_size_arg(arg, "sync_records", &stream->sync_records))
+        return -1;
+
+    return 0;
 }
 
-static PyObject *stream_get_extensions(stream_t *stream, void *closure)
+static int filestream_set_syncms(filestream_t *stream, PyObject *arg, void *closure)
 {
-    PyObject *ext = stream->ext;
+    if (Py_TYPE(arg) != &PyLong_Type)
+    {
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
+    }
 
-    Py_INCREF(ext);
-    return ext;
+    size_t num;
+    if (!parse_size_arg(arg, "sync_ms", &num))
+        return -1;
+
+    stream->sync_ns = (uint64_t)num * 1000000;
+    return 0;
 }
 
-static PyObject *stream_set_strkey(stream_t *stream, PyObject *arg, void *closure)
+static int filestream_set_strkey(filestream_t *stream, PyObject *arg, void *closure)
 {
     stream->str_keys = arg == Py_True;
-    Py_RETURN_NONE;
+    return 0;
 }
 
-static PyObject *stream_set_extensions(stream_t *stream, PyObject *arg, void *closure)
+static int filestream_set_extensions(filestream_t *stream, PyObject *arg, void *closure)
 {
     if (Py_TYPE(arg) != &ExtensionsObj)
-        return PyErr_Format(PyExc_TypeError, "Expected an object of type 'cmsgpack.Extensions', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+    {
+        PyErr_Format(PyExc_TypeError, "Expected an object of type 'cmsgpack.Extensions', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+        return -1;
+    }
     
     Py_DECREF(stream->ext);
     Py_INCREF(arg);
 
     stream->ext = arg;
-    Py_RETURN_NONE;
+    return 0;
 }
 
 
-/////////////////////////
-//  FILE STREAM CLASS  //
-/////////////////////////
+///////////////////
+//   ITERATION   //
+///////////////////
 
-static bool filestream_setup_fdata(filestream_t *stream, PyObject *filename, PyObject *reading_offset, PyObject *chunk_size)
-{
+/* # Item iterators
+ * 
+ * Iterate over the items of an encoded top-level array or the pairs of a map, decoding one item at a time.
+ * Only the container header is read up front, so memory usage is bounded by the largest item instead of the whole container.
+ * 
+ * Buffers are decoded in place, while file streams decode each item as a separate record through `decoding_start`.
+ */
 
-    // Get the filename data if we got a filename object
-    size_t fname_size;
-    const char *fname = PyUnicode_AsUTF8AndSize(filename, (Py_ssize_t *)&fname_size);
+// Iterator over the items of an encoded array or map
+typedef struct {
+    PyObject_HEAD
 
-    // Allocate the filename buffer
-    stream->fname = (char *)malloc(fname_size + 1);
+    bool map;          // Whether to yield key-value pairs
+    size_t remaining;  // The number of items or pairs left
 
-    if (!stream->fname)
-        return PyErr_NoMemory();
+    PyObject *encoded; // The object holding the encoded data, NULL when iterating over a file stream
+    Py_buffer view;    // The buffer of the encoded data
+    size_t pos;        // The offset of the next item in the buffer
 
-    // Copy the filename into the object and NULL-terminate it
-    memcpy(stream->fname, fname, fname_size);
-    stream->fname[fname_size] = 0;
+    filestream_t *fstream; // The file stream to iterate over, NULL when iterating over a buffer
 
-    // Decide the file buffer's size
-    stream->fbuf_size = FILEBUF_DEFAULTSIZE;
-    if (chunk_size)
+    bool str_keys;     // Whether only string keys are allowed
+    PyObject *ext;     // The extensions object to use
+    mstates_t *states; // The module states
+} itemiter_t;
+
+// Parse the container header at the start of DATA, and check that it's of the expected type. Sets NHEADER to the header size
+static bool itemiter_read_header(itemiter_t *it, const char *data, size_t size, size_t *nheader)
+{
+    const char *offset = data;
+    cm_header_t header;
+    cm_error_t error = cm_read_header(&offset, data + size, &header);
+
+    if (error == CM_ERROR_INCOMPLETE && it->fstream)
     {
-        int overflow = 0;
-        stream->fbuf_size = PyLong_AsLongLongAndOverflow(chunk_size, &overflow);
+        PyErr_SetString(PyExc_EOFError, "Reached EOF before finishing the decoding run");
+        return false;
+    }
 
-        if (overflow != 0)
-        {
-            free(stream->fname);
+    if (error != CM_OK)
+    {
+        PyErr_SetString(PyExc_ValueError, cm_error_string(error));
+        return false;
+    }
 
-            PyErr_SetString(PyExc_ValueError, "The value of argument 'chunk_size' exceeded the 64-bit integer limit");
-            return false;
-        }
+    const cm_type_t expected = it->map ? CM_TYPE_MAP : CM_TYPE_ARRAY;
 
-        // Check if the number wasn't negative
-        if ((ssize_t)(stream->fbuf_size) < 0)
-        {
-            free(stream->fname);
-            
-            PyErr_SetString(PyExc_ValueError, "The value of argument 'chunk_size' was smaller than 0, but must be positive");
-            return false;
-        }
+    if (header.type != expected)
+    {
+        PyErr_Format(PyExc_TypeError, "Expected the encoded data to start with %s", it->map ? "a map" : "an array");
+        return false;
     }
 
-    // Allocate the file buffer for decoding
-    stream->fbuf = (char *)malloc(stream->fbuf_size);
+    it->remaining = (size_t)header.size;
+    *nheader = (size_t)(offset - data);
+
+    return true;
+}
+
+// Read the container header at the reading offset of the file stream, and move the offset past it
+static bool itemiter_read_file_header(itemiter_t *it)
+{
+    filestream_t *fstream = it->fstream;
+
+    buffer_t b;
+    b.file = fstream->file;
+    b.dio = fstream->direct_io && fstream->dio.fd >= 0 ? &fstream->dio : NULL;
+
+    if (b.dio)
+        b.dio->pos = fstream->foff;
+    else
+        fseek(b.file, fstream->foff, SEEK_SET);
+
+    // Container headers take up to 5 bytes
+    char header[5];
+
+    size_t read;
+    Py_BEGIN_ALLOW_THREADS
+        read = decoding_read(&b, header, sizeof(header));
+    Py_END_ALLOW_THREADS
+
+    if (read == 0)
+        return decoding_read_error(&b);
+
+    size_t nheader;
+    if (!itemiter_read_header(it, header, read, &nheader))
+        return false;
+
+    fstream->foff += nheader;
+    return true;
+}
 
-    if (!stream->fbuf)
-    {
-        free(stream->fname);
+// Create an item iterator, either over ENCODED or over the next record of FSTREAM
+static PyObject *itemiter_new(mstates_t *states, PyObject *encoded, filestream_t *fstream, PyObject *ext, bool str_keys, bool map)
+{
+    itemiter_t *it = PyObject_New(itemiter_t, &ItemIterObj);
+
+    if (!it)
         return PyErr_NoMemory();
-    }
 
-    // Get the file offset
-    stream->foff = 0;
-    if (reading_offset)
+    it->map = map;
+    it->remaining = 0;
+    it->encoded = NULL;
+    it->pos = 0;
+    it->fstream = NULL;
+    it->str_keys = str_keys;
+    it->ext = Py_NewRef(ext);
+    it->states = states;
+
+    if (fstream)
     {
-        int overflow = 0;
-        stream->foff = PyLong_AsLongLongAndOverflow(reading_offset, &overflow);
+        it->fstream = (filestream_t *)Py_NewRef((PyObject *)fstream);
 
-        if (overflow != 0)
+        if (!itemiter_read_file_header(it))
         {
-            free(stream->fbuf);
-            free(stream->fname);
-            
-            PyErr_SetString(PyExc_ValueError, "The value of argument 'reading_offset' exceeded the 64-bit integer limit");
-            return false;
+            Py_DECREF(it);
+            return NULL;
         }
 
-        // Check if the number wasn't negative
-        if ((ssize_t)(stream->foff) < 0)
+        // Keep other reads away from the file until all items are read
+        if (it->remaining > 0)
+            fstream->iterating = (PyObject *)it;
+    }
+    else
+    {
+        if (PyObject_GetBuffer(encoded, &it->view, PyBUF_SIMPLE) < 0)
         {
-            free(stream->fbuf);
-            free(stream->fname);
-            
-            PyErr_SetString(PyExc_ValueError, "The value of argument 'reading_offset' was smaller than 0, but must be positive");
-            return false;
+            Py_DECREF(it);
+            return NULL;
+        }
+
+        it->encoded = Py_NewRef(encoded);
+
+        if (!itemiter_read_header(it, it->view.buf, (size_t)it->view.len, &it->pos))
+        {
+            Py_DECREF(it);
+            return NULL;
         }
     }
 
-    // Attempt to open the file
-    stream->file = fopen(stream->fname, "a+b");
+    return (PyObject *)it;
+}
 
-    if (!stream->file)
-    {
-        free(stream->fbuf);
-        free(stream->fname);
+// Let the file stream be read from again once the iterator is done with it
+static void itemiter_release_fstream(itemiter_t *it)
+{
+    if (it->fstream && it->fstream->iterating == (PyObject *)it)
+        it->fstream->iterating = NULL;
+}
 
-        const int err = errno;
-        return error_cannot_open_file(fname, err);
+static void itemiter_dealloc(itemiter_t *it)
+{
+    itemiter_release_fstream(it);
+
+    if (it->encoded)
+    {
+        PyBuffer_Release(&it->view);
+        Py_DECREF(it->encoded);
     }
 
-    // Disable file buffering as we already read/write in a chunk-like manner
-    setbuf(stream->file, NULL);
+    Py_XDECREF((PyObject *)it->fstream);
+    Py_DECREF(it->ext);
 
-    return true;
+    PyObject_Del(it);
 }
 
-static PyObject *FileStream(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+// Decode the next object in the buffer of the iterator
+static PyObject *itemiter_decode_buffer(itemiter_t *it)
 {
-    mstates_t *states = get_mstates(self);
+    buffer_t b;
 
-    PyObject *reading_offset = NULL;
-    PyObject *chunk_size = NULL;
-    PyObject *filename = NULL;
-    PyObject *str_keys = Py_False;
-    PyObject *ext = (PyObject *)&states->extensions;
+    b.ext = ((extensions_t *)it->ext)->data;
+    b.str_keys = it->str_keys;
+    b.states = it->states;
+    b.depth = 0;
+    b.raw_depth = 0;
+    b.owner = it->encoded;
+    b.refs = NULL;
+    b.oob = NULL;
+    b.int_arrays = false;
+    b.file = NULL;
+    b.dio = NULL;
 
-    keyarg_t keyargs[] = {
-        KEYARG(&filename, &PyUnicode_Type, states->interned.file_name),
-        KEYARG(&reading_offset, &PyLong_Type, states->interned.reading_offset),
-        KEYARG(&chunk_size, &PyLong_Type, states->interned.chunk_size),
-        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
-        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
-    };
+    batch_t batch = {0};
+    b.batch = &batch;
 
-    if (!parse_keywords(0, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
-        return NULL;
+    b.offset = (char *)it->view.buf + it->pos;
+    b.maxoffset = (char *)it->view.buf + it->view.len;
 
-    // Check if we got the filename argument
-    if (!filename)
-    {
-        PyErr_SetString(PyExc_TypeError, "Did not receive mandatory argument 'file_name'");
-        return NULL;
-    }
+    PyObject *result = decode_bytes(&b);
 
+    result = decoding_resolve_batch(&b, result);
+    batch_clear(&batch);
 
-    filestream_t *stream = PyObject_New(filestream_t, &FileStreamObj);
+    it->pos = (size_t)(b.offset - (char *)it->view.buf);
 
-    if (!stream)
-        return PyErr_NoMemory();
+    return result;
+}
+
+// Decode the next object, from either the buffer or the file stream
+static _always_inline PyObject *itemiter_decode(itemiter_t *it)
+{
+    if (it->fstream)
+        return decoding_start(NULL, it->states, it->ext, it->str_keys, 0, false, false, NULL, it->fstream);
     
-    // Set the file data
-    if (!filestream_setup_fdata(stream, filename, reading_offset, chunk_size))
+    return itemiter_decode_buffer(it);
+}
+
+static PyObject *itemiter_next(itemiter_t *it)
+{
+    if (it->remaining == 0)
     {
-        PyObject_Del(stream);
+        // Check for trailing data once all items of a buffer are decoded, like `decode` does
+        if (it->encoded && it->pos != (size_t)it->view.len)
+        {
+            it->pos = (size_t)it->view.len;
+            return PyErr_Format(PyExc_ValueError, "The encoded data pattern ended before the buffer ended");
+        }
+
         return NULL;
     }
 
-    // Set the object fields
-    stream->ext = ext;
-    stream->states = states;
-    stream->str_keys = str_keys == Py_True;
+    PyObject *item = itemiter_decode(it);
 
-    stream->avg_item_size = AVG_ITEM_SIZE_DEFAULT;
-    stream->avg_fluctuation = AVG_FLUCTUATION_DEFAULT;
+    if (item && it->map)
+    {
+        PyObject *val = NULL;
 
-    // Keep a reference to the module
-    Py_INCREF(self);
-    stream->module = self;
+        if (it->str_keys && !PyUnicode_CheckExact(item))
+            PyErr_Format(PyExc_TypeError, "Got a map key of type '%s' while only string keys were allowed", Py_TYPE(item)->tp_name);
+        else
+            val = itemiter_decode(it);
 
-    // Keep a reference to the ext object
-    Py_INCREF(ext);
+        PyObject *pair = val ? PyTuple_Pack(2, item, val) : NULL;
 
-    return (PyObject *)stream;
-}
+        Py_DECREF(item);
+        Py_XDECREF(val);
+        item = pair;
+    }
 
-static void filestream_dealloc(filestream_t *stream)
-{
-    // Free the file buffer and file name, and close the file
-    free(stream->fbuf);
-    free(stream->fname);
-    fclose(stream->file);
+    // The position is unknown after a failure, so stop iterating
+    if (!item)
+    {
+        it->remaining = 0;
+        itemiter_release_fstream(it);
 
-    Py_DECREF(stream->module);
-    Py_DECREF(stream->ext);
+        if (it->encoded)
+            it->pos = (size_t)it->view.len;
+        
+        return NULL;
+    }
 
-    PyObject_Del(stream);
-}
+    if (--it->remaining == 0)
+        itemiter_release_fstream(it);
 
-static PyObject *filestream_encode(filestream_t *stream, PyObject *obj)
-{
-    return encoding_start(obj, stream->states, stream->ext, stream->str_keys, stream, &stream->avg_item_size, &stream->avg_fluctuation);
+    return item;
 }
 
-static PyObject *filestream_decode(filestream_t *stream)
+static PyObject *itemiter_length_hint(itemiter_t *it, PyObject *unused)
 {
-    return decoding_start(NULL, stream->states, stream->ext, stream->str_keys, stream);
+    return PyLong_FromSize_t(it->remaining);
 }
 
-static PyObject *filestream_get_readingoffset(filestream_t *stream, void *closure)
+// Parse the arguments of `iter_array` and `iter_items`
+static PyObject *itemiter_from_args(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs, bool map)
 {
-    PyObject *num = PyLong_FromLongLong(stream->foff);
+    const Py_ssize_t npositional = 1;
+    if (!min_positional(nargs, npositional))
+        return NULL;
 
-    if (!num)
-        return PyErr_NoMemory();
-    
-    return num;
+    PyObject *encoded = parse_positional(args, 0, NULL, "encoded");
+
+    if (!encoded)
+        return NULL;
+
+    mstates_t *states = get_mstates(self);
+
+    PyObject *str_keys = Py_False;
+    PyObject *ext = (PyObject *)&states->extensions;
+
+    keyarg_t keyargs[] = {
+        KEYARG(&str_keys, &PyBool_Type, states->interned.str_keys),
+        KEYARG(&ext, &ExtensionsObj, states->interned.extensions),
+    };
+
+    if (!parse_keywords(npositional, args, nargs, kwargs, keyargs, NKEYARGS(keyargs)))
+        return NULL;
+
+    return itemiter_new(states, encoded, NULL, ext, str_keys == Py_True, map);
 }
 
-static PyObject *filestream_get_chunksize(filestream_t *stream, void *closure)
+static PyObject *iter_array(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
 {
-    PyObject *num = PyLong_FromLongLong(stream->fbuf_size);
+    return itemiter_from_args(self, args, nargs, kwargs, false);
+}
 
-    if (!num)
-        return PyErr_NoMemory();
-    
-    return num;
+static PyObject *iter_items(PyObject *self, PyObject **args, Py_ssize_t nargs, PyObject *kwargs)
+{
+    return itemiter_from_args(self, args, nargs, kwargs, true);
 }
 
-static PyObject *filestream_get_strkey(filestream_t *stream, void *closure)
+static PyObject *filestream_iter_array(filestream_t *stream, PyObject *unused)
 {
-    return stream->str_keys == true ? Py_True : Py_False;
+    if (!filestream_check_iterating(stream))
+        return NULL;
+
+    return itemiter_new(stream->states, NULL, stream, stream->ext, stream->str_keys, false);
 }
 
-static PyObject *filestream_get_extensions(filestream_t *stream, void *closure)
+static PyObject *filestream_iter_items(filestream_t *stream, PyObject *unused)
 {
-    PyObject *ext = stream->ext;
+    if (!filestream_check_iterating(stream))
+        return NULL;
 
-    Py_INCREF(ext);
-    return ext;
+    return itemiter_new(stream->states, NULL, stream, stream->ext, stream->str_keys, true);
 }
 
-static PyObject *filestream_set_readingoffset(filestream_t *stream, PyObject *arg, void *closure)
+
+//////////////////
+//    C  API    //
+//////////////////
+
+// Get the extensions object passed to a C API function, where NULL means the global one
+static extensions_t *capi_get_extensions(PyObject *extensions, int id)
 {
-    if (Py_TYPE(arg) != &PyLong_Type)
-        return PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
-    
-    int overflow = 0;
-    long num = PyLong_AsLongAndOverflow(arg, &overflow);
+    if (id < -128 || id > 127)
+    {
+        PyErr_Format(PyExc_ValueError, "Expected the ID to be between -128 and 127, but got an ID of %i", id);
+        return NULL;
+    }
 
-    if (overflow)
+    if (!ext_id_check_reserved(id))
+        return NULL;
+
+    if (!extensions)
+        return &get_mstates(PyState_FindModule(&cmsgpack))->extensions;
+    
+    if (!Py_IS_TYPE(extensions, &ExtensionsObj))
     {
-        PyErr_SetString(PyExc_ValueError, "Got an integer that exceeded the system word size");
+        error_unexpected_argtype("extensions", ExtensionsObj.tp_name, Py_TYPE(extensions)->tp_name);
         return NULL;
     }
 
-    stream->foff = num;
-    Py_RETURN_NONE;
+    return (extensions_t *)extensions;
 }
 
-static PyObject *filestream_set_chunksize(filestream_t *stream, PyObject *arg, void *closure)
+static int capi_add_encode(PyObject *extensions, int id, PyTypeObject *type, cm_native_encode_t func, void *ctx)
 {
-    if (Py_TYPE(arg) != &PyLong_Type)
-        return PyErr_Format(PyExc_TypeError, "Expected an object of type 'int', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+    extensions_t *ext = capi_get_extensions(extensions, id);
+
+    if (!ext)
+        return -1;
     
-    int overflow = 0;
-    long num = PyLong_AsLongAndOverflow(arg, &overflow);
+    ext_dictitem_t *item = PyObject_New(ext_dictitem_t, &ExtDictItemObj);
 
-    if (overflow)
+    if (!item)
     {
-        PyErr_SetString(PyExc_ValueError, "Got an integer that exceeded the system word size");
-        return NULL;
+        PyErr_NoMemory();
+        return -1;
     }
 
-    char *newbuf = (char *)malloc(num);
+    item->func = NULL;
+    item->id = (char)id;
+    item->batch = false;
+    item->nested = false;
+    item->size = 0;
+    item->native = func;
+    item->ctx = ctx;
 
-    if (!newbuf)
-        return PyErr_NoMemory();
-    
-    free(stream->fbuf);
-    
-    stream->fbuf = newbuf;
-    stream->fbuf_size = num;
+    int status = PyDict_SetItem(ext->data.dict, (PyObject *)type, (PyObject *)item);
 
-    Py_RETURN_NONE;
-}
+    Py_DECREF(item);
 
-static PyObject *filestream_set_strkey(filestream_t *stream, PyObject *arg, void *closure)
-{
-    stream->str_keys = arg == Py_True;
-    Py_RETURN_NONE;
+    return status < 0 ? -1 : 0;
 }
 
-static PyObject *filestream_set_extensions(filestream_t *stream, PyObject *arg, void *closure)
+static int capi_add_decode(PyObject *extensions, int id, cm_native_decode_t func, void *ctx)
 {
-    if (Py_TYPE(arg) != &ExtensionsObj)
-        return PyErr_Format(PyExc_TypeError, "Expected an object of type 'cmsgpack.Extensions', but got an object of type '%s'", Py_TYPE(arg)->tp_name);
+    extensions_t *ext = capi_get_extensions(extensions, id);
+
+    if (!ext)
+        return -1;
     
-    Py_DECREF(stream->ext);
-    Py_INCREF(arg);
+    unsigned char idx = (unsigned char)id;
 
-    stream->ext = arg;
-    Py_RETURN_NONE;
+    Py_XDECREF(ext->funcs[idx]);
+    ext->funcs[idx] = NULL;
+    ext->batch[idx] = false;
+    ext->nested[idx] = false;
+
+    ext->natives[idx].func = func;
+    ext->natives[idx].ctx = ctx;
+
+    return 0;
 }
 
+static cmsgpack_capi_t capi = {
+    .version = CMSGPACK_CAPI_VERSION,
+    .add_encode = capi_add_encode,
+    .add_decode = capi_add_decode,
+};
+
 
 //////////////////
 //    STATES    //
@@ -2773,9 +6732,41 @@ static bool setup_mstates(PyObject *m)
     GET_ISTR(types)
     GET_ISTR(extensions)
     GET_ISTR(pass_memoryview)
+    GET_ISTR(validate)
     GET_ISTR(str_keys)
     GET_ISTR(reading_offset)
     GET_ISTR(chunk_size)
+    GET_ISTR(raw_depth)
+    GET_ISTR(sync_records)
+    GET_ISTR(sync_ms)
+    GET_ISTR(direct_io)
+    GET_ISTR(batch)
+    GET_ISTR(size)
+    GET_ISTR(release)
+    GET_ISTR(nested)
+    GET_ISTR(hash)
+    GET_ISTR(shared_refs)
+    GET_ISTR(sample_rate)
+    GET_ISTR(prefix_size)
+    GET_ISTR(encode)
+    GET_ISTR(decode)
+    GET_ISTR(buffer_callback)
+    GET_ISTR(buffers)
+    GET_ISTR(decode_cache)
+    GET_ISTR(int_arrays)
+
+    /* PLACEHOLDERS */
+
+    s->batch_placeholder = PyObject_CallNoArgs((PyObject *)&PyBaseObject_Type);
+
+    if (!s->batch_placeholder)
+        return false;
+
+    /* SLOW HOOK */
+
+    memset(&s->slow, 0, sizeof(s->slow));
+    atomic_init(&s->slow.enabled, false);
+    clear_flag(&s->slow.lock);
 
     /* CACHES */
 
@@ -2856,6 +6847,15 @@ static bool setup_mstates(PyObject *m)
     memset(s->extensions.funcs, 0, sizeof(s->extensions.funcs));
     s->extensions.data.funcs = s->extensions.funcs;
 
+    memset(s->extensions.batch, 0, sizeof(s->extensions.batch));
+    s->extensions.data.batch = s->extensions.batch;
+
+    memset(s->extensions.nested, 0, sizeof(s->extensions.nested));
+    s->extensions.data.nested = s->extensions.nested;
+
+    memset(s->extensions.natives, 0, sizeof(s->extensions.natives));
+    s->extensions.data.natives = s->extensions.natives;
+
     // Set default values
     s->extensions.data.pass_memview = false;
 
@@ -2863,6 +6863,19 @@ static bool setup_mstates(PyObject *m)
     if (PyModule_AddObjectRef(m, "extensions", (PyObject *)&s->extensions) < 0)
         return false;
     
+    /* C API */
+
+    PyObject *capsule = PyCapsule_New(&capi, CMSGPACK_CAPI_NAME, NULL);
+
+    if (!capsule)
+        return false;
+    
+    int status = PyModule_AddObjectRef(m, "_C_API", capsule);
+    Py_DECREF(capsule);
+
+    if (status < 0)
+        return false;
+    
 
     return true;
 }
@@ -2883,6 +6896,8 @@ static void cleanup_mstates(PyObject *m)
     for (size_t i = 0; i < 256; ++i)
         Py_XDECREF(s->extensions.funcs[i]);
     
+    Py_XDECREF(s->batch_placeholder);
+    Py_XDECREF(s->slow.callback);
 }
 
 
@@ -2897,17 +6912,26 @@ static PyMethodDef StreamMethods[] = {
     {NULL}
 };
 
+static PyMethodDef ItemIterMethods[] = {
+    {"__length_hint__", (PyCFunction)itemiter_length_hint, METH_NOARGS, NULL},
+
+    {NULL}
+};
+
 static PyMethodDef FileStreamMethods[] = {
     {"encode", (PyCFunction)filestream_encode, METH_O, NULL},
     {"decode", (PyCFunction)filestream_decode, METH_NOARGS, NULL},
+    {"sync", (PyCFunction)filestream_sync, METH_FASTCALL, NULL},
+    {"iter_array", (PyCFunction)filestream_iter_array, METH_NOARGS, NULL},
+    {"iter_items", (PyCFunction)filestream_iter_items, METH_NOARGS, NULL},
 
     {NULL}
 };
 
 static PyMethodDef ExtensionsMethods[] = {
-    {"add", (PyCFunction)extensions_add, METH_FASTCALL, NULL},
-    {"add_encode", (PyCFunction)extensions_add_encode, METH_FASTCALL, NULL},
-    {"add_decode", (PyCFunction)extensions_add_decode, METH_FASTCALL, NULL},
+    {"add", (PyCFunction)extensions_add, METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"add_encode", (PyCFunction)extensions_add_encode, METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"add_decode", (PyCFunction)extensions_add_decode, METH_FASTCALL | METH_KEYWORDS, NULL},
 
     {"remove", (PyCFunction)extensions_remove, METH_FASTCALL, NULL},
     {"remove_encode", (PyCFunction)extensions_remove_encode, METH_O, NULL},
@@ -2920,7 +6944,13 @@ static PyMethodDef ExtensionsMethods[] = {
 
 static PyGetSetDef StreamGetSet[] = {
     {"str_keys", (getter)stream_get_strkey, (setter)stream_set_strkey, NULL, NULL},
+    {"raw_depth", (getter)stream_get_rawdepth, (setter)stream_set_rawdepth, NULL, NULL},
     {"extensions", (getter)stream_get_extensions, (setter)stream_set_extensions, NULL, NULL},
+    {"hash", (getter)stream_get_hash, (setter)stream_set_hash, NULL, NULL},
+    {"shared_refs", (getter)stream_get_sharedrefs, (setter)stream_set_sharedrefs, NULL, NULL},
+    {"int_arrays", (getter)stream_get_intarrays, (setter)stream_set_intarrays, NULL, NULL},
+    {"decode_cache", (getter)stream_get_decodecache, (setter)stream_set_decodecache, NULL, NULL},
+    {"cache_stats", (getter)stream_get_cachestats, NULL, NULL, NULL},
 
     {NULL}
 };
@@ -2930,6 +6960,10 @@ static PyGetSetDef FileStreamGetSet[] = {
     {"chunk_size", (getter)filestream_get_chunksize, (setter)filestream_set_chunksize, NULL, NULL},
     {"str_keys", (getter)filestream_get_strkey, (setter)filestream_set_strkey, NULL, NULL},
     {"extensions", (getter)filestream_get_extensions, (setter)filestream_set_extensions, NULL, NULL},
+    {"sync_records", (getter)filestream_get_syncrecords, (setter)filestream_set_syncrecords, NULL, NULL},
+    {"sync_ms", (getter)filestream_get_syncms, (setter)filestream_set_syncms, NULL, NULL},
+    {"direct_io", (getter)filestream_get_directio, (setter)filestream_set_directio, NULL, NULL},
+    {"durable_seq", (getter)filestream_get_durableseq, NULL, NULL, NULL},
 
     {NULL}
 };
@@ -2944,9 +6978,18 @@ static PyMethodDef CmsgpackMethods[] = {
     {"encode", (PyCFunction)encode, METH_FASTCALL | METH_KEYWORDS, NULL},
     {"decode", (PyCFunction)decode, METH_FASTCALL | METH_KEYWORDS, NULL},
 
+    {"patch", (PyCFunction)patch, METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"merge_maps", (PyCFunction)merge_maps, METH_FASTCALL | METH_KEYWORDS, NULL},
+
+    {"iter_array", (PyCFunction)iter_array, METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"iter_items", (PyCFunction)iter_items, METH_FASTCALL | METH_KEYWORDS, NULL},
+
+    {"on_slow", (PyCFunction)on_slow, METH_FASTCALL | METH_KEYWORDS, NULL},
+
     {"Stream", (PyCFunction)Stream, METH_FASTCALL | METH_KEYWORDS, NULL},
     {"FileStream", (PyCFunction)FileStream, METH_FASTCALL | METH_KEYWORDS, NULL},
     {"Extensions", (PyCFunction)Extensions, METH_FASTCALL | METH_KEYWORDS, NULL},
+    {"Raw", (PyCFunction)Raw, METH_FASTCALL | METH_KEYWORDS, NULL},
 
     {NULL}
 };
@@ -2978,6 +7021,18 @@ static PyTypeObject FileStreamObj = {
     .tp_new = NULL,
 };
 
+static PyTypeObject ItemIterObj = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "cmsgpack.ItemIterator",
+    .tp_basicsize = sizeof(itemiter_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_methods = ItemIterMethods,
+    .tp_dealloc = (destructor)itemiter_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)itemiter_next,
+    .tp_new = NULL,
+};
+
 static PyTypeObject ExtDictItemObj = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "cmsgpack.ExtDictItem",
@@ -2998,6 +7053,21 @@ static PyTypeObject ExtensionsObj = {
     .tp_new = NULL,
 };
 
+static PyBufferProcs RawBufferProcs = {
+    .bf_getbuffer = (getbufferproc)raw_getbuffer,
+    .bf_releasebuffer = NULL,
+};
+
+static PyTypeObject RawObj = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "cmsgpack.Raw",
+    .tp_basicsize = sizeof(raw_t),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)raw_dealloc,
+    .tp_as_buffer = &RawBufferProcs,
+    .tp_new = NULL,
+};
+
 static void cleanup(PyObject *module)
 {
     cleanup_mstates(module);
@@ -3033,10 +7103,13 @@ PyMODINIT_FUNC PyInit_cmsgpack(void)
     // Prepare custom types
     PYTYPE_READY(StreamObj);
     PYTYPE_READY(FileStreamObj);
+    PYTYPE_READY(ItemIterObj);
 
     PYTYPE_READY(ExtDictItemObj);
     PYTYPE_READY(ExtensionsObj);
 
+    PYTYPE_READY(RawObj);
+
     // Create main module
     m = PyModule_Create(&cmsgpack);
 
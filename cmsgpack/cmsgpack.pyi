@@ -1,4 +1,4 @@
-from typing_extensions import Callable, NoReturn, Buffer
+from typing_extensions import Any, Callable, Iterable, Iterator, NoReturn, Buffer
 
 
 class Extensions:
@@ -9,15 +9,15 @@ class Extensions:
     def __init__(self, types: dict | None=None, pass_memoryview: bool=False):
         ...
     
-    def add(self, id: int, type: type, encfunc: Callable, decfunc: Callable, /) -> NoReturn:
+    def add(self, id: int, type: type, encfunc: Callable, decfunc: Callable, /, batch: bool=False, nested: bool=False, size: int | None=None) -> NoReturn:
         " Add an extension type for encoding and decoding. "
         ...
     
-    def add_encode(self, id: int, type: type, encfunc: Callable, /) -> NoReturn:
+    def add_encode(self, id: int, type: type, encfunc: Callable, /, batch: bool=False, nested: bool=False, size: int | None=None) -> NoReturn:
         " Add an extension type for just encoding. "
         ...
     
-    def add_decode(self, id: int, decfunc: Callable, /) -> NoReturn:
+    def add_decode(self, id: int, decfunc: Callable, /, batch: bool=False, nested: bool=False) -> NoReturn:
         " Add an extension type for just decoding. "
         ...
     
@@ -38,29 +38,65 @@ class Extensions:
         ...
 
 
+class Raw:
+    " Class for embedding already-encoded data, which is written as-is during encoding. "
+
+    def __init__(self, encoded: Buffer, /, validate: bool=False):
+        ...
+    
+    def __buffer__(self, flags: int, /) -> memoryview:
+        ...
+
+
 # Global extensions object
 extensions: Extensions
 
 
-def encode(obj: any, /, str_keys: bool=False, extensions: Extensions=None) -> bytes:
+def encode(obj: any, /, str_keys: bool=False, extensions: Extensions=None, hash: str | None=None, shared_refs: bool=False, buffer_callback: Callable[[memoryview], Any] | None=None, int_arrays: bool=False) -> bytes | tuple[bytes, int]:
     " Encode Python data to bytes. "
     ...
 
-def decode(encoded: Buffer, /, str_keys: bool=False, extensions: Extensions=None) -> any:
+def decode(encoded: Buffer, /, str_keys: bool=False, extensions: Extensions=None, raw_depth: int=0, shared_refs: bool=False, buffers: Iterable[Buffer] | None=None, int_arrays: bool=False) -> any:
     " Decode any MessagePack-encoded data. "
     ...
 
+def iter_array(encoded: Buffer, /, str_keys: bool=False, extensions: Extensions=None) -> Iterator[any]:
+    " Iterate over the items of an encoded array, decoding one item at a time. "
+    ...
+
+def iter_items(encoded: Buffer, /, str_keys: bool=False, extensions: Extensions=None) -> Iterator[tuple[any, any]]:
+    " Iterate over the key-value pairs of an encoded map, decoding one pair at a time. "
+    ...
+
+def patch(encoded: Buffer, path: tuple | list, value: any, /, str_keys: bool=False, extensions: Extensions=None) -> bytes:
+    " Replace or add the value at the given path in encoded data, without decoding the rest. "
+    ...
+
+def merge_maps(a: Buffer, b: Buffer, /, str_keys: bool=False, extensions: Extensions=None) -> bytes:
+    " Merge two encoded maps, with pairs in `b` overriding pairs in `a`. "
+    ...
+
+def on_slow(threshold_us: int, max_bytes: int, callback: Callable[[str, float, int, bytes], Any] | None, /, sample_rate: float=1.0, prefix_size: int=64) -> None:
+    " Set the function to call for messages that take too long or are too large. "
+    ...
+
 
 class Stream:
     " Wrapper for `encode`/`decode` that retains optional arguments. "
 
     str_keys: bool
     extensions: Extensions
+    raw_depth: int
+    hash: str | None
+    shared_refs: bool
+    decode_cache: int
+    int_arrays: bool
+    cache_stats: dict[str, int]
     
-    def __init__(self, str_keys: bool=False, extensions: Extensions=None):
+    def __init__(self, str_keys: bool=False, extensions: Extensions=None, raw_depth: int=0, hash: str | None=None, shared_refs: bool=False, decode_cache: int=0, int_arrays: bool=False):
         ...
     
-    def encode(self, obj: any, /) -> bytes:
+    def encode(self, obj: any, /) -> bytes | tuple[bytes, int]:
         " Encode Python data to bytes. "
         ...
     
@@ -76,15 +112,31 @@ class FileStream:
     chunk_size: int
     str_keys: bool
     extensions: Extensions
+    sync_records: int
+    sync_ms: int
+    direct_io: bool
+    durable_seq: int
     
-    def __init__(self, file_name: str, reading_offset: int=0, chunk_size: int=8192, str_keys: bool=False, extensions: Extensions=None):
+    def __init__(self, file_name: str, reading_offset: int=0, chunk_size: int=8192, str_keys: bool=False, extensions: Extensions=None, sync_records: int=0, sync_ms: int=0, direct_io: bool=False):
         ...
     
-    def encode(self, obj: any, /) -> NoReturn:
-        " Encode Python data and write it to the file. "
+    def encode(self, obj: any, /) -> int:
+        " Encode Python data and write it to the file. Returns the sequence number of the written record. "
         ...
     
     def decode(self) -> any:
         " Decode MessagePack-encoded data read from the file. "
         ...
+    
+    def sync(self, seq: int=None, /) -> int:
+        " Sync written data to disk. Returns the sequence number up to which records are durable. "
+        ...
+    
+    def iter_array(self) -> Iterator[any]:
+        " Iterate over the items of the array in the next record, decoding one item at a time. "
+        ...
+    
+    def iter_items(self) -> Iterator[tuple[any, any]]:
+        " Iterate over the key-value pairs of the map in the next record, decoding one pair at a time. "
+        ...
 
@@ -0,0 +1,76 @@
+#ifndef CMSGPACK_CAPI_H
+#define CMSGPACK_CAPI_H
+
+/* # Native extension types
+ *
+ * C API for registering native functions for extension types, published by the `cmsgpack` module
+ * as the `cmsgpack._C_API` capsule. Native functions are called directly while encoding and decoding,
+ * without creating Python objects for the ext data.
+ *
+ * Call `cmsgpack_import_capi()` once (e.g. in the module's init function) before using `cmsgpack_capi`.
+ *
+ * Encoding:
+ * - The encode function writes the data of OBJ to OUT, which has SIZE bytes available, and returns the
+ *   number of bytes the data takes up. If that's more than SIZE, the data doesn't have to be written, and
+ *   the function is called again with enough space. Return -1 with an exception set on failure.
+ *
+ * Decoding:
+ * - The decode function receives the ext data and returns a new reference to the decoded object, or NULL
+ *   with an exception set on failure. DATA is only valid during the call.
+ *
+ * The `extensions` argument of the add functions is a `cmsgpack.Extensions` object, or NULL for the global one.
+ * CTX is passed to the functions as-is, and must stay valid for as long as the functions are registered.
+ * Registering a native function replaces the Python function for the same type or ID, and vice versa.
+ */
+
+#include <Python.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Incremented when the API struct changes in an incompatible way
+#define CMSGPACK_CAPI_VERSION 1
+
+#define CMSGPACK_CAPI_NAME "cmsgpack._C_API"
+
+typedef Py_ssize_t (*cm_native_encode_t)(PyObject *obj, char *out, size_t size, void *ctx);
+typedef PyObject *(*cm_native_decode_t)(const char *data, size_t size, void *ctx);
+
+typedef struct {
+    int version;
+
+    // Register native functions. Return 0 on success, or -1 with an exception set
+    int (*add_encode)(PyObject *extensions, int id, PyTypeObject *type, cm_native_encode_t func, void *ctx);
+    int (*add_decode)(PyObject *extensions, int id, cm_native_decode_t func, void *ctx);
+} cmsgpack_capi_t;
+
+#ifndef CMSGPACK_MODULE
+
+static cmsgpack_capi_t *cmsgpack_capi = NULL;
+
+// Import the C API from the `cmsgpack` module. Returns 0 on success, or -1 with an exception set
+static inline int cmsgpack_import_capi(void)
+{
+    cmsgpack_capi = (cmsgpack_capi_t *)PyCapsule_Import(CMSGPACK_CAPI_NAME, 0);
+
+    if (!cmsgpack_capi)
+        return -1;
+
+    if (cmsgpack_capi->version != CMSGPACK_CAPI_VERSION)
+    {
+        PyErr_Format(PyExc_ImportError, "Expected cmsgpack C API version %i, but got version %i", CMSGPACK_CAPI_VERSION, cmsgpack_capi->version);
+        cmsgpack_capi = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif // CMSGPACK_MODULE
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CMSGPACK_CAPI_H
@@ -0,0 +1,503 @@
+/* Licensed under the MIT License. */
+
+#include "core.h"
+
+////////////////////
+//    HEADERS     //
+////////////////////
+
+// Read a big-endian size field of NBYTES bytes
+static inline uint64_t read_size(const char *data, size_t nbytes)
+{
+    return (
+        nbytes == 1 ? (uint64_t)(unsigned char)data[0] :
+        nbytes == 2 ? (uint64_t)cm_load_u16(data) :
+                      (uint64_t)cm_load_u32(data)
+    );
+}
+
+cm_error_t cm_read_header(const char **data, const char *end, cm_header_t *header)
+{
+    const char *offset = *data;
+
+    if (offset >= end)
+        return CM_ERROR_INCOMPLETE;
+
+    const unsigned char mask = (unsigned char)*offset;
+
+    // Only fixsize values don't have `110` set on the upper 3 mask bits
+    if ((mask & 224) != 192)
+    {
+        if ((mask & 224) == CM_DT_STR_FIXED)
+        {
+            header->type = CM_TYPE_STR;
+            header->size = mask & 31;
+        }
+        else if ((mask & 128) == CM_DT_UINT_FIXED) // Uint only has upper bit set to 0
+        {
+            header->type = CM_TYPE_UINT;
+            header->value.u = mask;
+        }
+        else if ((mask & 224) == CM_DT_INT_FIXED)
+        {
+            header->type = CM_TYPE_INT;
+            header->value.i = (int8_t)mask;
+        }
+        else if ((mask & 240) == CM_DT_ARR_FIXED) // The 5th bit is used on ARR and MAP too, instead of just the upper 3
+        {
+            header->type = CM_TYPE_ARRAY;
+            header->size = mask & 0x0F;
+        }
+        else if ((mask & 240) == CM_DT_MAP_FIXED)
+        {
+            header->type = CM_TYPE_MAP;
+            header->size = mask & 0x0F;
+        }
+        else
+        {
+            return CM_ERROR_INVALID_HEADER;
+        }
+
+        *data = offset + 1;
+        return CM_OK;
+    }
+
+    // The number of bytes following the mask that belong to the header
+    size_t nbytes;
+
+    switch (mask)
+    {
+    case CM_DT_NIL:   header->type = CM_TYPE_NIL;                             nbytes = 0; break;
+    case CM_DT_TRUE:  header->type = CM_TYPE_BOOL; header->value.b = true;  nbytes = 0; break;
+    case CM_DT_FALSE: header->type = CM_TYPE_BOOL; header->value.b = false; nbytes = 0; break;
+
+    case CM_DT_UINT_BIT8:  header->type = CM_TYPE_UINT; nbytes = 1; break;
+    case CM_DT_UINT_BIT16: header->type = CM_TYPE_UINT; nbytes = 2; break;
+    case CM_DT_UINT_BIT32: header->type = CM_TYPE_UINT; nbytes = 4; break;
+    case CM_DT_UINT_BIT64: header->type = CM_TYPE_UINT; nbytes = 8; break;
+
+    case CM_DT_INT_BIT8:  header->type = CM_TYPE_INT; nbytes = 1; break;
+    case CM_DT_INT_BIT16: header->type = CM_TYPE_INT; nbytes = 2; break;
+    case CM_DT_INT_BIT32: header->type = CM_TYPE_INT; nbytes = 4; break;
+    case CM_DT_INT_BIT64: header->type = CM_TYPE_INT; nbytes = 8; break;
+
+    case CM_DT_FLOAT_BIT32: header->type = CM_TYPE_FLOAT; nbytes = 4; break;
+    case CM_DT_FLOAT_BIT64: header->type = CM_TYPE_FLOAT; nbytes = 8; break;
+
+    case CM_DT_STR_SMALL:  header->type = CM_TYPE_STR; nbytes = 1; break;
+    case CM_DT_STR_MEDIUM: header->type = CM_TYPE_STR; nbytes = 2; break;
+    case CM_DT_STR_LARGE:  header->type = CM_TYPE_STR; nbytes = 4; break;
+
+    case CM_DT_BIN_SMALL:  header->type = CM_TYPE_BIN; nbytes = 1; break;
+    case CM_DT_BIN_MEDIUM: header->type = CM_TYPE_BIN; nbytes = 2; break;
+    case CM_DT_BIN_LARGE:  header->type = CM_TYPE_BIN; nbytes = 4; break;
+
+    case CM_DT_ARR_MEDIUM: header->type = CM_TYPE_ARRAY; nbytes = 2; break;
+    case CM_DT_ARR_LARGE:  header->type = CM_TYPE_ARRAY; nbytes = 4; break;
+
+    case CM_DT_MAP_MEDIUM: header->type = CM_TYPE_MAP; nbytes = 2; break;
+    case CM_DT_MAP_LARGE:  header->type = CM_TYPE_MAP; nbytes = 4; break;
+
+    // Ext types hold an extra byte for the ID
+    case CM_DT_EXT_FIX1:  header->type = CM_TYPE_EXT; header->size =  1; nbytes = 1; break;
+    case CM_DT_EXT_FIX2:  header->type = CM_TYPE_EXT; header->size =  2; nbytes = 1; break;
+    case CM_DT_EXT_FIX4:  header->type = CM_TYPE_EXT; header->size =  4; nbytes = 1; break;
+    case CM_DT_EXT_FIX8:  header->type = CM_TYPE_EXT; header->size =  8; nbytes = 1; break;
+    case CM_DT_EXT_FIX16: header->type = CM_TYPE_EXT; header->size = 16; nbytes = 1; break;
+
+    case CM_DT_EXT_SMALL:  header->type = CM_TYPE_EXT; nbytes = 1 + 1; break;
+    case CM_DT_EXT_MEDIUM: header->type = CM_TYPE_EXT; nbytes = 2 + 1; break;
+    case CM_DT_EXT_LARGE:  header->type = CM_TYPE_EXT; nbytes = 4 + 1; break;
+
+    default:
+        return CM_ERROR_INVALID_HEADER;
+    }
+
+    // Skip over the mask byte
+    offset++;
+
+    if ((size_t)(end - offset) < nbytes)
+        return CM_ERROR_INCOMPLETE;
+
+    switch (header->type)
+    {
+    case CM_TYPE_UINT:
+    {
+        header->value.u = (
+            nbytes == 1 ? (uint64_t)(unsigned char)offset[0] :
+            nbytes == 2 ? (uint64_t)cm_load_u16(offset) :
+            nbytes == 4 ? (uint64_t)cm_load_u32(offset) :
+                          cm_load_u64(offset)
+        );
+        break;
+    }
+    case CM_TYPE_INT:
+    {
+        header->value.i = (
+            nbytes == 1 ? (int64_t)(int8_t)offset[0] :
+            nbytes == 2 ? (int64_t)(int16_t)cm_load_u16(offset) :
+            nbytes == 4 ? (int64_t)(int32_t)cm_load_u32(offset) :
+                          (int64_t)cm_load_u64(offset)
+        );
+        break;
+    }
+    case CM_TYPE_FLOAT:
+    {
+        header->value.f = nbytes == 4 ? cm_load_float(offset) : cm_load_double(offset);
+        break;
+    }
+    case CM_TYPE_STR:
+    case CM_TYPE_BIN:
+    case CM_TYPE_ARRAY:
+    case CM_TYPE_MAP:
+    {
+        header->size = read_size(offset, nbytes);
+        break;
+    }
+    case CM_TYPE_EXT:
+    {
+        // Fixsize ext types have their size set already, and only hold the ID
+        if (nbytes > 1)
+            header->size = read_size(offset, nbytes - 1);
+
+        header->ext_id = (int8_t)offset[nbytes - 1];
+        break;
+    }
+    default:
+        break;
+    }
+
+    *data = offset + nbytes;
+    return CM_OK;
+}
+
+
+////////////////////
+//    SKIPPING    //
+////////////////////
+
+// Containers are tracked through a counter of remaining objects instead of recursion
+cm_error_t cm_skip(const char **data, const char *end)
+{
+    const char *offset = *data;
+
+    // The number of objects left to skip, which grows when we encounter containers
+    uint64_t remaining = 1;
+
+    while (remaining != 0)
+    {
+        remaining--;
+
+        const char *header_start = offset;
+
+        cm_header_t header;
+        cm_error_t error = cm_read_header(&offset, end, &header);
+
+        if (error != CM_OK)
+        {
+            *data = header_start;
+            return error;
+        }
+
+        switch (header.type)
+        {
+        case CM_TYPE_ARRAY:
+            remaining += header.size;
+            break;
+        case CM_TYPE_MAP:
+            remaining += header.size * 2;
+            break;
+
+        case CM_TYPE_STR:
+        case CM_TYPE_BIN:
+        case CM_TYPE_EXT:
+        {
+            if ((uint64_t)(end - offset) < header.size)
+            {
+                *data = header_start;
+                return CM_ERROR_INCOMPLETE;
+            }
+
+            offset += header.size;
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    *data = offset;
+    return CM_OK;
+}
+
+cm_error_t cm_validate(const char *data, size_t size)
+{
+    const char *end = data + size;
+    cm_error_t error = cm_skip(&data, end);
+
+    if (error == CM_OK && data != end)
+        return CM_ERROR_TRAILING_DATA;
+
+    return error;
+}
+
+const char *cm_error_string(cm_error_t error)
+{
+    switch (error)
+    {
+    case CM_OK:
+        return "No error";
+    case CM_ERROR_INCOMPLETE:
+        return "Received incomplete encoded data, the buffer ended before the encoded data pattern ended";
+    case CM_ERROR_INVALID_HEADER:
+        return "Got an invalid header while decoding data";
+    case CM_ERROR_TRAILING_DATA:
+        return "The encoded data pattern ended before the buffer ended";
+    default:
+        return "Unknown error";
+    }
+}
+
+
+////////////////////
+//    HASHING     //
+////////////////////
+
+// XXH64, following the reference implementation at https://github.com/Cyan4973/xxHash
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// XXH64 reads its input little-endian
+static inline uint64_t xxh_read64(const unsigned char *p)
+{
+    uint64_t num;
+    memcpy(&num, p, 8);
+
+#ifdef CM_BIG_ENDIAN
+    num = CM_BIG_64(num);
+#endif
+
+    return num;
+}
+
+static inline uint32_t xxh_read32(const unsigned char *p)
+{
+    uint32_t num;
+    memcpy(&num, p, 4);
+
+#ifdef CM_BIG_ENDIAN
+    num = CM_BIG_32(num);
+#endif
+
+    return num;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t cm_xxh64(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + size;
+
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        // Four lanes of 8 bytes each
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+
+        const unsigned char *limit = end - 32;
+
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+
+        h = xxh_merge_round(h, v1);
+        h = xxh_merge_round(h, v2);
+        h = xxh_merge_round(h, v3);
+        h = xxh_merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t)size;
+
+    // Process the remaining bytes
+    while (end - p >= 8)
+    {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if (end - p >= 4)
+    {
+        h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+        h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= (*p++) * XXH_PRIME64_5;
+        h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+// CRC32C (Castagnoli), using the CPU's CRC instructions where available
+
+static const uint32_t crc32c_table[256] = {
+    0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4, 0xC79A971F, 0x35F1141C, 0x26A1E7E8, 0xD4CA64EB,
+    0x8AD958CF, 0x78B2DBCC, 0x6BE22838, 0x9989AB3B, 0x4D43CFD0, 0xBF284CD3, 0xAC78BF27, 0x5E133C24,
+    0x105EC76F, 0xE235446C, 0xF165B798, 0x030E349B, 0xD7C45070, 0x25AFD373, 0x36FF2087, 0xC494A384,
+    0x9A879FA0, 0x68EC1CA3, 0x7BBCEF57, 0x89D76C54, 0x5D1D08BF, 0xAF768BBC, 0xBC267848, 0x4E4DFB4B,
+    0x20BD8EDE, 0xD2D60DDD, 0xC186FE29, 0x33ED7D2A, 0xE72719C1, 0x154C9AC2, 0x061C6936, 0xF477EA35,
+    0xAA64D611, 0x580F5512, 0x4B5FA6E6, 0xB93425E5, 0x6DFE410E, 0x9F95C20D, 0x8CC531F9, 0x7EAEB2FA,
+    0x30E349B1, 0xC288CAB2, 0xD1D83946, 0x23B3BA45, 0xF779DEAE, 0x05125DAD, 0x1642AE59, 0xE4292D5A,
+    0xBA3A117E, 0x4851927D, 0x5B016189, 0xA96AE28A, 0x7DA08661, 0x8FCB0562, 0x9C9BF696, 0x6EF07595,
+    0x417B1DBC, 0xB3109EBF, 0xA0406D4B, 0x522BEE48, 0x86E18AA3, 0x748A09A0, 0x67DAFA54, 0x95B17957,
+    0xCBA24573, 0x39C9C670, 0x2A993584, 0xD8F2B687, 0x0C38D26C, 0xFE53516F, 0xED03A29B, 0x1F682198,
+    0x5125DAD3, 0xA34E59D0, 0xB01EAA24, 0x42752927, 0x96BF4DCC, 0x64D4CECF, 0x77843D3B, 0x85EFBE38,
+    0xDBFC821C, 0x2997011F, 0x3AC7F2EB, 0xC8AC71E8, 0x1C661503, 0xEE0D9600, 0xFD5D65F4, 0x0F36E6F7,
+    0x61C69362, 0x93AD1061, 0x80FDE395, 0x72966096, 0xA65C047D, 0x5437877E, 0x4767748A, 0xB50CF789,
+    0xEB1FCBAD, 0x197448AE, 0x0A24BB5A, 0xF84F3859, 0x2C855CB2, 0xDEEEDFB1, 0xCDBE2C45, 0x3FD5AF46,
+    0x7198540D, 0x83F3D70E, 0x90A324FA, 0x62C8A7F9, 0xB602C312, 0x44694011, 0x5739B3E5, 0xA55230E6,
+    0xFB410CC2, 0x092A8FC1, 0x1A7A7C35, 0xE811FF36, 0x3CDB9BDD, 0xCEB018DE, 0xDDE0EB2A, 0x2F8B6829,
+    0x82F63B78, 0x709DB87B, 0x63CD4B8F, 0x91A6C88C, 0x456CAC67, 0xB7072F64, 0xA457DC90, 0x563C5F93,
+    0x082F63B7, 0xFA44E0B4, 0xE9141340, 0x1B7F9043, 0xCFB5F4A8, 0x3DDE77AB, 0x2E8E845F, 0xDCE5075C,
+    0x92A8FC17, 0x60C37F14, 0x73938CE0, 0x81F80FE3, 0x55326B08, 0xA759E80B, 0xB4091BFF, 0x466298FC,
+    0x1871A4D8, 0xEA1A27DB, 0xF94AD42F, 0x0B21572C, 0xDFEB33C7, 0x2D80B0C4, 0x3ED04330, 0xCCBBC033,
+    0xA24BB5A6, 0x502036A5, 0x4370C551, 0xB11B4652, 0x65D122B9, 0x97BAA1BA, 0x84EA524E, 0x7681D14D,
+    0x2892ED69, 0xDAF96E6A, 0xC9A99D9E, 0x3BC21E9D, 0xEF087A76, 0x1D63F975, 0x0E330A81, 0xFC588982,
+    0xB21572C9, 0x407EF1CA, 0x532E023E, 0xA145813D, 0x758FE5D6, 0x87E466D5, 0x94B49521, 0x66DF1622,
+    0x38CC2A06, 0xCAA7A905, 0xD9F75AF1, 0x2B9CD9F2, 0xFF56BD19, 0x0D3D3E1A, 0x1E6DCDEE, 0xEC064EED,
+    0xC38D26C4, 0x31E6A5C7, 0x22B65633, 0xD0DDD530, 0x0417B1DB, 0xF67C32D8, 0xE52CC12C, 0x1747422F,
+    0x49547E0B, 0xBB3FFD08, 0xA86F0EFC, 0x5A048DFF, 0x8ECEE914, 0x7CA56A17, 0x6FF599E3, 0x9D9E1AE0,
+    0xD3D3E1AB, 0x21B862A8, 0x32E8915C, 0xC083125F, 0x144976B4, 0xE622F5B7, 0xF5720643, 0x07198540,
+    0x590AB964, 0xAB613A67, 0xB831C993, 0x4A5A4A90, 0x9E902E7B, 0x6CFBAD78, 0x7FAB5E8C, 0x8DC0DD8F,
+    0xE330A81A, 0x115B2B19, 0x020BD8ED, 0xF0605BEE, 0x24AA3F05, 0xD6C1BC06, 0xC5914FF2, 0x37FACCF1,
+    0x69E9F0D5, 0x9B8273D6, 0x88D28022, 0x7AB90321, 0xAE7367CA, 0x5C18E4C9, 0x4F48173D, 0xBD23943E,
+    0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
+    0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351,
+};
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t size)
+{
+    while (size--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+    #include <nmmintrin.h>
+
+    #define CRC32C_HW_RUNTIME
+
+    // Compiled for SSE4.2 regardless of the build flags, and only called if the CPU supports it
+    __attribute__((target("sse4.2")))
+    static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t size)
+    {
+    #ifdef __x86_64__
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint64_t chunk;
+            memcpy(&chunk, p, 8);
+            crc = (uint32_t)_mm_crc32_u64(crc, chunk);
+        }
+    #endif
+
+        for (; size >= 4; size -= 4, p += 4)
+        {
+            uint32_t chunk;
+            memcpy(&chunk, p, 4);
+            crc = _mm_crc32_u32(crc, chunk);
+        }
+
+        while (size--)
+            crc = _mm_crc32_u8(crc, *p++);
+
+        return crc;
+    }
+
+#elif defined(__ARM_FEATURE_CRC32)
+
+    #include <arm_acle.h>
+
+    #define CRC32C_HW
+
+    static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t size)
+    {
+        for (; size >= 8; size -= 8, p += 8)
+        {
+            uint64_t chunk;
+            memcpy(&chunk, p, 8);
+            crc = __crc32cd(crc, chunk);
+        }
+
+        while (size--)
+            crc = __crc32cb(crc, *p++);
+
+        return crc;
+    }
+
+#endif
+
+uint32_t cm_crc32c(uint32_t crc, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+
+    crc = ~crc;
+
+#if defined(CRC32C_HW_RUNTIME)
+    crc = __builtin_cpu_supports("sse4.2") ? crc32c_hw(crc, p, size) : crc32c_sw(crc, p, size);
+#elif defined(CRC32C_HW)
+    crc = crc32c_hw(crc, p, size);
+#else
+    crc = crc32c_sw(crc, p, size);
+#endif
+
+    return ~crc;
+}
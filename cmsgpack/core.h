@@ -0,0 +1,401 @@
+#ifndef CMSGPACK_CORE_H
+#define CMSGPACK_CORE_H
+
+/* # Core codec
+ *
+ * CPython-independent functions for writing and reading MessagePack data. These are used by the
+ * Python extension, and can be used by C/C++ code directly by linking the installed `libcmsgpack_core.a`,
+ * or by compiling `core.c` alongside this header.
+ *
+ * Writing:
+ * - The `cm_write_*` functions write a header (and the value, for scalars) to `out` and return the number of bytes written.
+ *   `out` must have at least `CM_MAX_HEADER_SIZE` bytes available. Functions that take a size return 0 if the size exceeds the limit.
+ *
+ * Reading:
+ * - `cm_read_header` parses a single header, including the value of scalars.
+ * - `cm_skip` skips over a single object, including all items of containers.
+ * - `cm_validate` checks if a buffer holds exactly one object.
+ * - The `cm_load_*` functions convert big-endian data to native numbers.
+ *
+ * Functions that read data take a pointer to the reading offset, which is advanced past the data that was read.
+ * On an error, the offset points to the header that caused the error.
+ *
+ * Hashing:
+ * - `cm_xxh64` and `cm_crc32c` hash encoded data, for checksums and content addressing.
+ */
+
+#include "masks.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+//////////////////////
+//  SUPPORT CHECKS  //
+//////////////////////
+
+// Checks for builtins, always resulting in false if the compiler can't check
+#ifdef __has_builtin
+    #define CM_HAS_BUILTIN(name) __has_builtin(name)
+#else
+    #define CM_HAS_BUILTIN(name) 0
+#endif
+
+#if !defined(CM_BIG_ENDIAN) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define CM_BIG_ENDIAN
+#endif
+
+
+//////////////////
+//  ENDIANNESS  //
+//////////////////
+
+#ifdef CM_BIG_ENDIAN
+
+    #define CM_BIG_64(x) (x)
+    #define CM_BIG_32(x) (x)
+    #define CM_BIG_DOUBLE(x) ((void)0)
+
+#else
+
+    #if CM_HAS_BUILTIN(__builtin_bswap64) && CM_HAS_BUILTIN(__builtin_bswap32)
+
+        #define CM_BIG_64(x) (__builtin_bswap64((uint64_t)(x)))
+        #define CM_BIG_32(x) (__builtin_bswap32((uint32_t)(x)))
+
+    #else
+
+        #define CM_BIG_64(x) ( \
+            (((x) >> 56) & 0x00000000000000FF) | \
+            (((x) >> 40) & 0x000000000000FF00) | \
+            (((x) >> 24) & 0x0000000000FF0000) | \
+            (((x) >>  8) & 0x00000000FF000000) | \
+            (((x) <<  8) & 0x000000FF00000000) | \
+            (((x) << 24) & 0x0000FF0000000000) | \
+            (((x) << 40) & 0x00FF000000000000) | \
+            (((x) << 56) & 0xFF00000000000000)   \
+        )
+
+        #define CM_BIG_32(x) ( \
+            (((x) >> 24) & 0x000000FF) | \
+            (((x) >>  8) & 0x0000FF00) | \
+            (((x) <<  8) & 0x00FF0000) | \
+            (((x) << 24) & 0xFF000000)   \
+        )
+
+    #endif
+
+    #define CM_BIG_DOUBLE(x) do { \
+        uint64_t tmp; \
+        memcpy(&tmp, &(x), 8); \
+        tmp = CM_BIG_64(tmp); \
+        memcpy(&(x), &tmp, 8); \
+    } while (0)
+
+#endif
+
+
+///////////////////
+//     TYPES     //
+///////////////////
+
+// The maximum number of bytes a header (or scalar value) takes up
+#define CM_MAX_HEADER_SIZE 9
+
+typedef enum {
+    CM_OK = 0,
+    CM_ERROR_INCOMPLETE,     // The data ended before the encoded object ended
+    CM_ERROR_INVALID_HEADER, // Got a header byte that isn't valid
+    CM_ERROR_TRAILING_DATA,  // The data continued after the encoded object ended
+} cm_error_t;
+
+typedef enum {
+    CM_TYPE_NIL,
+    CM_TYPE_BOOL,
+    CM_TYPE_UINT,
+    CM_TYPE_INT,
+    CM_TYPE_FLOAT,
+    CM_TYPE_STR,
+    CM_TYPE_BIN,
+    CM_TYPE_ARRAY,
+    CM_TYPE_MAP,
+    CM_TYPE_EXT,
+} cm_type_t;
+
+typedef struct {
+    cm_type_t type;
+    uint64_t size; // Data size for STR, BIN, and EXT, number of items for ARRAY, and number of pairs for MAP
+
+    // The value of scalar types
+    union {
+        bool b;
+        uint64_t u;
+        int64_t i;
+        double f;
+    } value;
+
+    int8_t ext_id; // The ID of EXT types
+} cm_header_t;
+
+
+/////////////////////
+//  LOADING DATA  //
+/////////////////////
+
+static inline uint16_t cm_load_u16(const char *data)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t cm_load_u32(const char *data)
+{
+    uint32_t num;
+    memcpy(&num, data, 4);
+    return CM_BIG_32(num);
+}
+
+static inline uint64_t cm_load_u64(const char *data)
+{
+    uint64_t num;
+    memcpy(&num, data, 8);
+    return CM_BIG_64(num);
+}
+
+static inline double cm_load_float(const char *data)
+{
+    // Swap the bytes before reinterpreting them, and use type promotion to convert to double
+    uint32_t bits = cm_load_u32(data);
+
+    float num;
+    memcpy(&num, &bits, 4);
+
+    return (double)num;
+}
+
+static inline double cm_load_double(const char *data)
+{
+    uint64_t bits = cm_load_u64(data);
+
+    double num;
+    memcpy(&num, &bits, 8);
+
+    return num;
+}
+
+
+////////////////////
+//  WRITING DATA  //
+////////////////////
+
+// Write a header's typemask and its size based on the number of bytes the size should take up.
+// NBYTES can be 0 for FIXSIZE, 1 for SMALL, 2 for MEDIUM, 4 for LARGE, and 8 for 64-bit int/uint cases
+static inline size_t cm_write_mask(char *out, const unsigned char mask, const uint64_t size, const size_t nbytes)
+{
+    if (nbytes == 0) // FIXSIZE
+    {
+        out[0] = (char)(mask | size);
+        return 1;
+    }
+
+    out[0] = (char)mask;
+
+    // Write the size big-endian, the casts truncate to the lowest byte
+    for (size_t i = 0; i < nbytes; ++i)
+        out[1 + i] = (char)(size >> (8 * (nbytes - 1 - i)));
+
+    return 1 + nbytes;
+}
+
+static inline size_t cm_write_str_header(char *out, size_t size)
+{
+    if (size <= CM_LIMIT_STR_FIXED)
+        return cm_write_mask(out, CM_DT_STR_FIXED, size, 0);
+    else if (size <= CM_LIMIT_SMALL)
+        return cm_write_mask(out, CM_DT_STR_SMALL, size, 1);
+    else if (size <= CM_LIMIT_MEDIUM)
+        return cm_write_mask(out, CM_DT_STR_MEDIUM, size, 2);
+    else if (size <= CM_LIMIT_LARGE)
+        return cm_write_mask(out, CM_DT_STR_LARGE, size, 4);
+
+    return 0;
+}
+
+static inline size_t cm_write_bin_header(char *out, size_t size)
+{
+    if (size <= CM_LIMIT_SMALL)
+        return cm_write_mask(out, CM_DT_BIN_SMALL, size, 1);
+    else if (size <= CM_LIMIT_MEDIUM)
+        return cm_write_mask(out, CM_DT_BIN_MEDIUM, size, 2);
+    else if (size <= CM_LIMIT_LARGE)
+        return cm_write_mask(out, CM_DT_BIN_LARGE, size, 4);
+
+    return 0;
+}
+
+static inline size_t cm_write_array_header(char *out, size_t nitems)
+{
+    if (nitems <= CM_LIMIT_ARR_FIXED)
+        return cm_write_mask(out, CM_DT_ARR_FIXED, nitems, 0);
+    else if (nitems <= CM_LIMIT_MEDIUM)
+        return cm_write_mask(out, CM_DT_ARR_MEDIUM, nitems, 2);
+    else if (nitems <= CM_LIMIT_LARGE)
+        return cm_write_mask(out, CM_DT_ARR_LARGE, nitems, 4);
+
+    return 0;
+}
+
+static inline size_t cm_write_map_header(char *out, size_t npairs)
+{
+    if (npairs <= CM_LIMIT_MAP_FIXED)
+        return cm_write_mask(out, CM_DT_MAP_FIXED, npairs, 0);
+    else if (npairs <= CM_LIMIT_MEDIUM)
+        return cm_write_mask(out, CM_DT_MAP_MEDIUM, npairs, 2);
+    else if (npairs <= CM_LIMIT_LARGE)
+        return cm_write_mask(out, CM_DT_MAP_LARGE, npairs, 4);
+
+    return 0;
+}
+
+// Write an ext header, including the ID byte
+static inline size_t cm_write_ext_header(char *out, int8_t id, size_t size)
+{
+    size_t n;
+
+    // If the size is a base of 2 and not larger than 16, it can be represented with a fixsize mask
+    const bool is_baseof2 = size != 0 && (size & (size - 1)) == 0;
+    if (size <= 16 && is_baseof2)
+    {
+        const unsigned char fixmask = (
+            size ==  8 ? CM_DT_EXT_FIX8  :
+            size == 16 ? CM_DT_EXT_FIX16 :
+            size ==  4 ? CM_DT_EXT_FIX4  :
+            size ==  2 ? CM_DT_EXT_FIX2  :
+                         CM_DT_EXT_FIX1
+        );
+
+        out[0] = fixmask;
+        n = 1;
+    }
+    else if (size <= CM_LIMIT_SMALL)
+    {
+        n = cm_write_mask(out, CM_DT_EXT_SMALL, size, 1);
+    }
+    else if (size <= CM_LIMIT_MEDIUM)
+    {
+        n = cm_write_mask(out, CM_DT_EXT_MEDIUM, size, 2);
+    }
+    else if (size <= CM_LIMIT_LARGE)
+    {
+        n = cm_write_mask(out, CM_DT_EXT_LARGE, size, 4);
+    }
+    else
+    {
+        return 0;
+    }
+
+    out[n] = id;
+    return n + 1;
+}
+
+static inline size_t cm_write_uint(char *out, uint64_t num)
+{
+    if (num <= CM_LIMIT_UINT_FIXED)
+        return cm_write_mask(out, CM_DT_UINT_FIXED, num, 0);
+    else if (num <= CM_LIMIT_SMALL)
+        return cm_write_mask(out, CM_DT_UINT_BIT8, num, 1);
+    else if (num <= CM_LIMIT_MEDIUM)
+        return cm_write_mask(out, CM_DT_UINT_BIT16, num, 2);
+    else if (num <= CM_LIMIT_LARGE)
+        return cm_write_mask(out, CM_DT_UINT_BIT32, num, 4);
+    else
+        return cm_write_mask(out, CM_DT_UINT_BIT64, num, 8);
+}
+
+static inline size_t cm_write_int(char *out, int64_t num)
+{
+    // Positive values use the smaller unsigned representations
+    if (num >= 0)
+        return cm_write_uint(out, (uint64_t)num);
+
+    if (num >= CM_LIMIT_INT_FIXED)
+        return cm_write_mask(out, CM_DT_INT_FIXED, num, 0);
+    else if (num >= CM_LIMIT_INT_BIT8)
+        return cm_write_mask(out, CM_DT_INT_BIT8, num, 1);
+    else if (num >= CM_LIMIT_INT_BIT16)
+        return cm_write_mask(out, CM_DT_INT_BIT16, num, 2);
+    else if (num >= CM_LIMIT_INT_BIT32)
+        return cm_write_mask(out, CM_DT_INT_BIT32, num, 4);
+    else
+        return cm_write_mask(out, CM_DT_INT_BIT64, num, 8);
+}
+
+static inline size_t cm_write_double(char *out, double num)
+{
+    // Ensure big-endianness
+    CM_BIG_DOUBLE(num);
+
+    out[0] = CM_DT_FLOAT_BIT64;
+    memcpy(out + 1, &num, 8);
+
+    return 9;
+}
+
+static inline size_t cm_write_bool(char *out, bool value)
+{
+    out[0] = value ? CM_DT_TRUE : CM_DT_FALSE;
+    return 1;
+}
+
+static inline size_t cm_write_nil(char *out)
+{
+    out[0] = CM_DT_NIL;
+    return 1;
+}
+
+
+////////////////////
+//  READING DATA  //
+////////////////////
+
+// Read a single header, and the value if it's a scalar
+cm_error_t cm_read_header(const char **data, const char *end, cm_header_t *header);
+
+// Skip over a single object, including all items of containers
+cm_error_t cm_skip(const char **data, const char *end);
+
+// Check if DATA holds exactly one object
+cm_error_t cm_validate(const char *data, size_t size);
+
+// Get a description of an error
+const char *cm_error_string(cm_error_t error);
+
+
+///////////////////
+//    HASHING    //
+///////////////////
+
+typedef enum {
+    CM_HASH_NONE,
+    CM_HASH_XXH64,
+    CM_HASH_CRC32C,
+} cm_hash_t;
+
+// The 64-bit xxHash of DATA
+uint64_t cm_xxh64(const void *data, size_t size, uint64_t seed);
+
+// The CRC-32C (Castagnoli) of DATA, continuing from CRC (0 for the first call)
+uint32_t cm_crc32c(uint32_t crc, const void *data, size_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CMSGPACK_CORE_H
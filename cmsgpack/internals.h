@@ -2,16 +2,6 @@
 #define CMSGPACK_INTERNALS_H
 
 
-//////////////////////
-//  SUPPORT CHECKS  //
-//////////////////////
-
-// Dummy __has_builtin macro always resulting in false
-#ifndef __has_builtin
-    #define __has_builtin(name) 0
-#endif
-
-
 ///////////////////
 //   INTERNALS   //
 ///////////////////
@@ -20,9 +10,12 @@
 #include <stdbool.h>
 
 #if Py_BIG_ENDIAN == 1
-    #define _big_endian
+    #define CM_BIG_ENDIAN
 #endif
 
+// Header writing/parsing and endianness conversion, shared with the C API
+#include "core.h"
+
 #ifdef __always_inline
     #define _always_inline __always_inline
 #else
@@ -43,72 +36,130 @@
     { atomic_flag_clear(flag); }
 
 
-#ifdef _big_endian
+#if defined(_WIN32) || defined(_WIN64)
+
+    #include <io.h>
+
+    #define _ftruncate(file, size) \
+        _chsize_s(_fileno(file), size) != 0
 
-    #define BIG_64(x) (x)
-    #define BIG_32(x) (x)
-    #define BIG_DOUBLE(x) (NULL)
+    #define _fdatasync(file) \
+        _commit(_fileno(file)) != 0
 
-#else
+#elif defined(_POSIX_VERSION)
 
-    #if __has_builtin(__builtin_bswap64) && __has_builtin(__builtin_bswap32)
+    #include <unistd.h>
 
-        #define BIG_64(x) (__builtin_bswap64((uint64_t)(x)))
-        #define BIG_32(x) (__builtin_bswap32((uint32_t)(x)))
+    #define _ftruncate(file, size) \
+        ftruncate(fileno(file), size) != 0
 
+    // macOS doesn't declare fdatasync, fall back to fsync there
+    #if defined(__APPLE__)
+        #define _fdatasync(file) \
+            fsync(fileno(file)) != 0
     #else
+        #define _fdatasync(file) \
+            fdatasync(fileno(file)) != 0
+    #endif
+
+#else
+
+    // Simulate a false return when we don't have a file truncate function
+    #define _ftruncate(file, size) \
+        false
+
+    // Without a sync function, flushing the stdio buffer is all we can do
+    #define _fdatasync(file) \
+        fflush(file) != 0
+
+#endif
+
+
+// Direct I/O, for reading files without going through the page cache
+#if defined(_POSIX_VERSION) && !defined(_WIN32)
 
-        #define BIG_64(x) ( \
-            (((x) >> 56) & 0x00000000000000FF) | \
-            (((x) >> 40) & 0x000000000000FF00) | \
-            (((x) >> 24) & 0x0000000000FF0000) | \
-            (((x) >>  8) & 0x00000000FF000000) | \
-            (((x) <<  8) & 0x000000FF00000000) | \
-            (((x) << 24) & 0x0000FF0000000000) | \
-            (((x) << 40) & 0x00FF000000000000) | \
-            (((x) << 56) & 0xFF00000000000000)   \
-        )
-
-        #define BIG_32(x) ( \
-            (((x) >> 24) & 0x000000FF) | \
-            (((x) >>  8) & 0x0000FF00) | \
-            (((x) <<  8) & 0x00FF0000) | \
-            (((x) << 24) & 0xFF000000)   \
-        )
+    #include <fcntl.h>
 
+    #ifdef O_DIRECT
+        #define _DIRECT_IO_SUPPORTED
     #endif
 
-    #define BIG_DOUBLE(x) do { \
-        uint64_t tmp; \
-        memcpy(&tmp, &(x), 8); \
-        tmp = BIG_64(tmp); \
-        memcpy(&(x), &tmp, 8); \
-    } while (0)
+    #ifdef POSIX_FADV_DONTNEED
+        #define _fadvise(file, offset, len, advice) \
+            posix_fadvise(fileno(file), offset, len, POSIX_FADV_##advice)
+    #endif
+
+#endif
 
+#ifndef _fadvise
+    #define _fadvise(file, offset, len, advice) \
+        0
 #endif
 
 
+// Get a monotonic timestamp in nanoseconds
 #if defined(_WIN32) || defined(_WIN64)
 
-    #include <io.h>
+    #include <windows.h>
 
-    #define _ftruncate(file, size) \
-        _chsize_s(_fileno(file), size) != 0
+    #define _monotonic_ns() \
+        ((uint64_t)GetTickCount64() * 1000000)
 
-#elif defined(_POSIX_VERSION)
+#else
 
-    #include <unistd.h>
+    #include <time.h>
 
-    #define _ftruncate(file, size) \
-        ftruncate(fileno(file), size) != 0
+    static inline uint64_t _monotonic_ns(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    }
+
+#endif
+
+
+// USDT probes for tracing with e.g. bpftrace, enabled by building with the `usdt` option.
+// Each probe has a semaphore that tracers increment when attaching, so the probe arguments
+// (and timestamps for durations) are only computed while a tracer is attached.
+#if defined(CMSGPACK_USDT) && defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #define _SDT_HAS_SEMAPHORES 1
+        #include <sys/sdt.h>
+
+        #define _usdt_enabled
+    #endif
+#endif
+
+#ifdef _usdt_enabled
+
+    // Define the semaphore of a probe, must be done once for each probe in use
+    #define usdt_semaphore(name) \
+        __extension__ unsigned short cmsgpack_##name##_semaphore __attribute__((unused)) __attribute__((section(".probes")));
+
+    // Whether a tracer is attached to the probe
+    #define usdt_active(name) \
+        __builtin_expect(cmsgpack_##name##_semaphore != 0, 0)
+
+    // Fire a probe with at least one argument
+    #define usdt_probe(name, ...) \
+        do { if (usdt_active(name)) STAP_PROBEV(cmsgpack, name, __VA_ARGS__); } while (0)
 
 #else
 
-    // Simulate a false return when we don't have a file truncate function
-    #define _ftruncate(file, size) \
-        false
+    // Takes the probe arguments so that they count as used, calls are removed as dead code
+    static inline void _usdt_discard(int unused, ...) { (void)unused; }
+
+    #define usdt_semaphore(name)
+    #define usdt_active(name) false
+    #define usdt_probe(name, ...) do { if (false) _usdt_discard(0, __VA_ARGS__); } while (0)
 
 #endif
 
+// Get a timestamp for measuring a duration reported by a probe, or zero when nothing is attached to it
+#define usdt_clock(name) \
+    (usdt_active(name) ? _monotonic_ns() : 0)
+
 
 #endif // CMSGPACK_INTERNALS_H
@@ -0,0 +1,144 @@
+import errno
+import os
+import queue
+import threading
+
+from .cmsgpack import FileStream
+
+# The number of records that are passed between threads at once
+BATCH_SIZE = 256
+
+# The number of batches a file can have buffered before its reader waits
+QUEUE_BATCHES = 16
+
+# Marks the end of a file's records in a queue
+_END = object()
+
+
+class _Failure:
+    " Wraps an exception raised in a reader thread, to be re-raised in the consuming thread. "
+
+    def __init__(self, exc):
+        self.exc = exc
+
+
+def _read_file(path, out, stop, stream_kwargs):
+    " Decode all records of a file, and put them in OUT in batches. "
+
+    def put(item):
+        # Check for the stop event regularly, so that the thread exits when the consumer stops early
+        while not stop.is_set():
+            try:
+                out.put(item, timeout=0.1)
+                return True
+
+            except queue.Full:
+                pass
+
+        return False
+
+    try:
+        # FileStream opens files for appending, which would create a missing file instead of failing
+        if isinstance(path, str) and not os.path.exists(path):
+            raise FileNotFoundError(errno.ENOENT, os.strerror(errno.ENOENT), path)
+
+        stream = FileStream(path, **stream_kwargs)
+        decode = stream.decode
+
+        batch = []
+        while True:
+            try:
+                batch.append(decode())
+
+            except EOFError:
+                # Only stop at the end of the file, a record cut off at the end of it is an error
+                if stream.reading_offset != os.path.getsize(path):
+                    raise
+
+                break
+
+            if len(batch) == BATCH_SIZE:
+                if not put(batch):
+                    return
+
+                batch = []
+
+        if batch and not put(batch):
+            return
+
+        put(_END)
+
+    except BaseException as exc:
+        put(_Failure(exc))
+
+
+def scan_files(paths, threads=None, ordered=True, **stream_kwargs):
+    " Decode the records of multiple files concurrently. "
+
+    paths = list(paths)
+
+    if threads is None:
+        threads = os.cpu_count() or 1
+
+    if not isinstance(threads, int) or isinstance(threads, bool):
+        raise TypeError(f"Expected argument 'threads' to be of type 'int', but got an object of type '{type(threads).__name__}'")
+
+    if threads < 1:
+        raise ValueError("The value of argument 'threads' must be at least 1")
+
+    threads = min(threads, len(paths)) or 1
+
+    stop = threading.Event()
+
+    # Files are handed out in order, so that the file being consumed is always being read when ordered
+    pending = queue.SimpleQueue()
+    for i in range(len(paths)):
+        pending.put(i)
+
+    if ordered:
+        outputs = [queue.Queue(QUEUE_BATCHES) for _ in paths]
+    else:
+        shared = queue.Queue(QUEUE_BATCHES * threads)
+        outputs = [shared] * len(paths)
+
+    def worker():
+        while not stop.is_set():
+            try:
+                i = pending.get_nowait()
+
+            except queue.Empty:
+                return
+
+            _read_file(paths[i], outputs[i], stop, stream_kwargs)
+
+    workers = [threading.Thread(target=worker, daemon=True) for _ in range(threads)]
+
+    for w in workers:
+        w.start()
+
+    try:
+        if ordered:
+            for out in outputs:
+                while (item := out.get()) is not _END:
+                    if isinstance(item, _Failure):
+                        raise item.exc
+
+                    yield from item
+        else:
+            remaining = len(paths)
+            while remaining:
+                item = shared.get()
+
+                if item is _END:
+                    remaining -= 1
+                elif isinstance(item, _Failure):
+                    raise item.exc
+                else:
+                    yield from item
+
+    finally:
+        # Let the readers exit when we're done, or when the consumer stopped early
+        stop.set()
+
+        for w in workers:
+            w.join()
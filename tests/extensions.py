@@ -75,6 +75,15 @@ test.exception(lambda: ext.add(1234, str, lambda: None, lambda: None), ValueErro
 test.exception(lambda: ext.add_encode(1234, str, lambda: None), ValueError)
 test.exception(lambda: ext.add_decode(1234, lambda: None), ValueError)
 
+# Test if the IDs of shared references (127), out-of-band buffers (126), and integer arrays (125) can't be registered
+for reserved_id in (125, 126, 127):
+    test.exception(lambda: cm.Extensions({reserved_id: (str, lambda: None, lambda: None)}), ValueError)
+    test.exception(lambda: ext.add(reserved_id, str, lambda: None, lambda: None), ValueError)
+    test.exception(lambda: ext.add_encode(reserved_id, str, lambda: None), ValueError)
+    test.exception(lambda: ext.add_decode(reserved_id, lambda: None), ValueError)
+
+test.success(lambda: cm.Extensions().add(124, str, lambda: None, lambda: None))
+
 # Test if an incorrect number of arguments is caught
 test.exception(lambda: ext.add(), TypeError)
 test.exception(lambda: ext.add(1, 2, 3, 4, 5), TypeError)
@@ -151,5 +160,247 @@ ext = cm.Extensions({ID_COMPLEX: (complex, encode_complex, decode_complex)}, pas
 test.exception(lambda: cm.decode(cm.encode(2j + 3, extensions=ext), extensions=ext), TypeError)
 
 
+# Batched functions, which record the size of each batch they get
+
+batch_sizes = []
+
+def encode_complex_batch(objs: list):
+    batch_sizes.append(len(objs))
+    return [encode_complex(obj) for obj in objs]
+
+def decode_complex_batch(bufs: list):
+    batch_sizes.append(len(bufs))
+    return [decode_complex(bytes(b)) for b in bufs]
+
+ext = cm.Extensions()
+ext.add(ID_COMPLEX, complex, encode_complex_batch, decode_complex_batch, batch=True)
+ext.add(ID_MYCLASS, MyClass, encode_myclass, decode_myclass)
+
+batch_value = [1j, {"a": 2j, "b": [3j, MyClass("x"), 4j]}, "c", 5j + 1]
+
+# Test if a batched function is called once for the whole object, and the data matches the non-batched encoding
+encoded = cm.encode(batch_value, extensions=ext)
+test.equal(batch_sizes, [5])
+test.equal(encoded, cm.encode(batch_value, extensions=cm.Extensions(ext_types)))
+
+test.equal(cm.decode(encoded, extensions=ext), batch_value)
+test.equal(batch_sizes, [5, 5])
+
+# Test if batched values work as the top-level object, as map keys, and with duplicate map keys
+batch_sizes.clear()
+test.equal(cm.decode(cm.encode(6j, extensions=ext), extensions=ext), 6j)
+test.equal(cm.decode(cm.encode({7j: 8j, 9j: "a"}, extensions=ext), extensions=ext), {7j: 8j, 9j: "a"})
+test.equal(cm.decode(b"\x82\xa1a\xd4\x01" + b"1" + b"\xa1a\xd4\x01" + b"2", extensions=ext), {"a": 2})
+test.equal(cm.decode(b"\x82\xa1a\xd4\x01" + b"1" + b"\xa1a\x03", extensions=ext), {"a": 3})
+
+# Test if batched functions are called with a single value while patching
+test.equal(cm.decode(cm.patch(cm.encode([1j], extensions=ext), [0], 2j, extensions=ext), extensions=ext), [2j])
+
+# Test if the results of batched functions are validated
+ext.add(ID_COMPLEX, complex, lambda objs: [b"1"], lambda bufs: [1], batch=True)
+test.exception(lambda: cm.encode([1j, 2j], extensions=ext), ValueError)
+test.exception(lambda: cm.decode(b"\x92\xd4\x01" + b"1" + b"\xd4\x01" + b"2", extensions=ext), ValueError)
+
+ext.add(ID_COMPLEX, complex, lambda objs: 123, lambda bufs: 123, batch=True)
+test.exception(lambda: cm.encode([1j], extensions=ext), TypeError)
+test.exception(lambda: cm.decode(b"\x91\xd4\x01" + b"1", extensions=ext), TypeError)
+
+ext.add(ID_COMPLEX, complex, lambda objs: [123] * len(objs), decode_complex_batch, batch=True)
+test.exception(lambda: cm.encode([1j, 2j], extensions=ext), TypeError)
+
+# Test if the batch argument is type-checked
+test.exception(lambda: ext.add_decode(ID_COMPLEX, decode_complex_batch, batch=1), TypeError)
+
+# Test if batched values are resolved when streaming from a file
+FNAME = "extensions_test.bin"
+
+ext.add(ID_COMPLEX, complex, encode_complex_batch, decode_complex_batch, batch=True)
+ext.pass_memoryview = True
+
+file_value = [1j, {"a": 2j, "b": [3j, "x" * 100, 4j]}]
+
+fstream = cm.FileStream(FNAME, extensions=ext, chunk_size=16)
+batch_sizes.clear()
+fstream.encode(file_value)
+fstream.encode([10j] * 20)
+
+# Values are batched until the first part is written to the file, and written per value after that
+test.equal(batch_sizes, [3, 1, 20])
+
+test.equal(fstream.decode(), file_value)
+test.equal(fstream.decode(), [10j] * 20)
+
+# Test if values are batched as long as nothing was written to the file yet
+fstream = cm.FileStream(FNAME, extensions=ext)
+batch_sizes.clear()
+fstream.encode(file_value)
+fstream.encode([10j] * 20)
+test.equal(batch_sizes, [4, 20])
+
+# Test if writing a record while writing another one from the same thread raises an error, instead of waiting on itself
+ext_write = cm.Extensions()
+ext_write.add_encode(ID_COMPLEX, complex, lambda obj: fstream.encode("inner") and b"")
+
+fstream = cm.FileStream(FNAME, extensions=ext_write, chunk_size=64)
+test.exception(lambda: fstream.encode(["x" * 100, 1j]), RuntimeError)
+test.success(lambda: fstream.encode([1j, "x" * 100]))
+
+del fstream
+
+import os
+os.remove(FNAME)
+
+
+# Test encoding functions that write directly to the output
+
+def encode_complex_into(obj: complex, out: memoryview):
+    data = encode_complex(obj)
+    out[:len(data)] = data
+    return len(data)
+
+ext = cm.Extensions()
+ext.add(ID_COMPLEX, complex, encode_complex_into, decode_complex, size=64)
+
+sized_value = [1j, {"a": 2j + 3}, 4.5j, "b"]
+encoded = cm.encode(sized_value, extensions=ext)
+
+test.equal(encoded, cm.encode(sized_value, extensions=cm.Extensions(ext_types)))
+test.equal(cm.decode(encoded, extensions=ext), sized_value)
+
+# Test if fixed-size data that fills the view exactly is written as-is
+ext.add_encode(ID_COMPLEX, complex, lambda obj, out: out.__setitem__(slice(None), b"x" * 16) or 16, size=16)
+test.equal(cm.encode(1j, extensions=ext), b"\xd8\x01" + b"x" * 16)
+
+# Test if the returned size is validated
+ext.add_encode(ID_COMPLEX, complex, lambda obj, out: 17, size=16)
+test.exception(lambda: cm.encode(1j, extensions=ext), ValueError)
+
+ext.add_encode(ID_COMPLEX, complex, lambda obj, out: b"", size=16)
+test.exception(lambda: cm.encode(1j, extensions=ext), TypeError)
+
+# Test if the view can't be used after the function returns
+views = []
+ext.add_encode(ID_COMPLEX, complex, lambda obj, out: views.append(out) or 0, size=16)
+cm.encode(1j, extensions=ext)
+test.exception(lambda: views[0][0], ValueError)
+
+# Test if views derived from the view can't outlive the function either
+views = []
+ext.add_encode(ID_COMPLEX, complex, lambda obj, out: views.append(out[0:16]) or 0, size=16)
+test.exception(lambda: cm.encode(1j, extensions=ext), BufferError)
+test.exception(lambda: views[0][0], ValueError)
+test.exception(lambda: bytes(views[0]), ValueError)
+
+# Test if exceptions raised by the function are passed on
+ext.add_encode(ID_COMPLEX, complex, lambda obj, out: views.append(out[0:16]) or 1 / 0, size=16)
+test.exception(lambda: cm.encode(1j, extensions=ext), ZeroDivisionError)
+test.exception(lambda: views[-1][0], ValueError)
+
+# Test if the size argument is validated
+test.exception(lambda: ext.add_encode(ID_COMPLEX, complex, encode_complex_into, size=0), ValueError)
+test.exception(lambda: ext.add_encode(ID_COMPLEX, complex, encode_complex_into, size=2**32), ValueError)
+test.exception(lambda: ext.add_encode(ID_COMPLEX, complex, encode_complex_into, size=16, batch=True), ValueError)
+test.exception(lambda: ext.add_decode(ID_COMPLEX, decode_complex, size=16), TypeError)
+
+
+# Test nested extension types, whose data is an encoded object
+
+class Point:
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+
+    def __eq__(self, other):
+        return isinstance(other, Point) and (other.x, other.y) == (self.x, self.y)
+
+ID_POINT = 3
+
+ext = cm.Extensions()
+ext.add(ID_POINT, Point, lambda p: [p.x, p.y], lambda args: Point(*args), nested=True)
+ext.add(ID_COMPLEX, complex, encode_complex_batch, decode_complex_batch, batch=True)
+
+nested_value = [Point(1, 2), {"a": Point(Point(3, 4), [5j, "x" * 300])}, 6j]
+encoded = cm.encode(nested_value, extensions=ext)
+
+# Test if the data matches a Python function that encodes and decodes the data itself
+python_ext = cm.Extensions(ext_types)
+python_ext.add(ID_POINT, Point, lambda p: cm.encode([p.x, p.y], extensions=python_ext), lambda b: Point(*cm.decode(b, extensions=python_ext)))
+
+test.equal(encoded, cm.encode(nested_value, extensions=python_ext))
+test.equal(cm.decode(encoded, extensions=ext), nested_value)
+
+# Test if nested data is validated
+test.exception(lambda: cm.decode(b"\xd5\x03\x01\x02", extensions=ext), ValueError)
+test.exception(lambda: cm.decode(b"\xd5\x03\x92\x01", extensions=ext), ValueError)
+
+# Test if objects returning themselves hit the recursion limit
+ext_self = cm.Extensions()
+ext_self.add_encode(ID_POINT, Point, lambda p: p, nested=True)
+test.exception(lambda: cm.encode(Point(1, 2), extensions=ext_self), RecursionError)
+
+# Test if the options are validated
+test.exception(lambda: ext.add_decode(ID_POINT, Point, nested=True, batch=True), ValueError)
+test.exception(lambda: ext.add_encode(ID_POINT, Point, Point, nested=True, size=16), ValueError)
+
+
+# Test native functions registered through the C API, called through ctypes
+
+import ctypes
+
+class CAPI(ctypes.Structure):
+    _fields_ = [("version", ctypes.c_int), ("add_encode", ctypes.c_void_p), ("add_decode", ctypes.c_void_p)]
+
+get_pointer = ctypes.pythonapi.PyCapsule_GetPointer
+get_pointer.restype = ctypes.c_void_p
+get_pointer.argtypes = [ctypes.py_object, ctypes.c_char_p]
+
+capi = CAPI.from_address(get_pointer(cm._C_API, b"cmsgpack._C_API"))
+test.equal(capi.version, 1)
+
+NATIVE_ENCODE = ctypes.PYFUNCTYPE(ctypes.c_ssize_t, ctypes.py_object, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p)
+NATIVE_DECODE = ctypes.PYFUNCTYPE(ctypes.py_object, ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p)
+
+add_encode = ctypes.PYFUNCTYPE(ctypes.c_int, ctypes.py_object, ctypes.c_int, ctypes.py_object, NATIVE_ENCODE, ctypes.c_void_p)(capi.add_encode)
+add_decode = ctypes.PYFUNCTYPE(ctypes.c_int, ctypes.py_object, ctypes.c_int, NATIVE_DECODE, ctypes.c_void_p)(capi.add_decode)
+
+@NATIVE_ENCODE
+def native_encode(obj, out, size, ctx):
+    data = encode_myclass(obj)
+
+    if len(data) <= size:
+        ctypes.memmove(out, data, len(data))
+
+    return len(data)
+
+@NATIVE_DECODE
+def native_decode(data, size, ctx):
+    return MyClass(ctypes.string_at(data, size).decode())
+
+ext = cm.Extensions()
+test.equal(add_encode(ext, ID_MYCLASS, MyClass, native_encode, None), 0)
+test.equal(add_decode(ext, ID_MYCLASS, native_decode, None), 0)
+
+# Test if native functions produce the same data as Python functions, including data that doesn't fit the buffer right away
+native_value = [MyClass("a"), {"b": MyClass("c" * 100_000)}, MyClass("")]
+encoded = cm.encode(native_value, extensions=ext)
+
+test.equal(encoded, cm.encode(native_value, extensions=cm.Extensions(ext_types)))
+test.equal(cm.decode(encoded, extensions=ext), native_value)
+
+# Test if Python functions replace native ones and vice versa
+ext.add_decode(ID_MYCLASS, lambda b: "python")
+test.equal(cm.decode(encoded, extensions=ext), ["python", {"b": "python"}, "python"])
+
+add_decode(ext, ID_MYCLASS, native_decode, None)
+ext.remove_decode(ID_MYCLASS)
+test.exception(lambda: cm.decode(encoded, extensions=ext), TypeError)
+
+# Test if the arguments are validated
+test.exception(lambda: add_decode(ext, 128, native_decode, None), ValueError)
+test.exception(lambda: add_decode(ext, 127, native_decode, None), ValueError)
+test.exception(lambda: add_encode(ext, 125, MyClass, native_encode, None), ValueError)
+test.exception(lambda: add_decode(123, ID_MYCLASS, native_decode, None), TypeError)
+
+
 test.print()
 
@@ -7,6 +7,7 @@ from test_values import test_values
 from test import Test
 
 import os
+import tracemalloc
 
 
 FNAME = "files_test.bin"
@@ -101,6 +102,229 @@ stream_rdoff = cm.FileStream(FNAME, reading_offset=1)
 stream_rdoff.encode(test_values)
 test.equal(test_values, stream_rdoff.decode())
 
+# Clear the file contents
+open(FNAME, "wb")
+
+# Test if values larger than the chunk size are read correctly
+stream_small = cm.FileStream(FNAME, chunk_size=64)
+large = ["a" * 1000, "\u20ac" * 1000, b"\x01" * 100_000, {"small": 1, "large": b"\x02" * 1000}]
+for v in large:
+    stream_small.encode(v)
+
+for v in large:
+    test.equal(v, stream_small.decode())
+
+# Test if the file buffer shrinks back to the chunk size after an ext record that had to be buffered in full
+class Large:
+    pass
+
+ext_large = cm.Extensions()
+ext_large.add(1, Large, lambda obj: b"\x03" * 100_000, lambda data: Large())
+
+stream_small.extensions = ext_large
+stream_small.encode(Large())
+
+tracemalloc.start()
+before, _ = tracemalloc.get_traced_memory()
+test.equal(Large, type(stream_small.decode()))
+after, _ = tracemalloc.get_traced_memory()
+tracemalloc.stop()
+
+# The file buffer is allocated with the traced raw allocator, so keeping the grown buffer would show up here
+test.equal(True, after - before < 1000)
+
+# Test if small records following large ones are still read correctly
+stream_small.encode(1)
+stream_small.encode([1, 2, 3])
+test.equal(1, stream_small.decode())
+test.equal([1, 2, 3], stream_small.decode())
+
+# Test if a value that's cut off by EOF is caught
+open(FNAME, "wb").write(cm.encode(b"\x03" * 1000)[:500])
+stream_cut = cm.FileStream(FNAME, chunk_size=64)
+test.exception(lambda: stream_cut.decode(), EOFError)
+
+# Test if the record is read again from its start once the rest of it is written
+test.equal(0, stream_cut.reading_offset)
+open(FNAME, "ab").write(cm.encode(b"\x03" * 1000)[500:])
+test.equal(b"\x03" * 1000, stream_cut.decode())
+
+# Clear the file contents
+open(FNAME, "wb")
+
+# Test if reading with direct I/O gives the same results, including for records that cross block boundaries
+stream_direct = cm.FileStream(FNAME, chunk_size=64, direct_io=True)
+test.equal(True, stream_direct.direct_io)
+records = [test_values, "x" * 5000, b"\x04" * 3_000_000] + [[i] * i for i in range(200)]
+for v in records:
+    stream_direct.encode(v)
+
+for v in records:
+    test.equal(v, stream_direct.decode())
+
+# Test if records written after reaching EOF are picked up
+test.exception(lambda: stream_direct.decode(), EOFError)
+stream_direct.encode("after")
+test.equal("after", stream_direct.decode())
+
+# Test if direct I/O can be toggled, and reading continues at the same offset
+stream_direct.reading_offset = 0
+test.equal(test_values, stream_direct.decode())
+stream_direct.direct_io = False
+test.equal("x" * 5000, stream_direct.decode())
+stream_direct.direct_io = True
+test.equal(b"\x04" * 3_000_000, stream_direct.decode())
+test.exception(lambda: cm.FileStream(FNAME, direct_io=1), TypeError)
+
+# Clear the file contents
+open(FNAME, "wb")
+
+# Test if written records get increasing sequence numbers, and syncing makes them durable
+stream_sync = cm.FileStream(FNAME)
+test.equal(1, stream_sync.encode(1))
+test.equal(2, stream_sync.encode(2))
+test.equal(0, stream_sync.durable_seq)
+# A sync covers all records written so far
+test.equal(2, stream_sync.sync(1))
+test.equal(2, stream_sync.sync())
+test.equal(2, stream_sync.durable_seq)
+test.exception(lambda: stream_sync.sync(3), ValueError)
+test.exception(lambda: stream_sync.sync(-1), ValueError)
+test.exception(lambda: stream_sync.sync("1"), TypeError)
+
+# Test if the sync policies are applied on writes
+stream_sync = cm.FileStream(FNAME, sync_records=2)
+stream_sync.encode(1)
+test.equal(0, stream_sync.durable_seq)
+stream_sync.encode(2)
+test.equal(2, stream_sync.durable_seq)
+
+stream_sync = cm.FileStream(FNAME, sync_ms=0)
+stream_sync.sync_ms = 1
+test.equal(1, stream_sync.sync_ms)
+stream_sync.encode(1)
+import time
+time.sleep(0.01)
+stream_sync.encode(2)
+test.equal(2, stream_sync.durable_seq)
+
+test.exception(lambda: cm.FileStream(FNAME, sync_records=-1), ValueError)
+test.exception(lambda: cm.FileStream(FNAME, sync_ms="1"), TypeError)
+
+# Test if concurrent syncs all end up durable
+import threading
+stream_sync = cm.FileStream(FNAME)
+seqs = [stream_sync.encode(i) for i in range(8)]
+threads = [threading.Thread(target=stream_sync.sync, args=(seq,)) for seq in seqs]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
+test.equal(seqs[-1], stream_sync.durable_seq)
+
+# Test if concurrent writers, including ones writing in parts, get unique sequence numbers
+stream_sync = cm.FileStream(FNAME, chunk_size=64, sync_records=3)
+written = []
+writers = [threading.Thread(target=lambda i=i: written.extend(stream_sync.encode(["x" * 100] * i) for _ in range(20))) for i in range(4)]
+for t in writers:
+    t.start()
+for t in writers:
+    t.join()
+test.equal(list(range(1, 81)), sorted(written))
+test.equal(True, stream_sync.durable_seq >= 78)
+
+# Test if the items of arrays and pairs of maps in files can be iterated over, and decoding continues after them
+open(FNAME, "wb")
+stream_iter = cm.FileStream(FNAME, chunk_size=64)
+records = [{"id": i, "data": "x" * (i * 10)} for i in range(20)]
+
+stream_iter.encode(records)
+stream_iter.encode({"a": 1, "b": [2]})
+stream_iter.encode("after")
+
+test.equal(list(stream_iter.iter_array()), records)
+test.equal(list(stream_iter.iter_items()), [("a", 1), ("b", [2])])
+test.equal(stream_iter.decode(), "after")
+
+test.exception(lambda: stream_iter.iter_array(), EOFError)
+stream_iter.encode("not an array")
+test.exception(lambda: stream_iter.iter_array(), TypeError)
+
+# Test if the stream can't be read from while an iterator over it is active, and can again once it's exhausted or dropped
+open(FNAME, "wb")
+stream_iter = cm.FileStream(FNAME, chunk_size=64)
+stream_iter.encode([1, 2, 3])
+stream_iter.encode({"a": 1})
+stream_iter.encode("after")
+
+it = stream_iter.iter_array()
+test.equal(next(it), 1)
+test.exception(lambda: stream_iter.decode(), RuntimeError)
+test.exception(lambda: stream_iter.iter_items(), RuntimeError)
+test.exception(lambda: setattr(stream_iter, "reading_offset", 0), RuntimeError)
+test.equal(list(it), [2, 3])
+
+it = stream_iter.iter_items()
+test.equal(next(it), ("a", 1))
+test.equal(stream_iter.decode(), "after")
+
+stream_iter.reading_offset = 0
+it = stream_iter.iter_array()
+del it
+# Reading continues at the next item of the dropped iterator
+test.equal(stream_iter.decode(), 1)
+
+# Test if objects larger than the chunk size are written while encoding, without buffering the whole object
+open(FNAME, "wb")
+stream_flush = cm.FileStream(FNAME, chunk_size=4096)
+large = ["x" * 1000 for _ in range(1000)]
+
+tracemalloc.start()
+stream_flush.encode(large)
+_, peak = tracemalloc.get_traced_memory()
+tracemalloc.stop()
+
+test.equal(peak < 100_000, True)
+test.equal(os.path.getsize(FNAME), len(cm.encode(large)))
+test.equal(stream_flush.decode(), large)
+
+# Test if partially written objects are removed when encoding fails, and the stream continues normally after
+test.exception(lambda: stream_flush.encode(large + [object()]), TypeError)
+test.equal(os.path.getsize(FNAME), len(cm.encode(large)))
+
+stream_flush.encode(large)
+test.equal(stream_flush.decode(), large)
+
+# Test if single values larger than the chunk size are written straight from the object, without buffering a copy
+single = [1, "y" * 1_000_000, b"\x04" * 1_000_000, bytearray(b"\x05" * 1_000_000), memoryview(b"\x06" * 1_000_000)]
+expected = [1, "y" * 1_000_000, b"\x04" * 1_000_000, b"\x05" * 1_000_000, b"\x06" * 1_000_000]
+
+tracemalloc.start()
+stream_flush.encode(single)
+_, peak = tracemalloc.get_traced_memory()
+tracemalloc.stop()
+
+test.equal(peak < 100_000, True)
+test.equal(stream_flush.decode(), expected)
+
+test.exception(lambda: stream_flush.encode(["z" * 1_000_000, object()]), TypeError)
+stream_flush.encode("z" * 1_000_000)
+test.equal(stream_flush.decode(), "z" * 1_000_000)
+
+# Test if the slow hook gets the start of records read from files, also when they exceeded the file buffer
+open(FNAME, "wb")
+reports = []
+cm.on_slow(0, 1000, lambda *args: reports.append(args), prefix_size=16)
+
+stream_slow = cm.FileStream(FNAME, chunk_size=64)
+stream_slow.encode(1)
+stream_slow.encode("x" * 5000)
+test.equal(stream_slow.decode(), 1)
+test.equal(stream_slow.decode(), "x" * 5000)
+
+test.equal([(kind, size, prefix) for kind, _, size, prefix in reports], [("encode", 5003, cm.encode("x" * 5000)[:16]), ("decode", 5003, cm.encode("x" * 5000)[:16])])
+cm.on_slow(0, 0, None)
+
 test.print()
 
 os.remove(FNAME)
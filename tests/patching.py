@@ -0,0 +1,70 @@
+
+# Test patching of encoded data
+
+import cmsgpack as cm
+
+from test_values import test_values
+from test import Test
+
+
+test = Test()
+
+record = {"id": 1, "name": "abc", "tags": ["a", "b", "c"], "nested": {"inner": True, "list": [1, 2, 3]}}
+encoded = cm.encode(record)
+
+# Test if values can be replaced at every depth
+if test.success(lambda: cm.patch(encoded, ("name",), "def")):
+    test.equal({**record, "name": "def"}, cm.decode(cm.patch(encoded, ("name",), "def")))
+
+test.equal({**record, "tags": ["a", "x", "c"]}, cm.decode(cm.patch(encoded, ["tags", 1], "x")))
+test.equal({**record, "tags": ["a", "b", "x"]}, cm.decode(cm.patch(encoded, ["tags", -1], "x")))
+test.equal({**record, "nested": {"inner": True, "list": [1, 2, test_values]}}, cm.decode(cm.patch(encoded, ("nested", "list", 2), test_values)))
+
+# Test if the whole object is replaced with an empty path
+test.equal(test_values, cm.decode(cm.patch(encoded, (), test_values)))
+
+# Test if a missing last key is added to the map
+test.equal({**record, "new": None}, cm.decode(cm.patch(encoded, ("new",), None)))
+test.equal({**record, "nested": {"inner": True, "list": [1, 2, 3], "new": 1}}, cm.decode(cm.patch(encoded, ("nested", "new"), 1)))
+
+# Test if adding a key updates the header when the map outgrows the fixsize header
+fixmap = {str(i): i for i in range(15)}
+test.equal({**fixmap, "new": 1}, cm.decode(cm.patch(cm.encode(fixmap), ("new",), 1)))
+
+# Test if invalid paths are caught
+test.exception(lambda: cm.patch(encoded, ("missing", "key"), 1), KeyError)
+test.exception(lambda: cm.patch(encoded, ("tags", 3), 1), IndexError)
+test.exception(lambda: cm.patch(encoded, ("tags", "a"), 1), TypeError)
+test.exception(lambda: cm.patch(encoded, ("id", 0), 1), TypeError)
+test.exception(lambda: cm.patch(encoded, "name", 1), TypeError)
+test.exception(lambda: cm.patch(encoded, (1,), 1, str_keys=True), TypeError)
+test.exception(lambda: cm.patch(encoded[:-1], ("nested", "list", 2), 1), ValueError)
+test.exception(lambda: cm.patch(encoded + b"\0", ("nested", "list", 2), 1), ValueError)
+test.exception(lambda: cm.patch(encoded, ("name",), 2j + 3), TypeError)
+
+# Test if maps are merged, with the second map overriding the first
+a = {"a": 1, "b": 2, "c": [3]}
+b = {"b": "override", "d": 4}
+
+if test.success(lambda: cm.merge_maps(cm.encode(a), cm.encode(b))):
+    test.equal({**a, **b}, cm.decode(cm.merge_maps(cm.encode(a), cm.encode(b))))
+
+test.equal(a, cm.decode(cm.merge_maps(cm.encode(a), cm.encode({}))))
+test.equal(b, cm.decode(cm.merge_maps(cm.encode({}), cm.encode(b))))
+
+large_a = {str(i): i for i in range(0x10000)}
+large_b = {str(i): -i for i in range(0x8000, 0x10010)}
+test.equal({**large_a, **large_b}, cm.decode(cm.merge_maps(cm.encode(large_a), cm.encode(large_b))))
+
+# Test if non-map and invalid data is caught
+test.exception(lambda: cm.merge_maps(cm.encode([]), cm.encode(b)), TypeError)
+test.exception(lambda: cm.merge_maps(cm.encode(a), cm.encode(b)[:-1]), ValueError)
+test.exception(lambda: cm.merge_maps(cm.encode(a) + b"\0", cm.encode(b)), ValueError)
+test.exception(lambda: cm.merge_maps(cm.encode({(1,): 1}), cm.encode({(2,): 2})), TypeError)
+
+# Test if string-keys-only is enforced when requested
+test.exception(lambda: cm.merge_maps(cm.encode({1: 1}), cm.encode(b), str_keys=True), TypeError)
+test.exception(lambda: cm.merge_maps(cm.encode(a), cm.encode({1: 1}), str_keys=True), TypeError)
+
+
+test.print()
@@ -6,6 +6,10 @@ import cmsgpack as cm
 from test_values import test_values, list_values, bytes_values
 from test import Test
 
+import array
+import mmap
+import pickle
+
 
 test = Test()
 
@@ -36,6 +40,53 @@ for item in bytes_values:
     if test.success(lambda: cm.decode(cm.encode(item_memoryview))):
         test.equal(item, cm.decode(cm.encode(item_memoryview)))
 
+# Test if other buffer exporters and non-contiguous memoryviews are encoded as their data in C order
+numbers = array.array("q", range(8))
+test.equal(cm.decode(cm.encode(numbers)), numbers.tobytes())
+test.equal(cm.decode(cm.encode([memoryview(numbers)[::-2], 1])), [memoryview(numbers)[::-2].tobytes(), 1])
+test.equal(cm.decode(cm.encode(memoryview(b"abcdefgh")[1::3])), b"beh")
+test.equal(cm.decode(cm.encode(pickle.PickleBuffer(b"data"))), b"data")
+
+mapped = mmap.mmap(-1, 4096)
+mapped[:5] = b"hello"
+test.equal(cm.decode(cm.encode({"blob": mapped}))["blob"][:5], b"hello")
+mapped.close()
+
+# Test if registered ext types still take priority over the buffer
+ext = cm.Extensions()
+ext.add_encode(5, array.array, lambda obj: b"A")
+test.equal(cm.encode(numbers, extensions=ext), b"\xd4\x05A")
+
+# Test if raw objects are written as-is
+raw = cm.Raw(cm.encode(test_values))
+if test.success(lambda: cm.encode([raw, raw])):
+    test.equal([test_values, test_values], cm.decode(cm.encode([raw, raw])))
+
+test.equal(test_values, cm.decode(raw))
+test.equal(cm.encode(test_values), bytes(raw))
+test.equal({"a": 1}, cm.decode(cm.encode({"a": cm.Raw(bytearray(cm.encode(1)))})))
+
+# Test if raw objects are validated when requested
+test.success(lambda: cm.Raw(cm.encode(test_values), validate=True))
+test.exception(lambda: cm.Raw(cm.encode(test_values)[:-1], validate=True), ValueError)
+test.exception(lambda: cm.Raw(cm.encode(1) + cm.encode(2), validate=True), ValueError)
+test.exception(lambda: cm.Raw(b"\xc1", validate=True), ValueError)
+test.exception(lambda: cm.Raw(123), TypeError)
+
+# Test if objects at the requested depth are decoded as raw objects
+envelope = {"type": "forward", "payload": test_values}
+decoded = cm.decode(cm.encode(envelope), raw_depth=1)
+test.equal(cm.encode(test_values), bytes(decoded["payload"]))
+test.equal(envelope, cm.decode(cm.encode(decoded)))
+
+decoded = cm.decode(cm.encode([envelope]), raw_depth=2)
+test.equal("forward", cm.decode(decoded[0]["type"]))
+test.equal(test_values, cm.decode(decoded[0]["payload"]))
+
+test.equal(test_values, cm.decode(cm.encode(test_values), raw_depth=0))
+test.exception(lambda: cm.decode(cm.encode(test_values), raw_depth=-1), ValueError)
+test.exception(lambda: cm.decode(cm.encode([1, 2])[:-1], raw_depth=1), ValueError)
+
 # Test if string-keys-only is enforced when requested
 test.exception(lambda: cm.encode({1: 2}, str_keys=True), TypeError)
 test.exception(lambda: cm.decode(cm.encode({1: 2}), str_keys=True), TypeError)
@@ -44,6 +95,10 @@ test.exception(lambda: cm.decode(cm.encode({1: 2}), str_keys=True), TypeError)
 test.exception(lambda: cm.encode(2**64), OverflowError)
 test.exception(lambda: cm.encode(-(2**63) - 1), OverflowError)
 
+# Test if 32-bit floats from other encoders are decoded correctly
+test.equal(1.5, cm.decode(b"\xca\x3f\xc0\x00\x00"))
+test.equal(-0.25, cm.decode(b"\xca\xbe\x80\x00\x00"))
+
 # Test NaN preservance
 def test_nan():
     import math
@@ -79,5 +134,206 @@ test.success(lambda: cm.encode(None,  extensions=cm.Extensions()))
 test.success(lambda: cm.decode(b"\0", extensions=cm.Extensions()))
 
 
+# Test if the content hash is returned alongside the data
+
+def crc32c(data):
+    crc = 0xFFFFFFFF
+    for byte in data:
+        crc ^= byte
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x82F63B78 if crc & 1 else crc >> 1
+
+    return crc ^ 0xFFFFFFFF
+
+for value in ("123456789", [1, 2, 3] * 100, {"a": "b" * 1000}):
+    encoded = cm.encode(value)
+
+    test.equal(cm.encode(value, hash="crc32c"), (encoded, crc32c(encoded)))
+    test.equal(cm.encode(value, hash=None), encoded)
+
+# Known XXH64 value of b"\xa9123456789"
+test.equal(cm.encode("123456789", hash="xxh64"), (b"\xa9123456789", 0xBD1A0588EA08E44D))
+
+# Test if XXH3, which isn't supported, raises an error naming the supported hashes
+test.exception(lambda: cm.encode(1, hash="xxh3"), ValueError)
+try:
+    cm.encode(1, hash="xxh3")
+except ValueError as e:
+    test.equal("not supported" in str(e), True)
+
+test.exception(lambda: cm.encode(None, hash="md5"), ValueError)
+test.exception(lambda: cm.encode(None, hash=123), ValueError)
+
+# Test if repeated containers keep their shared identity with shared references
+shared = {"a": [1, 2, 3]}
+value = [shared, shared, (shared, shared)]
+
+decoded = cm.decode(cm.encode(value, shared_refs=True), shared_refs=True)
+test.equal(decoded, [shared, shared, [shared, shared]])
+test.equal(decoded[0] is decoded[1] is decoded[2][0] is decoded[2][1], True)
+test.equal(len(cm.encode(value, shared_refs=True)) < len(cm.encode(value)), True)
+
+# Test if cycles are preserved with shared references
+cyclic = [1, 2]
+cyclic.append(cyclic)
+
+decoded = cm.decode(cm.encode(cyclic, shared_refs=True), shared_refs=True)
+test.equal(decoded[2] is decoded, True)
+test.exception(lambda: cm.encode(cyclic), RecursionError)
+
+# Test if containers in raw objects are numbered too
+raw = cm.Raw(cm.encode([[1], {}]))
+decoded = cm.decode(cm.encode([raw, shared, shared], shared_refs=True), shared_refs=True)
+test.equal(decoded, [[[1], {}], shared, shared])
+test.equal(decoded[1] is decoded[2], True)
+
+# Test if invalid references are caught
+test.exception(lambda: cm.decode(b"\x91\xd6\x7f\x00\x00\x00\x05", shared_refs=True), ValueError)
+test.exception(lambda: cm.decode(b"\x91\xd5\x7f\x00\x00", shared_refs=True), ValueError)
+test.exception(lambda: cm.decode(b"\x90", shared_refs=True, raw_depth=1), ValueError)
+
+# Test if decoding objects without a buffer doesn't leak the state of shared references
+import tracemalloc
+
+def decode_non_buffer(n):
+    for _ in range(n):
+        try:
+            cm.decode(123, shared_refs=True)
+        except TypeError:
+            pass
+
+tracemalloc.start()
+decode_non_buffer(100)
+before, _ = tracemalloc.get_traced_memory()
+decode_non_buffer(1000)
+after, _ = tracemalloc.get_traced_memory()
+tracemalloc.stop()
+
+test.equal(True, after - before < 10_000)
+
+# Test if the items of arrays and pairs of maps can be iterated over without decoding the whole container
+items = [1, "a", [2, 3], {"b": None}]
+test.equal(list(cm.iter_array(cm.encode(items))), items)
+test.equal(list(cm.iter_items(cm.encode({"a": 1, "b": [2]}))), [("a", 1), ("b", [2])])
+test.equal(list(cm.iter_array(cm.encode([]))), [])
+
+iterator = cm.iter_array(cm.encode(items))
+test.equal(iterator.__length_hint__(), 4)
+next(iterator)
+test.equal(iterator.__length_hint__(), 3)
+
+test.exception(lambda: cm.iter_array(cm.encode({})), TypeError)
+test.exception(lambda: cm.iter_items(cm.encode([])), TypeError)
+test.exception(lambda: list(cm.iter_items(cm.encode({1: 2}), str_keys=True)), TypeError)
+test.exception(lambda: list(cm.iter_array(cm.encode([1, 2])[:-1])), ValueError)
+test.exception(lambda: list(cm.iter_array(cm.encode([1]) + b"\x00")), ValueError)
+
+# Test if large binary data is passed out-of-band and reinserted as views
+payload = bytes(range(256)) * 1024
+small = b"small"
+buffers = []
+encoded = cm.encode({"meta": small, "data": payload, "more": [bytearray(payload)]}, buffer_callback=buffers.append)
+test.equal(len(encoded) < 100, True)
+test.equal([type(buf) for buf in buffers], [memoryview, memoryview])
+test.equal(buffers[0].obj is payload, True)
+decoded = cm.decode(encoded, buffers=buffers)
+test.equal(decoded, {"meta": small, "data": payload, "more": [payload]})
+test.equal(type(decoded["data"]), memoryview)
+test.equal(decoded["data"].obj is payload, True)
+test.equal(cm.decode(cm.encode(payload)), payload)
+test.equal(cm.encode(payload, buffer_callback=None), cm.encode(payload))
+
+# Test if errors with out-of-band buffers are caught
+test.exception(lambda: cm.encode(payload, buffer_callback=1), TypeError)
+test.exception(lambda: cm.encode(payload, buffer_callback=lambda buf: 1 / 0), ZeroDivisionError)
+test.exception(lambda: cm.decode(encoded, buffers=[payload]), ValueError)
+test.exception(lambda: cm.decode(encoded, buffers=1), TypeError)
+test.exception(lambda: cm.decode(encoded), TypeError)
+
+# Test if integer arrays are packed, including values that wrap around at 64 bits
+timestamps = [1700000000000 + i * 1000 for i in range(1000)]
+edges = [2**63 - 1, -2**63, 0, 2**63 - 1, -2**63, 5, -7, 2**63 - 1, 1]
+test.equal(len(cm.encode(timestamps, int_arrays=True)) * 50 < len(cm.encode(timestamps)), True)
+test.equal(cm.decode(cm.encode(timestamps, int_arrays=True), int_arrays=True), timestamps)
+test.equal(cm.decode(cm.encode(tuple(timestamps), int_arrays=True), int_arrays=True), timestamps)
+test.equal(cm.decode(cm.encode(edges, int_arrays=True), int_arrays=True), edges)
+test.equal(cm.decode(cm.encode([(i * i) % 1000 - 500 for i in range(100)], int_arrays=True), int_arrays=True), [(i * i) % 1000 - 500 for i in range(100)])
+
+# Test if arrays with other values, short arrays, and arrays that would be larger packed are written regularly
+for value in [timestamps[:10] + ["x"], [True] * 10, [2**64 - 1] * 10, timestamps[:7], [0, 127] * 10]:
+    test.equal(cm.encode(value, int_arrays=True), cm.encode(value))
+
+# Test if packed arrays are numbered like arrays with shared references
+decoded = cm.decode(cm.encode([timestamps, timestamps], shared_refs=True, int_arrays=True), shared_refs=True, int_arrays=True)
+test.equal(decoded[0] is decoded[1], True)
+
+# Test if invalid packed arrays are caught
+test.exception(lambda: cm.decode(cm.encode(timestamps, int_arrays=True)), TypeError)
+test.exception(lambda: cm.decode(b"\xc7\x05\x7d\x00\x00\x00\x09\x01", int_arrays=True), ValueError)
+test.exception(lambda: cm.decode(b"\xc7\x15\x7d\xff\xff\xff\xff\x01" + b"\x00" * 16, int_arrays=True), ValueError)
+
+# Test if the slow hook reports oversized messages with their prefix
+reports = []
+cm.on_slow(0, 1000, lambda *args: reports.append(args), prefix_size=8)
+
+large = b"\x01" * 2000
+cm.encode(1)
+cm.decode(cm.encode(large))
+
+test.equal([(kind, size, prefix) for kind, _, size, prefix in reports], [("encode", 2003, cm.encode(large)[:8]), ("decode", 2003, cm.encode(large)[:8])])
+test.equal(all(isinstance(duration, float) for _, duration, _, _ in reports), True)
+
+# Test if sampling skips reports, and errors in the callback don't affect the result
+reports.clear()
+cm.on_slow(0, 1000, lambda *args: reports.append(args), sample_rate=0.0)
+cm.encode(large)
+test.equal(reports, [])
+
+import sys
+unraisable = []
+sys.unraisablehook = lambda info: unraisable.append(info.exc_type)
+
+cm.on_slow(0, 1000, lambda *args: 1 / 0)
+test.equal(cm.decode(cm.encode(large)), large)
+test.equal(unraisable, [ZeroDivisionError, ZeroDivisionError])
+
+sys.unraisablehook = sys.__unraisablehook__
+
+# Test if messages from other threads are still reported while the callback runs, and the callback can be replaced meanwhile
+import threading
+
+reports.clear()
+in_callback = threading.Event()
+release_callback = threading.Event()
+
+def blocking_callback(kind, *args):
+    reports.append(kind)
+
+    if threading.current_thread() is not threading.main_thread():
+        in_callback.set()
+        release_callback.wait(10)
+
+cm.on_slow(0, 1000, blocking_callback)
+blocked = threading.Thread(target=lambda: cm.encode(large))
+blocked.start()
+in_callback.wait(10)
+
+cm.decode(cm.encode(large))
+cm.on_slow(0, 1000, lambda *args: reports.append("replaced"))
+cm.encode(large)
+
+release_callback.set()
+blocked.join()
+test.equal(sorted(reports), ["decode", "encode", "encode", "replaced"])
+
+# Test if the slow hook can be removed, and invalid arguments are caught
+cm.on_slow(0, 1000, None)
+test.equal(cm.encode(large), cm.encode(large))
+
+test.exception(lambda: cm.on_slow(0, 1000, 1), TypeError)
+test.exception(lambda: cm.on_slow(-1, 1000, print), ValueError)
+test.exception(lambda: cm.on_slow(0, 1000, print, sample_rate=2.0), ValueError)
+
+
 test.print()
 
@@ -4,3 +4,5 @@ run(["python", "tests/regular.py"])
 run(["python", "tests/stream.py"])
 run(["python", "tests/filestream.py"])
 run(["python", "tests/extensions.py"])
+run(["python", "tests/patching.py"])
+run(["python", "tests/scanning.py"])
@@ -0,0 +1,73 @@
+# Test scanning multiple files
+
+import cmsgpack as cm
+
+from test_values import test_values
+from test import Test
+
+import os
+
+
+FNAMES = [f"scan_test_{i}.bin" for i in range(5)]
+
+test = Test()
+
+
+# Write a different number of records to each file
+expected = []
+for i, fname in enumerate(FNAMES):
+    open(fname, "wb")
+    stream = cm.FileStream(fname)
+
+    records = [{"file": i, "n": j} for j in range(i * 300)] + [test_values]
+    for v in records:
+        stream.encode(v)
+
+    expected.append(records)
+
+# Test if records are yielded per file, in order
+if test.success(lambda: list(cm.scan_files(FNAMES, threads=3))):
+    test.equal([v for records in expected for v in records], list(cm.scan_files(FNAMES, threads=3)))
+
+# Test if interleaved scanning yields all records, in order per file
+if test.success(lambda: list(cm.scan_files(FNAMES, threads=3, ordered=False))):
+    result = list(cm.scan_files(FNAMES, threads=3, ordered=False))
+    test.equal(sum(len(records) for records in expected), len(result))
+
+    for i, records in enumerate(expected):
+        test.equal(records[:-1], [v for v in result if isinstance(v, dict) and v.get("file") == i])
+
+# Test if FileStream arguments are passed on
+test.equal(expected[1], list(cm.scan_files([FNAMES[1]], threads=1, chunk_size=64, direct_io=True)))
+
+# Test if stopping early works
+scan = cm.scan_files(FNAMES, threads=2)
+test.equal(expected[0][0] if expected[0] else test_values, next(scan))
+test.success(scan.close)
+
+# Test if errors are caught
+test.equal([], list(cm.scan_files([])))
+test.exception(lambda: list(cm.scan_files(FNAMES, threads=0)), ValueError)
+test.exception(lambda: list(cm.scan_files(FNAMES, threads="1")), TypeError)
+test.exception(lambda: list(cm.scan_files([123])), TypeError)
+
+# Test if missing files raise an error, without creating them
+test.exception(lambda: list(cm.scan_files(["scan_test_missing.bin"])), FileNotFoundError)
+test.equal(False, os.path.exists("scan_test_missing.bin"))
+
+# Test if a record cut off at the end of a file raises an error
+open(FNAMES[3], "ab").write(cm.encode(["torn"] * 10)[:-3])
+test.exception(lambda: list(cm.scan_files([FNAMES[3]])), EOFError)
+
+# Test if this includes a truncated value larger than the chunk size, which is read straight from the file
+open(FNAMES[4], "ab").write(cm.encode("x" * 1000)[:-10])
+test.exception(lambda: list(cm.scan_files([FNAMES[4]], chunk_size=64)), EOFError)
+
+# Test if errors raised while decoding are passed on
+open(FNAMES[2], "ab").write(b"\xc1")
+test.exception(lambda: list(cm.scan_files(FNAMES)), ValueError)
+
+test.print()
+
+for fname in FNAMES:
+    os.remove(fname)
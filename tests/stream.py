@@ -26,6 +26,15 @@ dec = stream.decode
 if test.success(lambda: dec(enc(test_values))):
     test.equal(test_values, dec(enc(test_values)))
 
+# Test if attributes can be modified
+stream.raw_depth = 1
+if test.equal(1, stream.raw_depth):
+    test.equal(cm.encode(test_values), bytes(dec(enc([test_values]))[0]))
+
+stream.raw_depth = 0
+test.exception(lambda: setattr(stream, "raw_depth", -1), ValueError)
+test.exception(lambda: setattr(stream, "extensions", 123), TypeError)
+
 # Test if string-keys-only is enforced when requested
 test.exception(lambda: enc({1: 2}, str_keys=True), TypeError)
 test.exception(lambda: dec(enc({1: 2}), str_keys=True), TypeError)
@@ -49,6 +58,95 @@ test.exception(lambda: cm.Stream(invalid_kwarg=123), TypeError)
 # Test if valid args are accepted
 test.success(lambda: cm.Stream(extensions=cm.Extensions()))
 
+# Test if the stream returns the hash of the data when set
+stream = cm.Stream(hash="xxh64")
+test.equal(stream.hash, "xxh64")
+test.equal(stream.encode("123456789"), cm.encode("123456789", hash="xxh64"))
+
+stream.hash = "crc32c"
+test.equal(stream.encode([1, 2]), cm.encode([1, 2], hash="crc32c"))
+
+stream.hash = None
+test.equal(stream.encode([1, 2]), cm.encode([1, 2]))
+
+test.exception(lambda: cm.Stream(hash="md5"), ValueError)
+test.exception(lambda: setattr(stream, "hash", "md5"), ValueError)
+
+# Test if the stream uses shared references when set
+stream = cm.Stream(shared_refs=True)
+test.equal(stream.shared_refs, True)
+
+shared = [1, 2]
+decoded = stream.decode(stream.encode([shared, shared]))
+test.equal(decoded[0] is decoded[1], True)
+
+stream.raw_depth = 1
+test.exception(lambda: stream.decode(stream.encode([shared])), ValueError)
+
+stream.shared_refs = False
+test.equal(stream.encode([shared, shared]), cm.encode([shared, shared]))
+
+test.exception(lambda: cm.Stream(shared_refs=True, raw_depth=1), ValueError)
+
+# Test if the stream packs integer arrays when set
+stream = cm.Stream(int_arrays=True)
+test.equal(stream.int_arrays, True)
+
+counters = list(range(0, 1000, 10))
+test.equal(stream.encode(counters), cm.encode(counters, int_arrays=True))
+test.equal(stream.decode(stream.encode(counters)), counters)
+
+stream.int_arrays = False
+test.equal(stream.encode(counters), cm.encode(counters))
+
+# Test if repeated messages are served from the decode cache, as copies that don't affect later hits
+stream = cm.Stream(decode_cache=8)
+test.equal(stream.decode_cache, 8)
+
+heartbeat = cm.encode({"type": "heartbeat", "ids": [1, 2, 3]})
+first = stream.decode(heartbeat)
+second = stream.decode(bytearray(heartbeat))
+test.equal(first, second)
+test.equal(first is second or first["ids"] is second["ids"], False)
+
+second["ids"].append(4)
+test.equal(stream.decode(heartbeat), {"type": "heartbeat", "ids": [1, 2, 3]})
+test.equal(stream.cache_stats, {"hits": 2, "misses": 1, "size": 1, "capacity": 8})
+
+# Test if objects that can't be copied, large messages, and shared references bypass the cache
+raw_stream = cm.Stream(raw_depth=1, decode_cache=8)
+raw_stream.decode(cm.encode([1]))
+test.equal(raw_stream.cache_stats["size"], 0)
+
+stream.decode(cm.encode("x" * 5000))
+test.equal(stream.cache_stats["size"], 1)
+
+class Key:
+    def __init__(self, data):
+        self.data = bytearray(data)
+
+ext_keys = cm.Extensions()
+ext_keys.add_decode(1, Key)
+key_stream = cm.Stream(extensions=ext_keys, decode_cache=8)
+key_stream.decode(b"\x81\xd4\x01\x00\x01")
+test.equal(key_stream.cache_stats["size"], 0)
+
+stream.shared_refs = True
+test.equal(stream.decode(heartbeat), {"type": "heartbeat", "ids": [1, 2, 3]})
+test.equal(stream.cache_stats["hits"], 2)
+
+# Test if changing options clears the cache, and invalid sizes are caught
+stream.shared_refs = False
+stream.str_keys = True
+test.equal(stream.cache_stats, {"hits": 0, "misses": 0, "size": 0, "capacity": 8})
+test.exception(lambda: stream.decode(cm.encode({1: 2})), TypeError)
+
+stream.decode_cache = 0
+stream.decode(heartbeat)
+test.equal(stream.cache_stats, {"hits": 0, "misses": 0, "size": 0, "capacity": 0})
+test.exception(lambda: cm.Stream(decode_cache=-1), ValueError)
+test.exception(lambda: setattr(stream, "decode_cache", "8"), TypeError)
+
 
 test.print()
 